@@ -0,0 +1,340 @@
+#include <Raphael/commands.h>
+#include <Raphael/nnue.h>
+#include <Raphael/nnue_kernels.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace raphael;
+using std::copy;
+using std::cout;
+using std::fixed;
+using std::flush;
+using std::ifstream;
+using std::left;
+using std::make_unique;
+using std::mt19937_64;
+using std::right;
+using std::setprecision;
+using std::setw;
+using std::string;
+using std::uniform_int_distribution;
+using std::vector;
+namespace ch = std::chrono;
+
+
+
+namespace raphael {
+class NnueMicrobench {
+public:
+    static constexpr i32 WALK_PLIES = 32;  // random plies played from each start position
+    static constexpr i32 FUSED_PLIES = 4;  // plies per fused accumulator update
+
+    NnueMicrobench(const vector<string>& fens, i32 rounds)
+        : rounds(rounds), net(make_unique<Nnue>()), kernels(Nnue::kernels()) {
+        generate_walks(fens);
+        collect_updates();
+        collect_accumulators();
+    }
+
+    void run() {
+        cout << "microbench: " << kernels.name << " nnue kernels, " << n_positions
+             << " positions, " << rounds << " rounds\n\n"
+             << left << setw(36) << "kernel" << right << setw(12) << "ns/call" << setw(14)
+             << "Mcalls/s" << "\n"
+             << flush;
+
+        nnue_kernels::ForwardProfile profile;
+        for (i32 r = 0; r < rounds; r++)
+            kernels.profile_forward(
+                *net->params, &accs[0].values, buckets.data(), n_positions, profile
+            );
+        const u64 forward_calls = (u64)rounds * n_positions;
+        report("activate_l0 (both perspectives)", profile.activate_ns, forward_calls);
+        report("forward_l1 (sparse)", profile.l1_sparse_ns, forward_calls);
+        report("forward_l1 (dense)", profile.l1_dense_ns, forward_calls);
+        report("forward_l2l3", profile.l2l3_ns, forward_calls);
+
+        bench_accumulator_update();
+        bench_fused_update();
+        bench_finny_update();
+        bench_evaluate_incremental();
+        bench_evaluate_refresh();
+
+        const f64 avg_nnz = f64(profile.nnz_blocks) / f64(forward_calls);
+        cout << "\navg nnz blocks: " << fixed << setprecision(2) << avg_nnz << " of "
+             << Nnue::L1_SIZE / 4 << " (" << 100.0 * avg_nnz / (Nnue::L1_SIZE / 4) << "%)\n"
+             << "checksum: " << profile.checksum + checksum << "\n"
+             << flush;
+    }
+
+private:
+    struct Walk {
+        chess::Board start;
+        vector<chess::Move> moves;
+    };
+
+    struct PlyUpdate {
+        nnue_kernels::AccumulatorUpdate update;
+        i32 bucket;
+        i32 chain;  // id shared by consecutive updates of the same walk, perspective and bucket
+    };
+
+    struct AccumulatorPair {
+        alignas(Nnue::MEM_ALIGNMENT) i16 values[2][Nnue::L1_SIZE];
+    };
+
+    i32 rounds;
+    std::unique_ptr<Nnue> net;
+    const nnue_kernels::Kernels& kernels;
+    i64 checksum = 0;
+
+    vector<Walk> walks;
+    vector<PlyUpdate> updates;
+    std::unique_ptr<AccumulatorPair[]> accs;
+    vector<i32> buckets;
+    i32 n_positions = 0;
+
+
+    void report(const string& name, u64 ns, u64 calls) const {
+        const f64 ns_per_call = f64(ns) / f64(calls);
+        cout << left << setw(36) << name << right << fixed << setprecision(1) << setw(12)
+             << ns_per_call << setw(14) << setprecision(3) << 1000.0 / ns_per_call << "\n"
+             << flush;
+    }
+
+    static u64 elapsed_ns(ch::steady_clock::time_point start) {
+        return ch::duration_cast<ch::nanoseconds>(ch::steady_clock::now() - start).count();
+    }
+
+    void generate_walks(const vector<string>& fens) {
+        mt19937_64 generator(0);
+        chess::MoveList<chess::ScoredMove> movelist;
+
+        for (const auto& fen : fens) {
+            Walk walk{.start = chess::Board(fen), .moves = {}};
+            auto board = walk.start;
+
+            for (i32 ply = 0; ply < WALK_PLIES; ply++) {
+                movelist.clear();
+                chess::Movegen::generate_legals(movelist, board);
+                if (movelist.size() == 0) break;
+
+                uniform_int_distribution<u64> distribution(0, movelist.size() - 1);
+                const auto move = movelist[distribution(generator)].move;
+                walk.moves.push_back(move);
+                board.make_move(move);
+            }
+
+            n_positions += walk.moves.size();
+            walks.push_back(walk);
+        }
+    }
+
+    void collect_updates() {
+        i32 chain = 0;
+        for (const auto& walk : walks) {
+            net->set_board(walk.start);
+            auto board = walk.start;
+            i32 prev_bucket[2] = {-1, -1};
+            i32 chain_ids[2] = {-1, -1};
+
+            for (const auto move : walk.moves) {
+                net->make_move(board, move);
+                board.make_move(move);
+
+                for (const auto perspective : {chess::Color::WHITE, chess::Color::BLACK}) {
+                    auto& acc = net->accumulators[net->idx_][perspective];
+                    if (acc.needs_refresh) continue;
+
+                    const auto king_sq = board.king_square(perspective);
+                    const bool mirror = Nnue::needs_mirroring(king_sq);
+                    const i32 bucket = Nnue::king_bucket(king_sq, perspective);
+                    if (bucket != prev_bucket[perspective]) chain_ids[perspective] = chain++;
+                    prev_bucket[perspective] = bucket;
+
+                    PlyUpdate ply{.update = {}, .bucket = bucket, .chain = chain_ids[perspective]};
+                    acc.take_update(ply.update, perspective, mirror);
+                    updates.push_back(ply);
+                }
+            }
+        }
+    }
+
+    void collect_accumulators() {
+        accs = make_unique<AccumulatorPair[]>(n_positions);
+        buckets.resize(n_positions);
+
+        i32 i = 0;
+        for (const auto& walk : walks) {
+            net->set_board(walk.start);
+            auto board = walk.start;
+
+            for (const auto move : walk.moves) {
+                net->make_move(board, move);
+                board.make_move(move);
+                net->evaluate(board);
+
+                const auto& stm_acc = net->accumulators[net->idx_][board.stm()];
+                const auto& ntm_acc = net->accumulators[net->idx_][~board.stm()];
+                copy(stm_acc.values, stm_acc.values + Nnue::L1_SIZE, accs[i].values[0]);
+                copy(ntm_acc.values, ntm_acc.values + Nnue::L1_SIZE, accs[i].values[1]);
+                buckets[i] = Nnue::output_bucket(board);
+                i++;
+            }
+        }
+    }
+
+    void bench_accumulator_update() {
+        auto bufs = make_unique<AccumulatorPair>();
+        u64 ns = 0;
+
+        for (i32 r = 0; r < rounds; r++) {
+            const auto start = ch::steady_clock::now();
+            for (usize i = 0; i < updates.size(); i++) {
+                auto update = updates[i].update;
+                update.values = bufs->values[(i + 1) % 2];
+                kernels.update_accumulators(
+                    bufs->values[i % 2], net->params->W0[updates[i].bucket], &update, 1
+                );
+            }
+            ns += elapsed_ns(start);
+        }
+        checksum += bufs->values[0][0];
+        report("accumulator update", ns, (u64)rounds * updates.size());
+    }
+
+    void bench_fused_update() {
+        // gather runs of FUSED_PLIES consecutive updates applied on top of each other
+        vector<vector<nnue_kernels::AccumulatorUpdate>> runs;
+        vector<i32> run_buckets;
+        for (usize i = 0; i < updates.size();) {
+            usize j = i;
+            vector<nnue_kernels::AccumulatorUpdate> run;
+            for (; j < updates.size() && updates[j].chain == updates[i].chain; j++) {
+                if (run.size() < FUSED_PLIES) run.push_back(updates[j].update);
+                if (run.size() == FUSED_PLIES) {
+                    runs.push_back(run);
+                    run_buckets.push_back(updates[i].bucket);
+                    run.clear();
+                }
+            }
+            i = j;
+        }
+        if (runs.empty()) return;
+
+        auto bufs = make_unique<AccumulatorPair[]>(FUSED_PLIES);
+        u64 ns = 0;
+        for (i32 r = 0; r < rounds; r++) {
+            const auto start = ch::steady_clock::now();
+            for (usize i = 0; i < runs.size(); i++) {
+                for (i32 k = 0; k < FUSED_PLIES; k++)
+                    runs[i][k].values = bufs[(k + 1) % FUSED_PLIES].values[0];
+                kernels.update_accumulators(
+                    bufs[0].values[0], net->params->W0[run_buckets[i]], runs[i].data(), FUSED_PLIES
+                );
+            }
+            ns += elapsed_ns(start);
+        }
+        checksum += bufs[0].values[0][0];
+        report("accumulator update (4 ply fused)", ns, (u64)rounds * runs.size() * FUSED_PLIES);
+    }
+
+    void bench_finny_update() {
+        u64 ns = 0;
+        u64 calls = 0;
+
+        for (i32 r = 0; r < rounds; r++) {
+            auto fresh = make_unique<Nnue>();
+            const auto start = ch::steady_clock::now();
+            for (const auto& walk : walks) {
+                auto board = walk.start;
+                for (const auto move : walk.moves) {
+                    board.make_move(move);
+                    for (const auto perspective : {chess::Color::WHITE, chess::Color::BLACK}) {
+                        const auto king_sq = board.king_square(perspective);
+                        const bool mirror = Nnue::needs_mirroring(king_sq);
+                        const i32 bucket = Nnue::king_bucket(king_sq, perspective);
+                        fresh->finny_table[perspective][mirror][bucket].update(
+                            kernels, fresh->params->W0[bucket], board, perspective, mirror
+                        );
+                        calls++;
+                    }
+                }
+            }
+            ns += elapsed_ns(start);
+        }
+        report("finny update", ns, calls);
+    }
+
+    void bench_evaluate_incremental() {
+        u64 ns = 0;
+        for (i32 r = 0; r < rounds; r++) {
+            const auto start = ch::steady_clock::now();
+            for (const auto& walk : walks) {
+                net->set_board(walk.start);
+                auto board = walk.start;
+                for (const auto move : walk.moves) {
+                    net->make_move(board, move);
+                    board.make_move(move);
+                    checksum += net->evaluate(board);
+                }
+            }
+            ns += elapsed_ns(start);
+        }
+        report("evaluate (incremental)", ns, (u64)rounds * n_positions);
+    }
+
+    void bench_evaluate_refresh() {
+        u64 ns = 0;
+        for (i32 r = 0; r < rounds; r++) {
+            const auto start = ch::steady_clock::now();
+            for (const auto& walk : walks) {
+                auto board = walk.start;
+                for (const auto move : walk.moves) {
+                    board.make_move(move);
+                    net->set_board(board);
+                    checksum += net->evaluate(board);
+                }
+            }
+            ns += elapsed_ns(start);
+        }
+        report("evaluate (refresh)", ns, (u64)rounds * n_positions);
+    }
+};
+}  // namespace raphael
+
+
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        cout << "usage: " << argv[0] << " [book] [rounds]\n" << flush;
+        return 1;
+    }
+
+    vector<string> fens;
+    if (argc >= 2) {
+        ifstream file(argv[1]);
+        if (!file) {
+            cout << "could not open book: " << argv[1] << "\n" << flush;
+            return 1;
+        }
+
+        string fen;
+        while (getline(file, fen))
+            if (!fen.empty()) fens.push_back(fen);
+    } else {
+        for (const auto fen : commands::bench_fens()) fens.push_back(fen);
+    }
+    const i32 rounds = (argc >= 3) ? std::stoi(argv[2]) : 20;
+
+    NnueMicrobench microbench(fens, rounds);
+    microbench.run();
+
+    return 0;
+}
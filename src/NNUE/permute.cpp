@@ -1,74 +1,118 @@
 #include <Raphael/nnue.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 using namespace raphael;
 using std::cout;
 using std::flush;
 using std::ifstream;
 using std::make_unique;
+using std::memcpy;
 using std::ofstream;
 using std::runtime_error;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 
 
+template <typename Params>
 class NnuePreprocessor {
 public:
-    NnuePreprocessor(const string& filename)
-        : filename(filename),
-          original_params(make_unique<Nnue::NnueParams>()),
-          processed_params(make_unique<Nnue::NnueParams>()) {
+    NnuePreprocessor(const string& filename) : filename(filename), params(make_unique<Params>()) {
         load_network();
     };
 
     void permute_network() {
-        const auto current_perm = original_params->permutation;
-        const auto current_idx = static_cast<u8>(current_perm);
-        if (current_idx > 2) throw runtime_error("invalid network permutation");
-        if (current_idx == target_idx) return;
+        if (params->permutation == Nnue::TARGET_PERM) return;
 
-        // create inverse perm
-        u8 inv_perms[8];
-        for (usize i = 0; i < 8; i++) inv_perms[PERMS[current_idx][i]] = i;
+        Nnue::permute_network(*params, Nnue::TARGET_PERM);
+        write_network();
+
+        // send warning that our net isn't permuted for optimal sparsity
+        if (!params->sparsity_permed)
+            cout << "\033[35mWARNING: network not permuted for sparsity\033[0m\n" << flush;
+    }
 
-        // create composed perms
-        u8 perms[8];
-        for (usize i = 0; i < 8; i++) perms[i] = PERMS[target_idx][inv_perms[i]];
+    void permute_neurons(const string& order_filename) {
+        ifstream file(order_filename);
+        if (!file.is_open()) throw runtime_error("could not open " + order_filename);
 
-        apply_perm(perms);
-        processed_params->permutation = static_cast<Nnue::NnuePerm>(target_idx);
+        vector<i32> order;
+        i32 idx;
+        while (file >> idx) order.push_back(idx);
+        file.close();
 
+        Nnue::permute_neurons(*params, order);
         write_network();
+        cout << "applied neuron order from " << order_filename << "\n" << flush;
+    }
 
-        // send warning that our net isn't permuted for optimal sparsity
-        if (!processed_params->sparsity_permed)
-            cout << "\033[35mWARNING: network not permuted for sparsity\033[0m\n" << flush;
+    void narrow_network(const string& narrow_filename) {
+        auto narrow = make_unique<Nnue::NnueParamsT<i8>>();
+
+        // every W0 weight must fit, since accumulators are only exact if no weight is clipped
+        usize out_of_range = 0;
+        i16 min_w = 0;
+        i16 max_w = 0;
+        const auto& W0 = params->W0;
+        for (usize b = 0; b < Nnue::N_INBUCKETS; b++) {
+            for (usize i = 0; i < Nnue::N_INPUTS; i++) {
+                for (usize j = 0; j < Nnue::L1_SIZE; j++) {
+                    const i16 w = W0[b][i][j];
+                    min_w = std::min(min_w, w);
+                    max_w = std::max(max_w, w);
+                    out_of_range += (w < INT8_MIN || w > INT8_MAX);
+                    narrow->W0[b][i][j] = w;
+                }
+            }
+        }
+        if (out_of_range)
+            throw runtime_error(
+                std::to_string(out_of_range) + " W0 weights of " + filename + " don't fit in i8 ("
+                + std::to_string(min_w) + " to " + std::to_string(max_w) + ")"
+            );
+
+        memcpy(narrow->b0, params->b0, sizeof(narrow->b0));
+        memcpy(narrow->W1, params->W1, sizeof(narrow->W1));
+        memcpy(narrow->b1, params->b1, sizeof(narrow->b1));
+        memcpy(narrow->W2, params->W2, sizeof(narrow->W2));
+        memcpy(narrow->b2, params->b2, sizeof(narrow->b2));
+        memcpy(narrow->W3, params->W3, sizeof(narrow->W3));
+        memcpy(narrow->b3, params->b3, sizeof(narrow->b3));
+        narrow->permutation = params->permutation;
+        narrow->sparsity_permed = params->sparsity_permed;
+
+        write_file(narrow_filename, *narrow);
+        cout << "converted W0 of " << filename << " to i8 in " << narrow_filename << " ("
+             << sizeof(Params) / 1024 << " KB -> " << sizeof(*narrow) / 1024 << " KB)\n"
+             << flush;
     }
 
-private:
-    string filename;
-    unique_ptr<Nnue::NnueParams> original_params;
-    unique_ptr<Nnue::NnueParams> processed_params;
+    void pack_network(const string& packed_filename) {
+        const auto packed = Nnue::pack_network(*params);
 
-    static constexpr u8 PERMS[3][8] = {
-        {0, 1, 2, 3, 4, 5, 6, 7}, // generic
-        {0, 2, 1, 3, 4, 6, 5, 7}, // avx2
-        {0, 4, 1, 5, 2, 6, 3, 7}, // avx512
-    };
+        ofstream file(packed_filename, std::ios::binary);
+        if (!file.is_open()) throw runtime_error("could not open " + packed_filename);
+        file.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+        file.close();
+
+        cout << "packed " << filename << " into " << packed_filename << " ("
+             << sizeof(Params) / 1024 << " KB -> " << packed.size() / 1024 << " KB)\n"
+             << flush;
+    }
 
-#ifdef USE_AVX512
-    static constexpr u8 target_idx = 2;
-#elif defined(USE_AVX2)
-    static constexpr u8 target_idx = 1;
-#else
-    static constexpr u8 target_idx = 0;
-#endif
+private:
+    string filename;
+    unique_ptr<Params> params;
 
 
     void load_network() {
@@ -77,67 +121,52 @@ private:
 
         file.seekg(0, std::ios::end);
         const auto netfile_size = file.tellg();
-        constexpr usize padded_size = 64 * ((sizeof(Nnue::NnueParams) + 63) / 64);
+        constexpr usize padded_size = 64 * ((sizeof(Params) + 63) / 64);
         if (netfile_size != padded_size)
             throw runtime_error("network file and architecture doesn't match");
         file.seekg(0, std::ios::beg);
 
-        file.read(reinterpret_cast<char*>(original_params.get()), sizeof(Nnue::NnueParams));
+        file.read(reinterpret_cast<char*>(params.get()), sizeof(Params));
         file.close();
-
-        *processed_params = *original_params;
     }
 
-    void write_network() {
+    void write_network() { write_file(filename, *params); }
+
+    template <typename Net>
+    static void write_file(const string& filename, const Net& net) {
         ofstream file(filename, std::ios::binary);
         if (!file.is_open()) throw runtime_error("could not open " + filename);
 
-        file.write(reinterpret_cast<char*>(processed_params.get()), sizeof(Nnue::NnueParams));
+        file.write(reinterpret_cast<const char*>(&net), sizeof(Net));
         file.close();
     }
-
-
-    void apply_perm(const u8 perm[8]) {
-        // permute W0 to cancel out packus
-        for (usize b = 0; b < Nnue::N_INBUCKETS; b++) {
-            for (usize i = 0; i < Nnue::N_INPUTS; i++) {
-                for (usize j = 0; j < Nnue::L1_SIZE; j += 64) {
-                    const auto src = &original_params->W0[b][i][j];
-                    auto dst = &processed_params->W0[b][i][j];
-
-                    for (usize jj = 0; jj < 64; jj++) {
-                        const auto src_chunk = jj / 8;
-                        const auto dst_chunk = perm[src_chunk];
-                        const auto offset = jj % 8;
-                        dst[8 * dst_chunk + offset] = src[jj];
-                    }
-                }
-            }
-        }
-
-        // permute b0 to cancel out packus
-        for (usize j = 0; j < Nnue::L1_SIZE; j += 64) {
-            const auto src = &original_params->b0[j];
-            auto dst = &processed_params->b0[j];
-
-            for (usize jj = 0; jj < 64; jj++) {
-                const auto src_chunk = jj / 8;
-                const auto dst_chunk = perm[src_chunk];
-                const auto offset = jj % 8;
-                dst[8 * dst_chunk + offset] = src[jj];
-            }
-        }
-    }
 };
 
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        cout << "usage: " << argv[0] << " <network_file>\n" << flush;
+    const string mode = (argc >= 2) ? argv[1] : "";
+    if (argc < 2 || ((mode == "--pack" || mode == "--i8") && argc != 4)) {
+        cout << "usage: " << argv[0] << " <network_file> [neuron_order_file]\n"
+             << "       " << argv[0] << " --i8 <network_file> <i8_file>\n"
+             << "       " << argv[0] << " --pack <network_file> <packed_file>\n"
+             << flush;
         return 1;
     }
 
-    NnuePreprocessor pre(argv[1]);
+    // trained networks are always i16, only --pack reads the build's own layout
+    if (mode == "--i8") {
+        NnuePreprocessor<Nnue::NnueParamsI16> pre(argv[2]);
+        pre.narrow_network(argv[3]);
+        return 0;
+    }
+    if (mode == "--pack") {
+        NnuePreprocessor<Nnue::NnueParams> pre(argv[2]);
+        pre.pack_network(argv[3]);
+        return 0;
+    }
+
+    NnuePreprocessor<Nnue::NnueParamsI16> pre(argv[1]);
+    if (argc >= 3) pre.permute_neurons(argv[2]);
     pre.permute_network();
 
     return 0;
@@ -0,0 +1,53 @@
+#include <Raphael/EvalCache.h>
+
+using namespace raphael;
+using std::make_unique;
+using std::memory_order_relaxed;
+
+
+
+EvalCache::EvalCache(i32 size_mb) { resize(size_mb); }
+
+void EvalCache::resize(i32 size_mb) {
+    assert(size_mb >= 0 && size_mb <= MAX_CACHE_SIZE_MB);
+    size_ = static_cast<usize>(size_mb) * 1024 * 1024 / sizeof(Entry);
+    table_ = (size_) ? make_unique<Entry[]>(size_) : nullptr;
+}
+
+bool EvalCache::enabled() const { return size_ != 0; }
+
+bool EvalCache::probe(u64 key, i32& eval) const {
+    assert(enabled());
+    const auto& entry = table_[index(key)];
+    const u64 data = entry.data.load(memory_order_relaxed);
+    const u64 check = entry.check.load(memory_order_relaxed);
+
+    // an empty slot has no valid bit and a torn slot fails the xor check
+    if (!(data & VALID_BIT) || (check ^ data) != key) return false;
+    eval = static_cast<i32>(static_cast<u32>(data));
+    return true;
+}
+
+void EvalCache::prefetch(u64 key) const {
+    if (enabled()) __builtin_prefetch(&table_[index(key)]);
+}
+
+void EvalCache::store(u64 key, i32 eval) {
+    assert(enabled());
+    auto& entry = table_[index(key)];
+    const u64 data = VALID_BIT | static_cast<u32>(eval);
+    entry.data.store(data, memory_order_relaxed);
+    entry.check.store(key ^ data, memory_order_relaxed);
+}
+
+void EvalCache::clear() {
+    for (usize i = 0; i < size_; i++) {
+        table_[i].check.store(0, memory_order_relaxed);
+        table_[i].data.store(0, memory_order_relaxed);
+    }
+}
+
+usize EvalCache::index(u64 key) const {
+    // key >> 64 = 0~1, index at this fraction of the way through size_
+    return static_cast<usize>((static_cast<u128>(key) * static_cast<u128>(size_)) >> 64);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <chess/include.h>
+
+#include <atomic>
+#include <memory>
+
+
+
+namespace raphael {
+class EvalCache {
+public:
+    static constexpr i32 MAX_CACHE_SIZE_MB = 1024;
+    static constexpr i32 DEF_CACHE_SIZE_MB = 8;
+
+    /** A single cached eval. The key is stored xored with the data so a torn write from another
+     * thread fails verification instead of returning the wrong eval
+     */
+    struct Entry {
+        std::atomic<u64> check;  // zobrist hash of position ^ data
+        std::atomic<u64> data;   // valid bit << 32 | eval
+    };
+    static_assert(sizeof(Entry) == 16);
+
+private:
+    static constexpr u64 VALID_BIT = 1ULL << 32;
+
+    std::unique_ptr<Entry[]> table_;
+    usize size_ = 0;
+
+
+
+public:
+    /** Initializes the eval cache
+     *
+     * \param size_mb cache size in MiB, 0 to disable the cache
+     */
+    explicit EvalCache(i32 size_mb);
+
+    /** Resizes and clears the cache
+     *
+     * \param size_mb cache size in MiB, 0 to disable the cache
+     */
+    void resize(i32 size_mb);
+
+    /** Returns whether the cache has any entries to probe and store to
+     *
+     * \returns whether the cache is enabled
+     */
+    bool enabled() const;
+
+    /** Retrieves the cached eval for a given key
+     *
+     * \param key zobrist hash of position
+     * \param eval variable to put the eval into
+     * \returns whether the eval for this exact key was found
+     */
+    bool probe(u64 key, i32& eval) const;
+
+    /** Prefetches a cache entry
+     *
+     * \param key key to prefetch
+     */
+    void prefetch(u64 key) const;
+
+    /** Stores the eval for a given key, replacing whatever was in its slot
+     *
+     * \param key zobrist hash of position
+     * \param eval eval of the position
+     */
+    void store(u64 key, i32 eval);
+
+    /** Clears the cache */
+    void clear();
+
+private:
+    /** Returns the slot of a key
+     *
+     * \param key zobrist hash of position
+     * \returns the index into the table
+     */
+    usize index(u64 key) const;
+};
+}  // namespace raphael
@@ -43,7 +43,9 @@ History::History()
       pawn_correction_{},
       major_correction_{},
       nonpawn_correction_{},
-      cont_correction_{} {}
+      cont_correction_{},
+      cont_generation_{},
+      cont_corr_generation_{} {}
 
 
 i32 History::bonus(i32 fdepth, i32 depth_mul, i32 base_bonus, i32 max_bonus) const {
@@ -159,12 +161,18 @@ i32 History::get_correction(const Position<true>& position) const {
 
 void History::clear() {
     memset(butterfly_hist_, 0, sizeof(butterfly_hist_));
-    memset(cont_hist_, 0, sizeof(cont_hist_));
     memset(capt_hist_, 0, sizeof(capt_hist_));
     memset(pawn_correction_, 0, sizeof(pawn_correction_));
     memset(major_correction_, 0, sizeof(major_correction_));
     memset(nonpawn_correction_, 0, sizeof(nonpawn_correction_));
-    memset(cont_correction_, 0, sizeof(cont_correction_));
+
+    // blocks from an older generation read as zero and are zeroed on their first write
+    if (++generation_ == 0) {
+        memset(cont_hist_, 0, sizeof(cont_hist_));
+        memset(cont_correction_, 0, sizeof(cont_correction_));
+        memset(cont_generation_, 0, sizeof(cont_generation_));
+        memset(cont_corr_generation_, 0, sizeof(cont_corr_generation_));
+    }
 }
 
 
@@ -187,6 +195,8 @@ const HistoryEntry& History::cont_entry(
     assert(moving != chess::Piece::NONE);
     assert(prev_move.move);
     assert(prev_move.moving != chess::Piece::NONE);
+    static constexpr HistoryEntry EMPTY{};
+    if (cont_generation_[prev_move.moving][prev_move.move.to()] != generation_) return EMPTY;
     return cont_hist_[prev_move.moving][prev_move.move.to()][moving][move.to()];
 }
 HistoryEntry& History::cont_entry(
@@ -196,7 +206,13 @@ HistoryEntry& History::cont_entry(
     assert(moving != chess::Piece::NONE);
     assert(prev_move.move);
     assert(prev_move.moving != chess::Piece::NONE);
-    return cont_hist_[prev_move.moving][prev_move.move.to()][moving][move.to()];
+    auto& block = cont_hist_[prev_move.moving][prev_move.move.to()];
+    auto& generation = cont_generation_[prev_move.moving][prev_move.move.to()];
+    if (generation != generation_) {
+        memset(block, 0, sizeof(block));
+        generation = generation_;
+    }
+    return block[moving][move.to()];
 }
 
 const HistoryEntry& History::capt_entry(chess::Move move, chess::Piece captured) const {
@@ -236,6 +252,8 @@ const CorrectionEntry& History::cont_corr_entry(
     assert(moving != chess::Piece::NONE);
     assert(prev_move.move);
     assert(prev_move.moving != chess::Piece::NONE);
+    static constexpr CorrectionEntry EMPTY{};
+    if (cont_corr_generation_[prev_move.moving][prev_move.move.to()] != generation_) return EMPTY;
     return cont_correction_[prev_move.moving][prev_move.move.to()][moving][move.to()];
 }
 CorrectionEntry& History::cont_corr_entry(
@@ -245,5 +263,11 @@ CorrectionEntry& History::cont_corr_entry(
     assert(moving != chess::Piece::NONE);
     assert(prev_move.move);
     assert(prev_move.moving != chess::Piece::NONE);
-    return cont_correction_[prev_move.moving][prev_move.move.to()][moving][move.to()];
+    auto& block = cont_correction_[prev_move.moving][prev_move.move.to()];
+    auto& generation = cont_corr_generation_[prev_move.moving][prev_move.move.to()];
+    if (generation != generation_) {
+        memset(block, 0, sizeof(block));
+        generation = generation_;
+    }
+    return block[moving][move.to()];
 }
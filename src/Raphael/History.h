@@ -48,6 +48,12 @@ private:
     CorrectionEntry nonpawn_correction_[2][2][CORRHIST_SIZE];  // [stm][color][nonpawn_hash idx]
     CorrectionEntry cont_correction_[12][64][12][64];          // [prev from][prev to][from][to]
 
+    // the continuation histories are most of the size, so instead of being zeroed on clear, each
+    // [prev from][prev to] block is treated as zero until it is written in the current generation
+    u8 generation_ = 0;
+    u8 cont_generation_[12][64];       // [prev from][prev to]
+    u8 cont_corr_generation_[12][64];  // [prev from][prev to]
+
 public:
     /** Initializes all the history tables with zeros */
     History();
@@ -123,7 +129,9 @@ public:
     i32 get_correction(const Position<true>& position) const;
 
 
-    /** Zeros out all the histories */
+    /** Zeros out all the histories. The continuation histories are invalidated in O(1) and only
+     * fully zeroed when the generation wraps around
+     */
     void clear();
 
 private:
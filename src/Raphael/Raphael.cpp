@@ -2,6 +2,7 @@
 #include <Raphael/SEE.h>
 #include <Raphael/consts.h>
 #include <Raphael/movepick.h>
+#include <Raphael/numa.h>
 #include <Raphael/utils.h>
 #include <Raphael/wdl.h>
 
@@ -27,6 +28,7 @@ using std::memory_order_relaxed;
 using std::memory_order_release;
 using std::memset;
 using std::min;
+using std::span;
 using std::string;
 using std::swap;
 
@@ -38,9 +40,17 @@ const Raphael::EngineOptions& Raphael::default_params() {
     static EngineOptions opts{
         .hash
         = {"Hash", TranspositionTable::DEF_TABLE_SIZE_MB, 1, TranspositionTable::MAX_TABLE_SIZE_MB},
+        .evalcache = {"EvalCache", EvalCache::DEF_CACHE_SIZE_MB, 0, EvalCache::MAX_CACHE_SIZE_MB},
+        .largepages = {"LargePages", "thp", {"off", "thp", "hugetlb-2M", "hugetlb-1G"}},
         .threads = {"Threads", 1, 1, 1024},
         .moveoverhead = {"MoveOverhead", 10, 0, 5000},
         .chess960 = {"UCI_Chess960", false},
+        .evalfile = {"EvalFile", Nnue::EMBEDDED_NETWORK},
+        .smallevalfile = {"SmallEvalFile", Nnue::NO_SMALL_NETWORK},
+        .nethugepages = {"NetHugePages", true},
+        .numa = {"NumaAffinity", false},
+        .sharedhash = {"SharedHash", false},
+        .sliderlookup = {"SliderLookup", "auto", {"auto", "pext", "magic"}},
         .datagen = {"Datagen", false},
         .softnodes = {"Softnodes", false},
         .softhardmult = {"SoftNodeHardLimitMultiplier", 1678, 1, 5000}
@@ -57,9 +67,57 @@ void Raphael::PVList::update(const chess::Move move, const PVList& child) {
 }
 
 
-Raphael::Raphael(): params_(default_params()), tt_(params_.hash) {
-    params_.hash.set_callback([this]() { tt_.resize(params_.hash, params_.threads); });
+Raphael::Raphael(): params_(default_params()), tt_(params_.hash), evalcache_(params_.evalcache) {
+    params_.hash.set_callback([this]() {
+        tt_.resize(params_.hash, params_.threads, true);
+        check_shared_hash();
+        report_hash_pages();
+    });
+    params_.evalcache.set_callback([this]() { evalcache_.resize(params_.evalcache); });
+    params_.largepages.set_callback([this]() {
+        using PageMode = TranspositionTable::PageMode;
+        const std::string& mode = params_.largepages;
+        if (mode == "off")
+            tt_.set_page_mode(PageMode::OFF, params_.threads);
+        else if (mode == "thp")
+            tt_.set_page_mode(PageMode::THP, params_.threads);
+        else if (mode == "hugetlb-2M")
+            tt_.set_page_mode(PageMode::HUGETLB_2M, params_.threads);
+        else
+            tt_.set_page_mode(PageMode::HUGETLB_1G, params_.threads);
+        report_hash_pages();
+    });
+    params_.sharedhash.set_callback([this]() {
+        tt_.set_shared(params_.sharedhash, params_.threads);
+        check_shared_hash();
+    });
+    params_.sliderlookup.set_callback([this]() {
+        using SliderLookup = chess::Attacks::SliderLookup;
+        const std::string& mode = params_.sliderlookup;
+        bool pext;
+        if (mode == "pext")
+            pext = chess::Attacks::set_slider_lookup(SliderLookup::PEXT);
+        else if (mode == "magic")
+            pext = chess::Attacks::set_slider_lookup(SliderLookup::MAGIC);
+        else
+            pext = chess::Attacks::set_slider_lookup(SliderLookup::AUTO);
+        if (ucilevel_ != UciInfoLevel::NONE)
+            cout << "info string slider lookups use " << ((pext) ? "pext" : "magic") << "\n"
+                 << flush;
+    });
     params_.threads.set_callback([this]() { set_threads(params_.threads); });
+    params_.numa.set_callback([this]() { set_threads(params_.threads); });
+    params_.evalfile.set_callback([this]() { load_evalfile(); });
+    params_.smallevalfile.set_callback([this]() { load_small_evalfile(); });
+    params_.datagen.set_callback([this]() { evalcache_.clear(); });
+    params_.nethugepages.set_callback([this]() {
+        Nnue::set_huge_pages(params_.nethugepages);
+
+        // threads must be respawned to construct their Nnue with the new copy
+        set_threads(params_.threads);
+        if (ucilevel_ != UciInfoLevel::NONE)
+            cout << "info string network uses " << Nnue::network_page_info() << "\n" << flush;
+    });
     set_threads(params_.threads);
     init_tunables();
 }
@@ -73,6 +131,7 @@ void Raphael::set_option(const std::string& name, i32 value) {
     for (const auto p :
          {
              &params_.hash,
+             &params_.evalcache,
              &params_.threads,
              &params_.moveoverhead,
              &params_.softhardmult,
@@ -101,7 +160,16 @@ void Raphael::set_option(const std::string& name, i32 value) {
 void Raphael::set_option(const std::string& name, bool value) {
     assert(!is_searching_.load(memory_order_acquire));
 
-    for (CheckOption* p : {&params_.chess960, &params_.datagen, &params_.softnodes}) {
+    for (CheckOption* p :
+         {
+             &params_.chess960,
+             &params_.nethugepages,
+             &params_.numa,
+             &params_.sharedhash,
+             &params_.datagen,
+             &params_.softnodes,
+         })
+    {
         if (!utils::is_case_insensitive_equals(p->name, name)) continue;
 
         // set value
@@ -119,6 +187,44 @@ void Raphael::set_option(const std::string& name, bool value) {
     cout << "info string error: unknown check option '" << name << "'\n" << flush;
 }
 
+void Raphael::set_option(const std::string& name, const std::string& value) {
+    assert(!is_searching_.load(memory_order_acquire));
+
+    for (StringOption* p : {&params_.evalfile, &params_.smallevalfile}) {
+        if (!utils::is_case_insensitive_equals(p->name, name)) continue;
+
+        // set value
+        p->set(value);
+
+        if (ucilevel_ != UciInfoLevel::NONE)
+            cout << "info string set " << p->name << " to " << p->value << "\n" << flush;
+        return;
+    }
+
+    for (ComboOption* p : {&params_.largepages, &params_.sliderlookup}) {
+        if (!utils::is_case_insensitive_equals(p->name, name)) continue;
+
+        for (const auto& var : p->vars) {
+            if (!utils::is_case_insensitive_equals(var, value)) continue;
+
+            // set value
+            p->set(var);
+
+            if (ucilevel_ != UciInfoLevel::NONE)
+                cout << "info string set " << p->name << " to " << var << "\n" << flush;
+            return;
+        }
+
+        // error checking
+        cout << "info string error: option '" << p->name << "' value must be one of";
+        for (const auto& var : p->vars) cout << " " << var;
+        cout << "\n" << flush;
+        return;
+    }
+
+    cout << "info string error: unknown string or combo option '" << name << "'\n" << flush;
+}
+
 void Raphael::set_uciinfolevel(UciInfoLevel level) {
     assert(!is_searching_.load(memory_order_acquire));
     ucilevel_ = level;
@@ -181,6 +287,20 @@ Raphael::MoveScore Raphael::search(const TimeManager::SearchOptions& options) {
     return wait_search();
 }
 
+std::vector<Raphael::ThreadStats> Raphael::thread_stats() const {
+    assert(!is_searching_.load(memory_order_acquire));
+
+    std::vector<ThreadStats> stats;
+    for (const auto& tdata : thread_data_)
+        stats.push_back(
+            {tdata->numa_node,
+             tm_.get_nodes(tdata->thread_id),
+             tdata->evalcache_probes,
+             tdata->evalcache_hits}
+        );
+    return stats;
+}
+
 void Raphael::stop_search() {
     stop_.store(true, memory_order_relaxed);
     is_searching_.wait(true, memory_order_acquire);
@@ -193,16 +313,86 @@ i32 Raphael::static_eval(bool corrected) {
     assert(thread_data_.size() >= 1);
 
     auto& tdata = *thread_data_[0];
+    if (tdata.history_stale) {
+        tdata.history.clear();
+        tdata.history_stale = false;
+    }
+
     i32 corrplexity;
     const auto raw_score = tdata.position_.evaluate(!params_.datagen);
     return (corrected) ? adjust_score(tdata, raw_score, corrplexity) : raw_score;
 }
 
+void Raphael::static_eval_batch(
+    span<const chess::Board> boards, span<i32> evals, i32 num_threads
+) const {
+    Nnue::evaluate_batch(boards, evals, num_threads);
+    if (params_.datagen) return;
+    for (usize i = 0; i < boards.size(); i++)
+        evals[i] = Position<true>::material_scaled(boards[i], evals[i]);
+}
+
 
 void Raphael::reset() {
     assert(!is_searching_.load(memory_order_acquire));
-    tt_.clear(params_.threads);
-    for (auto& tdata : thread_data_) tdata->history.clear();
+    tt_.new_generation(params_.threads);
+    for (auto& tdata : thread_data_) tdata->history_stale = true;
+}
+
+
+void Raphael::check_shared_hash() {
+    if (!params_.sharedhash || tt_.is_shared()) return;
+
+    cout << "info string error: could not attach to shared hash, using a private hash instead\n"
+         << flush;
+    params_.sharedhash.value = false;
+}
+
+void Raphael::report_hash_pages() const {
+    if (ucilevel_ == UciInfoLevel::NONE) return;
+    cout << "info string Hash uses " << tt_.page_info() << "\n" << flush;
+}
+
+void Raphael::load_evalfile() {
+    try {
+        Nnue::load_network(params_.evalfile);
+    } catch (const std::exception& e) {
+        cout << "info string error: " << e.what() << "\n" << flush;
+        params_.evalfile.value = Nnue::network_name();
+        return;
+    }
+
+    // positions (and their accumulators) are lost and must be set again
+    set_threads(params_.threads);
+    evalcache_.clear();
+
+    if (ucilevel_ != UciInfoLevel::NONE && !Nnue::network_decode_info().empty())
+        cout << "info string " << Nnue::network_decode_info() << "\n" << flush;
+    if (ucilevel_ != UciInfoLevel::NONE && !Nnue::network_sparsity_permed())
+        cout << "info string warning: network not permuted for sparsity\n" << flush;
+}
+
+void Raphael::load_small_evalfile() {
+    try {
+        Nnue::load_small_network(params_.smallevalfile);
+    } catch (const std::exception& e) {
+        cout << "info string error: " << e.what() << "\n" << flush;
+        params_.smallevalfile.value = Nnue::small_network_name();
+        return;
+    }
+
+    // positions (and their accumulators) are lost and must be set again
+    set_threads(params_.threads);
+}
+
+void Raphael::save_hash(const string& path) const {
+    assert(!is_searching_.load(memory_order_acquire));
+    tt_.save(path, params_.threads);
+}
+
+void Raphael::load_hash(const string& path) {
+    assert(!is_searching_.load(memory_order_acquire));
+    tt_.load(path, params_.threads);
 }
 
 
@@ -221,9 +411,13 @@ void Raphael::kill_search() {
 
 
 void Raphael::t_search_function(i32 thread_id) {
+    // bind before allocating so the thread data is zeroed (first touched) on the local node
+    const i32 numa_node = (params_.numa) ? numa::bind_thread(thread_id) : -1;
+
     thread_data_[thread_id] = make_unique<ThreadData>();
     auto& tdata = *thread_data_[thread_id];
     tdata.thread_id = thread_id;
+    tdata.numa_node = numa_node;
 
     init_barrier_->arrive_and_wait();
 
@@ -232,6 +426,11 @@ void Raphael::t_search_function(i32 thread_id) {
         idle_barrier_->arrive_and_wait();
         if (quit_.load(memory_order_relaxed)) break;
 
+        if (tdata.history_stale) {
+            tdata.history.clear();
+            tdata.history_stale = false;
+        }
+
         tm_.start_timer(
             search_opt_,
             thread_id,
@@ -239,6 +438,8 @@ void Raphael::t_search_function(i32 thread_id) {
             (params_.softnodes) ? params_.softhardmult : 0
         );
         memset(&tdata.search_stack, 0, sizeof(tdata.search_stack));
+        tdata.evalcache_probes = 0;
+        tdata.evalcache_hits = 0;
         const auto result = iterative_deepen(tdata);
 
         // wait until all threads finish
@@ -297,6 +498,29 @@ string Raphael::get_pv_line(const PVList& pv) const {
 }
 
 
+bool Raphael::probe_eval(ThreadData& tdata, u64 key, i32& eval) {
+    if (!evalcache_.enabled()) return tt_.get_static_eval(key, eval);
+
+    tdata.evalcache_probes++;
+    if (!evalcache_.probe(key, eval)) return false;
+    tdata.evalcache_hits++;
+    return true;
+}
+
+i32 Raphael::store_eval(ThreadData& tdata, u64 key) {
+    const i32 eval = tdata.position_.evaluate(!params_.datagen);
+    if (evalcache_.enabled())
+        evalcache_.store(key, eval);
+    else
+        tt_.set_static_eval(key, eval);
+    return eval;
+}
+
+i32 Raphael::raw_eval(ThreadData& tdata, u64 key) {
+    i32 eval;
+    return (probe_eval(tdata, key, eval)) ? eval : store_eval(tdata, key);
+}
+
 i32 Raphael::adjust_score(const ThreadData& tdata, i32 raw_static_eval, i32& corrplexity) const {
     const auto& position = tdata.position_;
     const auto& history = tdata.history;
@@ -468,12 +692,9 @@ i32 Raphael::negamax(
             ss->static_eval = NONE_SCORE;
             score_estimate = ss->static_eval;
         } else {
-            if (tthit && ttentry.static_eval != NONE_SCORE)
-                raw_static_eval = ttentry.static_eval;
-            else if (!tt_.get_static_eval(ttkey, raw_static_eval)) {
-                raw_static_eval = position.evaluate(!params_.datagen);
-                tt_.set_static_eval(ttkey, raw_static_eval);
-            }
+            raw_static_eval = (tthit && ttentry.static_eval != NONE_SCORE)
+                                ? ttentry.static_eval
+                                : raw_eval(tdata, ttkey);
 
             ss->static_eval = adjust_score(tdata, raw_static_eval, corrplexity);
             score_estimate = ss->static_eval;
@@ -520,7 +741,9 @@ i32 Raphael::negamax(
             && !(ttentry.flag == tt_.UPPER && ttentry.score < beta)
             && !board.is_kingpawn(board.stm()))
         {
-            tt_.prefetch(board.hash_after<true>(chess::Move::NO_MOVE));
+            const u64 null_key = board.hash_after<true>(chess::Move::NO_MOVE);
+            tt_.prefetch(null_key);
+            evalcache_.prefetch(null_key);
             position.make_nullmove();
             ss->move = chess::Move::NO_MOVE;
 
@@ -644,7 +867,9 @@ i32 Raphael::negamax(
 
         const u64 old_nodes = tm_.get_nodes(thread_id);
 
-        tt_.prefetch(board.hash_after<false>(move));
+        const u64 child_key = board.hash_after<false>(move);
+        tt_.prefetch(child_key);
+        evalcache_.prefetch(child_key);
         position.make_move(move);
         ss->move = move;
         move_searched++;
@@ -828,14 +1053,29 @@ i32 Raphael::quiescence(ThreadData& tdata, const i32 ply, i32 alpha, i32 beta, M
         raw_static_eval = NONE_SCORE;
         static_eval = -MATE_SCORE + ply;
     } else {
-        if (tthit && ttentry.static_eval != NONE_SCORE)
+        bool has_eval = tthit && ttentry.static_eval != NONE_SCORE;
+        if (has_eval)
             raw_static_eval = ttentry.static_eval;
-        else if (!tt_.get_static_eval(ttkey, raw_static_eval)) {
-            raw_static_eval = position.evaluate(!params_.datagen);
-            tt_.set_static_eval(ttkey, raw_static_eval);
+        else
+            has_eval = probe_eval(tdata, ttkey, raw_static_eval);
+
+        // trust the small network far from the window, only escalate to the full network near it
+        i32 small_eval = NONE_SCORE;
+        if (!has_eval && position.has_small_net()) {
+            small_eval = adjust_score(
+                tdata, position.evaluate_small(!params_.datagen), corrplexity
+            );
+            if (small_eval > alpha - QS_SMALL_NET_MARGIN && small_eval < beta + QS_SMALL_NET_MARGIN)
+                small_eval = NONE_SCORE;
         }
 
-        static_eval = adjust_score(tdata, raw_static_eval, corrplexity);
+        if (small_eval != NONE_SCORE) {
+            raw_static_eval = NONE_SCORE;  // small evals aren't stored
+            static_eval = small_eval;
+        } else {
+            if (!has_eval) raw_static_eval = store_eval(tdata, ttkey);
+            static_eval = adjust_score(tdata, raw_static_eval, corrplexity);
+        }
 
         if (static_eval >= beta) return static_eval;
 
@@ -872,7 +1112,9 @@ i32 Raphael::quiescence(ThreadData& tdata, const i32 ply, i32 alpha, i32 beta, M
             if (!SEE::see(move, board, QS_SEE_THRESH)) continue;
         }
 
-        tt_.prefetch(board.hash_after<false>(move));
+        const u64 child_key = board.hash_after<false>(move);
+        tt_.prefetch(child_key);
+        evalcache_.prefetch(child_key);
         position.make_move(move);
         move_searched++;
         tm_.inc_nodes(thread_id);
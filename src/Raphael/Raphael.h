@@ -1,4 +1,5 @@
 #pragma once
+#include <Raphael/EvalCache.h>
 #include <Raphael/History.h>
 #include <Raphael/Transposition.h>
 #include <Raphael/position.h>
@@ -7,6 +8,7 @@
 #include <atomic>
 #include <barrier>
 #include <memory>
+#include <span>
 #include <string>
 #include <thread>
 #include <vector>
@@ -21,9 +23,17 @@ public:
     struct EngineOptions {
         // uci options
         SpinOption<false> hash;
+        SpinOption<false> evalcache;
+        ComboOption largepages;
         SpinOption<false> threads;
         SpinOption<false> moveoverhead;
         CheckOption chess960;
+        StringOption evalfile;
+        StringOption smallevalfile;
+        CheckOption nethugepages;
+        CheckOption numa;
+        CheckOption sharedhash;
+        ComboOption sliderlookup;
 
         // other options
         CheckOption datagen;
@@ -45,6 +55,13 @@ public:
         u64 nodes = 0;
     };
 
+    struct ThreadStats {
+        i32 numa_node;  // -1 if the thread is not bound to a node
+        u64 nodes;
+        u64 evalcache_probes;
+        u64 evalcache_hits;
+    };
+
 
 private:
     enum class UCIScoreType : u8 {
@@ -88,6 +105,10 @@ private:
         History history;
         i32 min_nmp_ply;
         i32 thread_id;
+        i32 numa_node;
+        u64 evalcache_probes;  // reset every search
+        u64 evalcache_hits;
+        bool history_stale = false;  // cleared by the thread itself before its next search
     };
 
     // shared data
@@ -95,6 +116,7 @@ private:
     UciInfoLevel ucilevel_ = UciInfoLevel::NONE;
 
     TranspositionTable tt_;
+    EvalCache evalcache_;
     TimeManager tm_;
 
     // thread helpers
@@ -129,6 +151,7 @@ public:
      */
     void set_option(const std::string& name, i32 value);
     void set_option(const std::string& name, bool value);
+    void set_option(const std::string& name, const std::string& value);
 
     /** Sets Raphael's UCI info level
      *
@@ -184,6 +207,12 @@ public:
      */
     MoveScore search(const TimeManager::SearchOptions& options);
 
+    /** Returns the numa node and node count of each thread for the last search
+     *
+     * \returns stats of each thread
+     */
+    std::vector<ThreadStats> thread_stats() const;
+
     /** Stops any ongoing search and waits */
     void stop_search();
 
@@ -195,14 +224,53 @@ public:
      */
     i32 static_eval(bool corrected);
 
+    /** Returns the raw static evals of many boards, matching static_eval(false) on each board
+     *
+     * \param boards boards to evaluate
+     * \param evals output static evals, same size as boards
+     * \param num_threads number of threads to evaluate with
+     */
+    void static_eval_batch(
+        std::span<const chess::Board> boards, std::span<i32> evals, i32 num_threads
+    ) const;
+
 
-    /** Resets Raphael */
+    /** Resets Raphael. The tt and the continuation histories are invalidated in O(1), and each
+     * thread clears the rest of its history before its next search
+     */
     void reset();
 
+
+    /** Saves the transposition table to a file. Throws a runtime_error on failure
+     *
+     * \param path path of the file to save to
+     */
+    void save_hash(const std::string& path) const;
+
+    /** Loads the transposition table from a file. Throws a runtime_error on failure
+     *
+     * \param path path of the file to load from
+     */
+    void load_hash(const std::string& path);
+
 private:
     /** Stops and kills all threads */
     void kill_search();
 
+    /** Reports and disables the SharedHash option if the table could not be shared */
+    void check_shared_hash();
+
+    /** Reports the pages backing the transposition table */
+    void report_hash_pages() const;
+
+    /** Loads the network set by the EvalFile option and rebuilds the thread data to use it */
+    void load_evalfile();
+
+    /** Loads the small network set by the SmallEvalFile option and rebuilds the thread data to use
+     * it
+     */
+    void load_small_evalfile();
+
 
     /** Persistent search thread to handle search commands
      *
@@ -235,6 +303,32 @@ private:
     std::string get_pv_line(const PVList& pv) const;
 
 
+    /** Retrieves a previously stored raw static eval from the eval cache. Falls back to the static
+     * eval slot of the tt cluster if the eval cache is disabled
+     *
+     * \param tdata this thread's data
+     * \param key zobrist hash of the position
+     * \param eval variable to put the raw static eval into
+     * \returns whether the eval was found
+     */
+    bool probe_eval(ThreadData& tdata, u64 key, i32& eval);
+
+    /** Evaluates the thread's position and stores the raw static eval for probe_eval
+     *
+     * \param tdata this thread's data
+     * \param key zobrist hash of the position
+     * \returns the raw static eval
+     */
+    i32 store_eval(ThreadData& tdata, u64 key);
+
+    /** Returns the raw static eval of the thread's position, from the eval cache if possible
+     *
+     * \param tdata this thread's data
+     * \param key zobrist hash of the position
+     * \returns the raw static eval
+     */
+    i32 raw_eval(ThreadData& tdata, u64 key);
+
     /** Adjusts the raw static eval using scaling and corrhists
      *
      * \param tdata this thread's data
@@ -3,18 +3,32 @@
 #include <Raphael/utils.h>
 
 #include <cstring>
+#include <fstream>
+#include <stdexcept>
 #include <thread>
 
 #ifdef _WIN32
     #include <windows.h>
 #else
+    #ifdef __linux__
+        #include <dirent.h>
+    #endif
+    #include <fcntl.h>
+    #include <sys/file.h>
     #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
 #endif
 
 using namespace raphael;
+using std::memcmp;
+using std::memcpy;
 using std::memset;
 using std::min;
+using std::runtime_error;
+using std::string;
 using std::thread;
+using std::to_string;
 using std::vector;
 
 
@@ -44,12 +58,17 @@ TranspositionTable::TranspositionTable(i32 size_mb): capacity_(0), table_(nullpt
 
 TranspositionTable::~TranspositionTable() { deallocate(); }
 
-void TranspositionTable::resize(i32 size_mb, i32 num_threads) {
+void TranspositionTable::resize(i32 size_mb, i32 num_threads, bool preserve) {
     assert(size_mb > 0 && size_mb <= MAX_TABLE_SIZE_MB);
     const usize newsize = (usize)size_mb * 1024 * 1024 / CLUSTER_SIZE;
 
-    // re-allocate if necessary
-    if (newsize > capacity_ || newsize <= capacity_ / 2) {
+    if (preserve && !shared_ && newsize != size_) {
+        rehash(newsize, num_threads);
+        return;
+    }
+
+    // re-allocate if necessary (shared tables are named by size so must be exact)
+    if (newsize > capacity_ || newsize <= capacity_ / 2 || (shared_ && newsize != capacity_)) {
         deallocate();
         allocate(newsize);
     }
@@ -58,13 +77,53 @@ void TranspositionTable::resize(i32 size_mb, i32 num_threads) {
     clear(num_threads);
 }
 
+bool TranspositionTable::set_shared(bool shared, i32 num_threads) {
+    if (shared == shared_) return shared_;
+
+    deallocate();
+    shared_ = shared;
+    allocate(size_);
+    clear(num_threads);
+    return shared_;
+}
+
+bool TranspositionTable::is_shared() const { return shared_; }
+
+void TranspositionTable::set_page_mode(PageMode mode, i32 num_threads) {
+    page_mode_ = mode;
+    if (shared_) return;
+
+    deallocate();
+    allocate(size_);
+    clear(num_threads);
+}
+
+string TranspositionTable::page_info() const {
+    if (shared_) return "shared memory pages";
+    // hugetlb mappings are rounded up to whole pages
+    const string mapped = " (" + to_string((capacity_ * CLUSTER_SIZE) >> 20) + " MB mapped for "
+                        + to_string((size_ * CLUSTER_SIZE) >> 20) + " MB)";
+    if (page_size_ == 1024 * 1024 * 1024) return "1GB hugetlb pages" + mapped;
+    if (page_size_ == 2 * 1024 * 1024) return "2MB hugetlb pages" + mapped;
+    if (page_size_ == 4096) return "4KB pages";
+
+#ifdef __linux__
+    const usize bytes = capacity_ * CLUSTER_SIZE;
+    return "transparent huge pages (" + to_string(utils::huge_page_bytes(table_, bytes) >> 20)
+           + " of " + to_string(bytes >> 20) + " MB backed by 2MB pages)";
+#else
+    return "4KB pages";
+#endif
+}
+
 bool TranspositionTable::get(ProbedEntry& ttentry, u64 key, i32 ply) const {
     const auto& cluster = table_[index(key)];
     const auto packed_key = static_cast<u16>(key);
 
     for (usize i = 0; i < ENTRIES_PER_CLUSTER; i++) {
         const auto& entry = cluster.entries[i];
-        if (packed_key == entry.key && entry.flag() != Flag::INVALID) {
+        if (packed_key == entry.key && entry.generation == generation_
+            && entry.flag() != Flag::INVALID) {
             // correct mate score when retrieving (https://youtu.be/XfeuxubYlT0)
             i32 score = static_cast<i32>(entry.score);
             if (utils::is_loss(score))
@@ -103,17 +162,19 @@ void TranspositionTable::set(
     Entry* entry = nullptr;
     i32 min_value = INT32_MAX;
 
+    const u32 age = table_age();
     for (usize i = 0; i < ENTRIES_PER_CLUSTER; i++) {
         auto& candidate = cluster.entries[i];
 
-        // replace if empty or same key
-        if (candidate.flag() == Flag::INVALID || packed_key == candidate.key) {
+        // replace if empty (or from an old generation) or same key
+        if (candidate.flag() == Flag::INVALID || candidate.generation != generation_
+            || packed_key == candidate.key) {
             entry = &candidate;
             break;
         }
 
         // otherwise replace worst entry
-        const i32 value = candidate.value(age_);
+        const i32 value = candidate.value(age);
         if (value < min_value) {
             min_value = value;
             entry = &candidate;
@@ -121,11 +182,12 @@ void TranspositionTable::set(
     }
     assert(entry != nullptr);
 
-    if (!(flag == Flag::EXACT || packed_key != entry->key || entry->age() != age_
+    const bool stale = entry->generation != generation_;
+    if (!(flag == Flag::EXACT || packed_key != entry->key || entry->age() != age || stale
           || fdepth + TT_REPL_DEPTH_MARGIN + pv * TT_REPL_PV_MARGIN > entry->fdepth))
         return;
 
-    if (move || entry->key != packed_key) entry->move = static_cast<u16>(move);
+    if (move || entry->key != packed_key || stale) entry->move = static_cast<u16>(move);
 
     // correct mate score when storing (https://youtu.be/XfeuxubYlT0)
     if (utils::is_loss(score))
@@ -138,14 +200,14 @@ void TranspositionTable::set(
     entry->score = static_cast<i16>(score);
     entry->static_eval = static_cast<i16>(static_eval);
     entry->fdepth = static_cast<u16>(fdepth);
-    entry->set_age_pv_flag(age_, pv, flag);
+    entry->set_age_pv_flag(age, pv, flag);
+    entry->generation = static_cast<u8>(generation_);
 }
 
 bool TranspositionTable::get_static_eval(u64 key, i32& static_eval) const {
     const auto& cluster = table_[index(key)];
-    const auto packed_key = static_cast<u16>(key);
 
-    if (cluster.key == packed_key) {
+    if (cluster.key == cluster_key(key)) {
         static_eval = cluster.static_eval;
         return true;
     }
@@ -154,9 +216,8 @@ bool TranspositionTable::get_static_eval(u64 key, i32& static_eval) const {
 
 void TranspositionTable::set_static_eval(u64 key, i32 static_eval) {
     auto& cluster = table_[index(key)];
-    const auto packed_key = static_cast<u16>(key);
 
-    cluster.key = packed_key;
+    cluster.key = cluster_key(key);
     cluster.static_eval = static_eval;
 }
 
@@ -165,6 +226,12 @@ void TranspositionTable::clear(i32 num_threads) {
     assert(table_ != nullptr);
     assert(size_ > 0);
 
+    // don't wipe entries other processes are still using
+    if (shared_header_ && attached_elsewhere()) {
+        generation_ = 0;
+        return;
+    }
+
     const usize chunk_size = (size_ + num_threads - 1) / num_threads;
     vector<thread> threads;
     threads.reserve(num_threads);
@@ -179,19 +246,151 @@ void TranspositionTable::clear(i32 num_threads) {
     }
     for (auto& thread : threads) thread.join();
 
-    age_ = 0;
+    set_table_age(0);
+    generation_ = 0;
+}
+
+void TranspositionTable::new_generation(i32 num_threads) {
+    generation_ = (generation_ + 1) & MAX_GENERATION;
+
+    // old entries become valid again on wrap around, and processes sharing a table must agree on
+    // the generation, so clear in both cases
+    if (generation_ == 0 || shared_)
+        clear(num_threads);
+    else
+        age_ = 0;
+}
+
+void TranspositionTable::save(const string& path, i32 num_threads) const {
+    FileHeader header{};
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.version = FILE_VERSION;
+    header.cluster_size = CLUSTER_SIZE;
+    header.entry_size = sizeof(Entry);
+    header.entries_per_cluster = ENTRIES_PER_CLUSTER;
+    header.size = size_;
+    header.age = table_age();
+    header.generation = generation_;
+
+    const usize filesize = sizeof(FileHeader) + size_ * CLUSTER_SIZE;
+
+#ifdef _WIN32
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) throw runtime_error("could not open hash file '" + path + "'");
+    file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+    file.write(reinterpret_cast<const char*>(table_), size_ * CLUSTER_SIZE);
+    if (!file) throw runtime_error("could not write hash file '" + path + "'");
+#else
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw runtime_error("could not open hash file '" + path + "'");
+    if (ftruncate(fd, filesize) != 0) {
+        close(fd);
+        throw runtime_error("could not resize hash file '" + path + "'");
+    }
+
+    void* data = mmap(nullptr, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) throw runtime_error("could not map hash file '" + path + "'");
+
+    auto file_header = static_cast<FileHeader*>(data);
+    auto file_table = reinterpret_cast<Cluster*>(file_header + 1);
+    *file_header = header;
+    parallel_copy(file_table, table_, num_threads);
+
+    const bool synced = msync(data, filesize, MS_SYNC) == 0;
+    munmap(data, filesize);
+    if (!synced) throw runtime_error("could not write hash file '" + path + "'");
+#endif
+}
+
+void TranspositionTable::load(const string& path, i32 num_threads) {
+    if (shared_header_ && attached_elsewhere())
+        throw runtime_error("can't load hash file '" + path + "' into a table other processes use");
+
+    // reject files with a different layout or size
+    const auto validate = [&](const FileHeader& header, usize filesize) {
+        if (filesize < sizeof(FileHeader) || memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)))
+            throw runtime_error("'" + path + "' is not a hash file");
+        if (header.version != FILE_VERSION || header.cluster_size != CLUSTER_SIZE
+            || header.entry_size != sizeof(Entry)
+            || header.entries_per_cluster != ENTRIES_PER_CLUSTER || header.age > MAX_AGE
+            || header.generation > MAX_GENERATION)
+            throw runtime_error("hash file '" + path + "' has an incompatible entry layout");
+        if (header.size != size_)
+            throw runtime_error(
+                "hash file '" + path + "' was saved with Hash "
+                + to_string(header.size * CLUSTER_SIZE / (1024 * 1024)) + ", current Hash is "
+                + to_string(size_ * CLUSTER_SIZE / (1024 * 1024))
+            );
+        if (filesize != sizeof(FileHeader) + size_ * CLUSTER_SIZE)
+            throw runtime_error("hash file '" + path + "' is truncated");
+    };
+
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) throw runtime_error("could not open hash file '" + path + "'");
+    const usize filesize = file.tellg();
+    file.seekg(0);
+
+    FileHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+    validate(header, filesize);
+    file.read(reinterpret_cast<char*>(table_), size_ * CLUSTER_SIZE);
+    if (!file) throw runtime_error("could not read hash file '" + path + "'");
+    set_table_age(header.age);
+    generation_ = header.generation;
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("could not open hash file '" + path + "'");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw runtime_error("could not read hash file '" + path + "'");
+    }
+    const usize filesize = st.st_size;
+    if (filesize < sizeof(FileHeader)) {
+        close(fd);
+        throw runtime_error("'" + path + "' is not a hash file");
+    }
+
+    void* data = mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) throw runtime_error("could not map hash file '" + path + "'");
+    madvise(data, filesize, MADV_WILLNEED);
+
+    const auto& header = *static_cast<const FileHeader*>(data);
+    try {
+        validate(header, filesize);
+    } catch (const runtime_error&) {
+        munmap(data, filesize);
+        throw;
+    }
+
+    parallel_copy(table_, reinterpret_cast<const Cluster*>(&header + 1), num_threads);
+    set_table_age(header.age);
+    generation_ = header.generation;
+    munmap(data, filesize);
+#endif
 }
 
-void TranspositionTable::do_age() { age_ = (age_ + 1) & MAX_AGE; }
+void TranspositionTable::do_age() {
+    if (shared_header_)
+        shared_header_->age.fetch_add(1, std::memory_order_relaxed);
+    else
+        age_ = (age_ + 1) & MAX_AGE;
+}
 
 i32 TranspositionTable::hashfull() const {
+    const u32 age = table_age();
     i32 filled = 0;
 
     for (usize i = 0; i < 1000; i++) {
         const auto& cluster = table_[i];
         for (usize j = 0; j < ENTRIES_PER_CLUSTER; j++) {
             const auto& entry = cluster.entries[j];
-            if (entry.flag() != Flag::INVALID && entry.age() == age_) filled++;
+            if (entry.flag() != Flag::INVALID && entry.generation == generation_
+                && entry.age() == age)
+                filled++;
         }
     }
 
@@ -199,6 +398,108 @@ i32 TranspositionTable::hashfull() const {
 }
 
 
+void TranspositionTable::rehash(usize newsize, i32 num_threads) {
+    assert(num_threads > 0);
+    assert(!shared_);
+
+    Cluster* old_table = table_;
+    const usize old_size = size_;
+    const usize old_bytes = capacity_ * CLUSTER_SIZE;
+    const bool old_mapped = mapped_;
+    table_ = nullptr;
+    capacity_ = 0;
+    allocate(newsize);
+    size_ = newsize;
+
+    const usize chunk_size = (size_ + num_threads - 1) / num_threads;
+    vector<thread> threads;
+    threads.reserve(num_threads);
+
+    for (i32 t = 0; t < num_threads; t++) {
+        const usize start = min(t * chunk_size, size_);
+        const usize end = min(start + chunk_size, size_);
+
+        threads.emplace_back([this, old_table, old_size, start, end]() {
+            for (usize i = start; i < end; i++) {
+                // keys mapping to cluster i lie in [ceil(i*2^64/size), ceil((i+1)*2^64/size) - 1]
+                const u128 lo_key = ((static_cast<u128>(i) << 64) + size_ - 1) / size_;
+                const u128 hi_key = ((static_cast<u128>(i + 1) << 64) + size_ - 1) / size_ - 1;
+                const usize lo = static_cast<usize>((lo_key * old_size) >> 64);
+                const usize hi = static_cast<usize>((hi_key * old_size) >> 64);
+
+                // only the low 16 bits of the key are stored, so when growing, an old cluster's
+                // entries are copied to every new cluster it overlaps
+                Cluster cluster{};
+                cluster.key = old_table[lo].key;
+                cluster.static_eval = old_table[lo].static_eval;
+
+                usize count = 0;
+                for (usize j = lo; j <= hi; j++) {
+                    for (const auto& entry : old_table[j].entries) {
+                        if (entry.flag() == Flag::INVALID || entry.generation != generation_)
+                            continue;
+
+                        // skip copies made by an earlier grow
+                        bool duplicate = false;
+                        for (usize k = 0; k < count; k++)
+                            duplicate |= !memcmp(&cluster.entries[k], &entry, sizeof(Entry));
+                        if (duplicate) continue;
+
+                        // keep the most valuable entries
+                        if (count < ENTRIES_PER_CLUSTER) {
+                            cluster.entries[count++] = entry;
+                            continue;
+                        }
+                        auto* worst = &cluster.entries[0];
+                        for (auto& kept : cluster.entries)
+                            if (kept.value(age_) < worst->value(age_)) worst = &kept;
+                        if (entry.value(age_) > worst->value(age_)) *worst = entry;
+                    }
+                }
+
+                table_[i] = cluster;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    free_table(old_table, old_bytes, old_mapped);
+}
+
+void TranspositionTable::parallel_copy(Cluster* dst, const Cluster* src, i32 num_threads) const {
+    assert(num_threads > 0);
+
+    const usize chunk_size = (size_ + num_threads - 1) / num_threads;
+    vector<thread> threads;
+    threads.reserve(num_threads);
+
+    for (i32 t = 0; t < num_threads; t++) {
+        const usize start = min(t * chunk_size, size_);
+        const usize end = min(start + chunk_size, size_);
+
+        threads.emplace_back([dst, src, start, end]() {
+            memcpy(&dst[start], &src[start], (end - start) * CLUSTER_SIZE);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+u16 TranspositionTable::cluster_key(u64 key) const {
+    return static_cast<u16>(key) ^ static_cast<u16>(generation_ * 0x9E37);
+}
+
+u32 TranspositionTable::table_age() const {
+    if (shared_header_) return shared_header_->age.load(std::memory_order_relaxed) & MAX_AGE;
+    return age_;
+}
+
+void TranspositionTable::set_table_age(u32 age) {
+    if (shared_header_)
+        shared_header_->age.store(age, std::memory_order_relaxed);
+    else
+        age_ = age;
+}
+
 u64 TranspositionTable::index(u64 key) const {
     // key >> 64 = 0~1, index at this fraction of the way through size_
     return static_cast<u64>((static_cast<u128>(key) * static_cast<u128>(size_)) >> 64);
@@ -208,18 +509,55 @@ void TranspositionTable::allocate(usize newsize) {
     assert(table_ == nullptr);
     assert(capacity_ == 0);
 
+    if (shared_) {
+        if (allocate_shared(newsize)) return;
+        shared_ = false;  // fall back to a private table
+    }
+
+#if defined(__linux__) && defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    // explicit huge pages need to be reserved by the system, so fall back to smaller pages
+    const auto try_hugetlb = [&](usize page_size, int page_shift) {
+        const usize newsize_s = ((newsize * CLUSTER_SIZE + page_size - 1) / page_size) * page_size;
+        void* data = mmap(
+            nullptr,
+            newsize_s,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT),
+            -1,
+            0
+        );
+        if (data == MAP_FAILED) return false;
+
+        capacity_ = newsize_s / CLUSTER_SIZE;
+        table_ = static_cast<Cluster*>(data);
+        mapped_ = true;
+        page_size_ = page_size;
+        return true;
+    };
+
+    // a table smaller than a 1GB page would mostly be rounding, so it gets 2MB pages instead
+    if (page_mode_ == PageMode::HUGETLB_1G && newsize * CLUSTER_SIZE >= 1024 * 1024 * 1024
+        && try_hugetlb(1024 * 1024 * 1024, 30))
+        return;
+    if ((page_mode_ == PageMode::HUGETLB_1G || page_mode_ == PageMode::HUGETLB_2M)
+        && try_hugetlb(2 * 1024 * 1024, 21))
+        return;
+#endif
+
 #if defined(__linux__)
-    static constexpr usize page_size = 2 * 1024 * 1024;
+    const usize page_size = (page_mode_ == PageMode::OFF) ? 4096 : 2 * 1024 * 1024;
 #else
-    static constexpr usize page_size = 4096;
+    const usize page_size = 4096;
 #endif
 
     const usize newsize_s = ((newsize * CLUSTER_SIZE + page_size - 1) / page_size) * page_size;
     capacity_ = newsize_s / CLUSTER_SIZE;
+    mapped_ = false;
+    page_size_ = (page_mode_ == PageMode::OFF) ? 4096 : 0;  // transparent huge pages vary
 
 #if defined(__linux__)
     table_ = static_cast<Cluster*>(aligned_alloc(page_size, newsize_s));
-    madvise(table_, newsize_s, MADV_HUGEPAGE);
+    madvise(table_, newsize_s, (page_mode_ == PageMode::OFF) ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
 #elif defined(_WIN32)
     table_ = static_cast<Cluster*>(_aligned_malloc(newsize_s, page_size));
 #else
@@ -227,18 +565,197 @@ void TranspositionTable::allocate(usize newsize) {
 #endif
 }
 
+bool TranspositionTable::allocate_shared(usize newsize) {
+    assert(table_ == nullptr);
+    assert(capacity_ == 0);
+
+#ifdef _WIN32
+    (void)newsize;
+    return false;
+#else
+    const auto name = shared_name(newsize);
+    const usize bytes = sizeof(SharedHeader) + newsize * CLUSTER_SIZE;
+
+    const int lock_fd = lock_shared_segments();
+    if (lock_fd < 0) return false;
+    remove_stale_segments();
+
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        close(lock_fd);
+        return false;
+    }
+
+    // a new segment is zero filled (i.e., an empty table), we only need to write the header
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    const bool created = ok && st.st_size == 0;
+    if (created)
+        ok = ftruncate(fd, bytes) == 0;
+    else
+        ok = ok && static_cast<usize>(st.st_size) == bytes;
+
+    void* data = (ok) ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                      : MAP_FAILED;
+    if (data != MAP_FAILED) {
+    #ifdef __linux__
+        madvise(data, bytes, MADV_HUGEPAGE);
+    #endif
+        auto header = static_cast<SharedHeader*>(data);
+        if (created) {
+            memcpy(header->magic, FILE_MAGIC, sizeof(header->magic));
+            header->version = FILE_VERSION;
+            header->size = newsize;
+        }
+
+        if (memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0
+            && header->version == FILE_VERSION && header->size == newsize
+            && flock(fd, LOCK_SH) == 0) {
+            shared_header_ = header;
+        } else {
+            munmap(data, bytes);
+            data = MAP_FAILED;
+        }
+    }
+
+    if (data == MAP_FAILED) {
+        if (created) shm_unlink(name.c_str());
+        close(fd);
+        close(lock_fd);
+        return false;
+    }
+    close(lock_fd);
+
+    // the shared lock on fd marks the segment as in use until we detach or exit
+    shared_fd_ = fd;
+    capacity_ = newsize;
+    table_ = reinterpret_cast<Cluster*>(shared_header_ + 1);
+    page_size_ = 0;
+    return true;
+#endif
+}
+
+bool TranspositionTable::attached_elsewhere() const {
+    assert(shared_fd_ >= 0);
+
+#ifdef _WIN32
+    return false;
+#else
+    const int lock_fd = lock_shared_segments();
+    if (lock_fd < 0) return true;
+
+    // the exclusive lock can only be taken if nobody else holds a shared one. Converting a lock
+    // can drop it when it fails, so the shared lock is always taken again
+    const bool alone = flock(shared_fd_, LOCK_EX | LOCK_NB) == 0;
+    flock(shared_fd_, LOCK_SH);
+    close(lock_fd);
+    return !alone;
+#endif
+}
+
 void TranspositionTable::deallocate() {
-    if (table_) {
+    if (shared_header_) {
+#ifndef _WIN32
+        // the last process to detach removes the segment. If the lock can't be taken the segment
+        // is left behind, and removed by the next process attaching to any segment
+        const int lock_fd = lock_shared_segments();
+        if (lock_fd >= 0) {
+            const auto name = shared_name(capacity_);
+            if (flock(shared_fd_, LOCK_EX | LOCK_NB) == 0 && is_current_segment(shared_fd_, name))
+                shm_unlink(name.c_str());
+        }
+        close(shared_fd_);
+        if (lock_fd >= 0) close(lock_fd);
+        munmap(shared_header_, sizeof(SharedHeader) + capacity_ * CLUSTER_SIZE);
+#endif
+
+        capacity_ = 0;
+        table_ = nullptr;
+        shared_header_ = nullptr;
+        shared_fd_ = -1;
+    } else if (table_) {
         assert(table_ != nullptr);
         assert(capacity_ > 0);
 
+        free_table(table_, capacity_ * CLUSTER_SIZE, mapped_);
+        capacity_ = 0;
+        table_ = nullptr;
+    }
+}
+
+void TranspositionTable::free_table(Cluster* table, usize bytes, bool mapped) {
 #ifdef _WIN32
-        _aligned_free(table_);
+    (void)bytes;
+    (void)mapped;
+    _aligned_free(table);
 #else
-        free(table_);
+    if (mapped)
+        munmap(table, bytes);
+    else
+        free(table);
 #endif
+}
 
-        capacity_ = 0;
-        table_ = nullptr;
+string TranspositionTable::shared_name(usize size) {
+#ifdef _WIN32
+    const string user = "";
+#else
+    const string user = to_string(getuid()) + "-";
+#endif
+    return "/raphael-tt-" + user + to_string(FILE_VERSION) + "-" + to_string(size);
+}
+
+int TranspositionTable::lock_shared_segments() {
+#ifdef _WIN32
+    return -1;
+#else
+    const auto name = "/raphael-tt-" + to_string(getuid()) + "-lock";
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+bool TranspositionTable::is_current_segment(int fd, const string& name) {
+#ifdef _WIN32
+    (void)fd;
+    (void)name;
+    return false;
+#else
+    const int current_fd = shm_open(name.c_str(), O_RDONLY, 0600);
+    if (current_fd < 0) return false;
+
+    struct stat st, current_st;
+    const bool same = fstat(fd, &st) == 0 && fstat(current_fd, &current_st) == 0
+                   && st.st_dev == current_st.st_dev && st.st_ino == current_st.st_ino;
+    close(current_fd);
+    return same;
+#endif
+}
+
+void TranspositionTable::remove_stale_segments() {
+#ifdef __linux__
+    // segment names of this version only differ in the size at the end
+    const auto name = shared_name(0);
+    const auto prefix = name.substr(1, name.size() - 2);
+
+    DIR* dir = opendir("/dev/shm");
+    if (!dir) return;
+
+    while (const dirent* entry = readdir(dir)) {
+        if (string(entry->d_name).rfind(prefix, 0) != 0) continue;
+
+        // a segment nobody holds a lock on was left behind by a process that was killed
+        const auto segment = "/" + string(entry->d_name);
+        const int fd = shm_open(segment.c_str(), O_RDWR, 0600);
+        if (fd < 0) continue;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0 && is_current_segment(fd, segment))
+            shm_unlink(segment.c_str());
+        close(fd);
     }
+    closedir(dir);
+#endif
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include <chess/include.h>
 
+#include <atomic>
+#include <string>
 #include <vector>
 
 
@@ -14,6 +16,8 @@ public:
 
     enum Flag : u8 { INVALID = 0, LOWER, EXACT, UPPER };
 
+    enum class PageMode : u8 { OFF = 0, THP, HUGETLB_2M, HUGETLB_1G };
+
     struct Entry {
         u16 key;          // zobrist hash of position
         i16 score;        // score of the position
@@ -21,7 +25,7 @@ public:
         u16 move;         // bestmove
         u16 fdepth;       // max MAX_DEPTH * DEPTH_SCALE
         u8 age_pv_flag;   // 5 bits age, 1 bit pv, 2 bits flag
-        u8 pad;           // find a use, I guess
+        u8 generation;    // table generation the entry was stored in
 
         u32 age() const;
         bool pv() const;
@@ -61,15 +65,49 @@ public:
         Flag flag;
     };
 
+    struct alignas(64) FileHeader {
+        char magic[8];
+        u32 version;
+        u32 cluster_size;
+        u32 entry_size;
+        u32 entries_per_cluster;
+        u64 size;
+        u32 age;
+        u32 generation;
+    };
+    static constexpr char FILE_MAGIC[8] = "RAPHTT";
+    static constexpr u32 FILE_VERSION = 2;
+    static_assert(sizeof(FileHeader) == CLUSTER_SIZE);
+
+    struct alignas(64) SharedHeader {
+        char magic[8];
+        u32 version;
+        std::atomic<u32> age;  // tt age, advanced by every process using the table
+        u64 size;
+    };
+    static_assert(sizeof(SharedHeader) == CLUSTER_SIZE);
+    static_assert(std::atomic<u32>::is_always_lock_free);
+
 private:
     usize size_;
     usize capacity_;
     Cluster* table_;
 
-    u32 age_ = 0;
+    bool shared_ = false;
+    SharedHeader* shared_header_ = nullptr;
+    int shared_fd_ = -1;  // holds a shared flock while attached, released by the os on exit
+
+    PageMode page_mode_ = PageMode::THP;
+    usize page_size_ = 0;  // page size backing the table, or 0 if not fixed
+    bool mapped_ = false;  // whether the table was allocated with mmap
+
+    u32 age_ = 0;  // unused if shared, the age is then kept in the shared header
     static constexpr u32 AGE_BITS = 5;
     static constexpr u32 MAX_AGE = (1 << AGE_BITS) - 1;
 
+    u32 generation_ = 0;  // entries from other generations are treated as empty
+    static constexpr u32 MAX_GENERATION = 255;
+
 
 public:
     /** Initializes the Transposition Table
@@ -87,9 +125,49 @@ public:
     /** Resizes the Transposition Table
      *
      * \param size_mb the size of the table (in MB)
-     * \param num_threads number of threads to use for clearing the resized table
+     * \param num_threads number of threads to use for clearing or rehashing the resized table
+     * \param preserve whether to migrate existing entries into the resized table instead of
+     * clearing it (ignored for shared tables)
+     */
+    void resize(i32 size_mb, i32 num_threads, bool preserve = false);
+
+    /** Moves the table into (or out of) a named shared memory segment, so that engine processes
+     * using the same table size probe and store into a single table. Falls back to a private table
+     * if the segment cannot be used. Clears the table
+     *
+     * \param shared whether to share the table
+     * \param num_threads number of threads to use for clearing the table
+     * \returns whether the table is shared
+     */
+    bool set_shared(bool shared, i32 num_threads);
+
+    /** Returns whether the table is in a shared memory segment
+     *
+     * \returns whether the table is shared
+     */
+    bool is_shared() const;
+
+    /** Returns the name of the shared memory segment for a table of the given size
+     *
+     * \param size size in number of clusters
+     * \returns name of the segment
      */
-    void resize(i32 size_mb, i32 num_threads);
+    static std::string shared_name(usize size);
+
+    /** Sets the page allocation policy and reallocates the table. Explicit huge pages fall back to
+     * smaller pages if they can't be allocated, and 1GB pages are only used for tables of at least
+     * 1GB. Ignored for shared tables. Clears the table
+     *
+     * \param mode page allocation policy
+     * \param num_threads number of threads to use for clearing the table
+     */
+    void set_page_mode(PageMode mode, i32 num_threads);
+
+    /** Returns a description of the pages backing the table
+     *
+     * \returns the page description
+     */
+    std::string page_info() const;
 
     /** Retrieves the table entry for a given key
      *
@@ -143,12 +221,35 @@ public:
      */
     void set_static_eval(u64 key, i32 static_eval);
 
-    /** Clears the table
+    /** Clears the table. A shared table is only cleared if no other process is using it
      *
      * \param num_threads number of threads to use for clearing the table
      */
     void clear(i32 num_threads);
 
+    /** Saves the table and its age to a file. Throws a runtime_error on failure
+     *
+     * \param path path of the file to save to
+     * \param num_threads number of threads to use for copying the table
+     */
+    void save(const std::string& path, i32 num_threads) const;
+
+    /** Loads the table and its age from a file created with save. The file must have been saved
+     * with the same table size and entry layout, and a shared table must not be in use by other
+     * processes. Throws a runtime_error on failure
+     *
+     * \param path path of the file to load from
+     * \param num_threads number of threads to use for copying the table
+     */
+    void load(const std::string& path, i32 num_threads);
+
+    /** Invalidates all entries in O(1) by starting a new generation. The table is only cleared
+     * when the generation counter wraps around
+     *
+     * \param num_threads number of threads to use if the table has to be cleared
+     */
+    void new_generation(i32 num_threads);
+
     /** Increments the tt age */
     void do_age();
 
@@ -156,6 +257,19 @@ public:
     i32 hashfull() const;
 
 private:
+    /** Returns the tt age. Processes sharing a table age it together, so their entries don't look
+     * stale to each other
+     *
+     * \returns the tt age
+     */
+    u32 table_age() const;
+
+    /** Sets the tt age
+     *
+     * \param age age to set
+     */
+    void set_table_age(u32 age);
+
     /** Computes the index on the table
      *
      * \param key the key to use
@@ -163,13 +277,81 @@ private:
      */
     u64 index(u64 key) const;
 
+    /** Computes the cluster key of the current generation, so static evals stored in an older
+     * generation don't match
+     *
+     * \param key the key to use
+     * \returns the cluster key
+     */
+    u16 cluster_key(u64 key) const;
+
+    /** Moves the entries of the table into a newly allocated table of a different size. When
+     * several entries map to the same cluster, the most valuable ones are kept
+     *
+     * \param newsize new size in number of entries
+     * \param num_threads number of threads to use for rehashing
+     */
+    void rehash(usize newsize, i32 num_threads);
+
+    /** Copies clusters between the table and a buffer using multiple threads
+     *
+     * \param dst buffer to copy into
+     * \param src buffer to copy from
+     * \param num_threads number of threads to use for copying
+     */
+    void parallel_copy(Cluster* dst, const Cluster* src, i32 num_threads) const;
+
     /** Allocates the table and sets capacity_ and table_ (not size)
      *
      * \param newsize new size in number of entries
      */
     void allocate(usize newsize);
 
+    /** Attaches to (creating if needed) the shared memory segment for a table of the given size
+     * and sets capacity_, table_, and shared_header_ (not size)
+     *
+     * \param newsize new size in number of entries
+     * \returns whether the segment could be attached
+     */
+    bool allocate_shared(usize newsize);
+
+    /** Returns whether another process is attached to the shared memory segment of the table
+     *
+     * \returns whether the segment is in use elsewhere
+     */
+    bool attached_elsewhere() const;
+
     /** Deallocates the table (if allocated) and sets capacity_ and table_ (not size) */
     void deallocate();
+
+    /** Frees a privately allocated table
+     *
+     * \param table table to free
+     * \param bytes allocated size of the table
+     * \param mapped whether the table was allocated with mmap
+     */
+    static void free_table(Cluster* table, usize bytes, bool mapped);
+
+    /** Takes the lock that serializes attaching to, detaching from, and removing segments. Every
+     * shm_unlink happens under it, so a segment opened under it can't be unlinked by the time it
+     * is attached. The lock is an empty segment that is never removed
+     *
+     * \returns descriptor holding the lock (close it to unlock), or -1 on failure
+     */
+    static int lock_shared_segments();
+
+    /** Returns whether a name still refers to an open segment, i.e. the segment was not unlinked
+     * and replaced by another one with the same name
+     *
+     * \param fd descriptor of the open segment
+     * \param name name of the segment
+     * \returns whether the name refers to the segment of fd
+     */
+    static bool is_current_segment(int fd, const std::string& name);
+
+    /** Removes the segments no process is attached to, which processes that were killed leave
+     * behind. Needs the lock from lock_shared_segments()
+     */
+    static void remove_stale_segments();
 };
 }  // namespace raphael
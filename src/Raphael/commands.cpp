@@ -1,25 +1,49 @@
 #include <Raphael/commands.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <queue>
 #include <random>
+#include <thread>
+#include <type_traits>
 
+using std::atomic;
+using std::condition_variable;
 using std::cout;
 using std::fixed;
 using std::flush;
 using std::ifstream;
+using std::ios;
+using std::lock_guard;
+using std::make_unique;
+using std::map;
+using std::max;
+using std::memory_order_relaxed;
+using std::min;
 using std::mt19937_64;
+using std::mutex;
+using std::ofstream;
+using std::queue;
 using std::setprecision;
+using std::stable_sort;
 using std::string;
+using std::thread;
 using std::uniform_int_distribution;
+using std::unique_lock;
+using std::unique_ptr;
 using std::vector;
 namespace ch = std::chrono;
 
 
 
 namespace raphael::commands {
-void bench(Raphael& engine) {
+const vector<const char*>& bench_fens() {
     // from https://github.com/Ciekce/Stormphrax/blob/main/src/bench.cpp
     static const vector<const char*> bench_data = {
         "r3k2r/2pb1ppp/2pp1q2/p7/1nP1B3/1P2P3/P2N1PPP/R2QK2R w KQkq - 0 14",
@@ -73,28 +97,63 @@ void bench(Raphael& engine) {
         "3br1k1/p1pn3p/1p3n2/5pNq/2P1p3/1PN3PP/P2Q1PB1/4R1K1 w - - 0 23",
         "2r2b2/5p2/5k2/p1r1pP2/P2pB3/1P3P2/K1P3R1/7R w - - 23 93",
     };
+    return bench_data;
+}
 
+i64 bench(Raphael& engine) {
     engine.set_uciinfolevel(raphael::Raphael::UciInfoLevel::MINIMAL);
     engine.reset();
 
-    cout << "bench: starting\n" << flush;
+    cout << "bench: starting with " << Nnue::kernel_name() << " nnue kernels ("
+         << ((std::is_same_v<Nnue::FtWeight, i8>) ? "i8" : "i16") << " ft weights) and "
+         << chess::Attacks::slider_lookup_name() << " slider lookups\n"
+         << flush;
+    if (!Nnue::network_decode_info().empty())
+        cout << "bench: " << Nnue::network_decode_info() << "\n" << flush;
+    if (const auto timings = chess::Attacks::slider_timings(); timings.pext_ns > 0)
+        cout << "bench: slider lookups take " << fixed << setprecision(2) << timings.pext_ns
+             << "ns with pext, " << timings.magic_ns << "ns with magic\n"
+             << flush;
 
     i64 runtime = 0;
     u64 nodes = 0;
-    for (auto fen : bench_data) {
+    u64 evalcache_probes = 0;
+    u64 evalcache_hits = 0;
+    map<i32, u64> node_nodes;  // nodes searched per numa node
+    map<i32, i32> node_threads;
+    for (auto fen : bench_fens()) {
         const chess::Board board(fen);
         engine.set_board(board);
 
         cout << "\ninfo string fen: " << fen << "\n" << flush;
 
         const auto start_t = ch::steady_clock::now();
-        const auto res = engine.search({.maxdepth = BENCH_DEPTH});
+        engine.search({.maxdepth = BENCH_DEPTH});
         const auto now = ch::steady_clock::now();
 
         runtime += ch::duration_cast<ch::milliseconds>(now - start_t).count();
-        nodes += res.nodes;
+        node_threads.clear();
+        for (const auto& stats : engine.thread_stats()) {
+            nodes += stats.nodes;
+            evalcache_probes += stats.evalcache_probes;
+            evalcache_hits += stats.evalcache_hits;
+            node_nodes[stats.numa_node] += stats.nodes;
+            node_threads[stats.numa_node]++;
+        }
+    }
+
+    // per node breakdown, only if threads were bound to nodes
+    if (!node_nodes.contains(-1)) {
+        cout << "\n";
+        for (const auto& [node, count] : node_nodes)
+            cout << "numa node " << node << ": " << node_threads[node] << " threads " << count
+                 << " nodes " << i64(1000.0f * count / runtime) << " nps\n";
     }
 
+    cout << "\neval cache: " << evalcache_hits << " hits of " << evalcache_probes << " probes ("
+         << fixed << setprecision(2) << 100.0 * evalcache_hits / max<u64>(evalcache_probes, 1)
+         << "%)\n";
+
     const i64 nps = 1000.0f * nodes / runtime;
     cout << "\nbench: completed in " << runtime << "ms:\n"
          << nodes << " nodes " << nps << " nps\n"
@@ -104,6 +163,127 @@ void bench(Raphael& engine) {
     const auto avg_nnz = Nnue::save_ft_activations();
     cout << "avg nnz: " << avg_nnz << "\n" << flush;
 #endif
+    return nps;
+}
+
+
+namespace {
+/** Lockless table of subtree leaf counts shared by the perft threads. Like the eval cache, the key
+ * is stored xored with the data so a torn write fails verification instead of returning a wrong
+ * count
+ */
+class PerftTable {
+private:
+    struct Entry {
+        atomic<u64> check;  // zobrist hash of position ^ data
+        atomic<u64> data;   // leaves << 8 | depth
+    };
+
+    unique_ptr<Entry[]> table_;
+    usize size_ = 0;
+
+public:
+    explicit PerftTable(i32 size_mb) {
+        size_ = static_cast<usize>(size_mb) * 1024 * 1024 / sizeof(Entry);
+        if (size_) table_ = make_unique<Entry[]>(size_);
+    }
+
+    bool enabled() const { return size_ != 0; }
+
+    bool probe(u64 key, i32 depth, u64& leaves) const {
+        const auto& entry = table_[index(key, depth)];
+        const u64 data = entry.data.load(memory_order_relaxed);
+        const u64 check = entry.check.load(memory_order_relaxed);
+
+        if ((check ^ data) != key || static_cast<i32>(data & 0xFF) != depth) return false;
+        leaves = data >> 8;
+        return true;
+    }
+
+    void store(u64 key, i32 depth, u64 leaves) {
+        auto& entry = table_[index(key, depth)];
+        const u64 data = (leaves << 8) | static_cast<u64>(depth);
+        entry.data.store(data, memory_order_relaxed);
+        entry.check.store(key ^ data, memory_order_relaxed);
+    }
+
+private:
+    usize index(u64 key, i32 depth) const {
+        // mix in the depth so the same position at different depths uses different slots
+        const u64 mixed = key ^ (static_cast<u64>(depth) * 0x9E3779B97F4A7C15ULL);
+        return static_cast<usize>((static_cast<u128>(mixed) * static_cast<u128>(size_)) >> 64);
+    }
+};
+
+/** Counts the leaves below a position, bulk counting the last ply. Moves are made and unmade on
+ * the board in place, with one undo record per ply
+ *
+ * \param board position to count from, restored on return
+ * \param depth depth to count to, at least 1
+ * \param table perft hash table, possibly disabled
+ * \returns the number of leaves
+ */
+u64 perft_leaves(chess::Board& board, i32 depth, PerftTable& table) {
+    chess::MoveList<chess::ScoredMove> moves;
+    chess::Movegen::generate_legals(moves, board);
+    if (depth == 1) return moves.size();
+
+    u64 leaves = 0;
+    if (table.enabled() && table.probe(board.hash(), depth, leaves)) return leaves;
+
+    chess::Board::UndoInfo undo;
+    for (const auto& smove : moves) {
+        board.make_move(smove.move, undo);
+        leaves += perft_leaves(board, depth - 1, table);
+        board.unmake_move(smove.move, undo);
+    }
+
+    if (table.enabled()) table.store(board.hash(), depth, leaves);
+    return leaves;
+}
+}  // namespace
+
+u64 perft(const chess::Board& board, i32 depth, i32 threads, i32 hash_mb) {
+    assert(depth >= 1 && threads >= 1);
+    PerftTable table(hash_mb);
+
+    chess::MoveList<chess::ScoredMove> moves;
+    chess::Movegen::generate_legals(moves, board);
+    vector<u64> counts(moves.size());
+
+    const auto start_t = ch::steady_clock::now();
+
+    // threads take the next uncounted root move until none are left
+    atomic<usize> next = 0;
+    const auto work = [&]() {
+        chess::Board thread_board = board;
+        chess::Board::UndoInfo undo;
+        for (usize i = next++; i < moves.size(); i = next++) {
+            thread_board.make_move(moves[i].move, undo);
+            counts[i] = (depth > 1) ? perft_leaves(thread_board, depth - 1, table) : 1;
+            thread_board.unmake_move(moves[i].move, undo);
+        }
+    };
+
+    vector<thread> workers;
+    const i32 n_workers = min<i32>(threads, max<usize>(moves.size(), 1));
+    for (i32 i = 0; i < n_workers; i++) workers.emplace_back(work);
+    for (auto& worker : workers) worker.join();
+
+    const auto runtime
+        = ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start_t).count();
+
+    u64 leaves = 0;
+    for (usize i = 0; i < moves.size(); i++) {
+        cout << chess::uci::from_move(moves[i].move, board.chess960()) << ": " << counts[i] << "\n";
+        leaves += counts[i];
+    }
+
+    cout << "\nperft: depth " << depth << " completed in " << runtime / 1000 << "ms:\n"
+         << leaves << " nodes " << fixed << setprecision(2)
+         << f64(leaves) / max<i64>(runtime, 1) << " Mnps\n"
+         << flush;
+    return leaves;
 }
 
 
@@ -172,7 +352,7 @@ void genfens(
 }
 
 
-void evalstats(Raphael& engine, const std::string& book) {
+void evalstats(Raphael& engine, const std::string& book, i32 threads) {
     // based on https://github.com/cosmobobak/viridithas/blob/master/src/evaluation.rs
     ifstream file(book);
     if (!file) {
@@ -187,25 +367,41 @@ void evalstats(Raphael& engine, const std::string& book) {
     i32 min_eval = INT32_MAX;
     i32 max_eval = INT32_MIN;
 
-    chess::Board board;
+    constexpr usize chunk_size = 65536;  // positions read and evaluated at a time
+    vector<chess::Board> boards;
+    vector<i32> evals(chunk_size);
+    boards.reserve(chunk_size);
     string fen;
 
-    while (getline(file, fen)) {
-        if (fen.empty()) continue;
-
-        board.set_fen(fen);
-        if (board.in_check()) continue;
+    const auto start_t = ch::steady_clock::now();
+    bool done = false;
+    while (!done) {
+        boards.clear();
+        while (boards.size() < chunk_size) {
+            if (!getline(file, fen)) {
+                done = true;
+                break;
+            }
+            if (fen.empty()) continue;
+
+            chess::Board board;
+            board.set_fen(fen);
+            if (!board.in_check()) boards.push_back(board);
+        }
 
-        engine.set_board(board);
-        i64 eval = engine.static_eval(false);
+        engine.static_eval_batch(boards, {evals.data(), boards.size()}, threads);
 
-        count++;
-        total += eval;
-        abs_total += abs(eval);
-        sq_total += eval * eval;
-        if (eval < min_eval) min_eval = eval;
-        if (eval > max_eval) max_eval = eval;
+        for (usize i = 0; i < boards.size(); i++) {
+            const i64 eval = evals[i];
+            count++;
+            total += eval;
+            abs_total += abs(eval);
+            sq_total += eval * eval;
+            if (eval < min_eval) min_eval = eval;
+            if (eval > max_eval) max_eval = eval;
+        }
     }
+    const auto dtime = ch::duration_cast<ch::milliseconds>(ch::steady_clock::now() - start_t);
 
     if (count > 0) {
         const auto mean = f64(total) / f64(count);
@@ -221,9 +417,241 @@ void evalstats(Raphael& engine, const std::string& book) {
              << "min:      " << min_eval << "\n"
              << "max:      " << max_eval << "\n"
              << "newscale: " << newscale << "\n"
+             << "evaluated " << i64(count) << " positions in " << dtime.count() << "ms ("
+             << i64(count) * 1000 / max<i64>(dtime.count(), 1) << " pos/s)\n"
              << flush;
     }
 
     file.close();
 }
+
+
+void sparsityprofile(const std::string& book, const std::string& outfile, i32 threads) {
+    ifstream file(book);
+    if (!file) {
+        cout << "info string could not open book: " << book << "\n" << flush;
+        return;
+    }
+
+    constexpr usize chunk_size = 65536;  // positions read and evaluated at a time
+    vector<chess::Board> boards;
+    vector<i32> evals(chunk_size);
+    boards.reserve(chunk_size);
+    auto stats = make_unique<Nnue::ActivationStats>();
+    string fen;
+
+    bool done = false;
+    while (!done) {
+        boards.clear();
+        while (boards.size() < chunk_size) {
+            if (!getline(file, fen)) {
+                done = true;
+                break;
+            }
+            if (fen.empty()) continue;
+
+            chess::Board board;
+            board.set_fen(fen);
+            if (!board.in_check()) boards.push_back(board);
+        }
+
+        Nnue::evaluate_batch(boards, {evals.data(), boards.size()}, threads, stats.get());
+    }
+
+    if (stats->samples == 0) {
+        cout << "info string book file is empty\n" << flush;
+        return;
+    }
+
+    // most active neurons first, so rarely active neurons share blocks
+    constexpr i32 n_neurons = Nnue::L1_SIZE / 2;
+    vector<i32> order(n_neurons);
+    for (i32 i = 0; i < n_neurons; i++) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](i32 a, i32 b) {
+        return stats->activations[a] > stats->activations[b];
+    });
+
+    ofstream out(outfile);
+    if (!out) {
+        cout << "info string could not open output: " << outfile << "\n" << flush;
+        return;
+    }
+    for (const auto idx : order) out << idx << "\n";
+    out.close();
+
+    i32 dead = 0;
+    for (i32 i = 0; i < n_neurons; i++) dead += (stats->activations[i] == 0);
+
+    cout << fixed << setprecision(2) << "positions:      " << stats->samples / 2 << "\n"
+         << "avg nnz blocks: " << f64(stats->nnz_blocks) / f64(stats->samples) << " of "
+         << n_neurons / 4 << " per perspective\n"
+         << "dead neurons:   " << dead << "\n"
+         << "info string wrote neuron order to " << outfile << ", apply it with ./perm <network> "
+         << outfile << "\n"
+         << flush;
+}
+
+
+void evalbatch(
+    const std::string& infile, const std::string& outfile, i32 threads, u64 nodes, bool binary
+) {
+    ifstream in(infile);
+    if (!in) {
+        cout << "info string could not open input: " << infile << "\n" << flush;
+        return;
+    }
+    ofstream out(outfile, (binary) ? ios::binary : ios::out);
+    if (!out) {
+        cout << "info string could not open output: " << outfile << "\n" << flush;
+        return;
+    }
+
+    struct Chunk {
+        u64 idx;
+        vector<string> fens;
+        vector<EvalBatchRecord> records;
+    };
+
+    mutex chunk_mutex;
+    condition_variable read_cv;   // reader waits for in flight chunks to be written
+    condition_variable work_cv;   // workers wait for chunks to score
+    condition_variable write_cv;  // writer waits for the next chunk in order
+    queue<unique_ptr<Chunk>> pending;
+    map<u64, unique_ptr<Chunk>> scored;
+    const u64 max_in_flight = (u64)threads * EVALBATCH_CHUNKS_PER_THREAD;
+    u64 in_flight = 0;
+    u64 n_chunks = 0;
+    bool input_done = false;
+
+    const auto start_t = ch::steady_clock::now();
+
+    // reader: streams the input in chunks, never holding more than max_in_flight chunks
+    thread reader([&]() {
+        string line;
+        bool eof = false;
+        while (!eof) {
+            auto chunk = make_unique<Chunk>();
+            chunk->fens.reserve(EVALBATCH_CHUNK_SIZE);
+            while (chunk->fens.size() < EVALBATCH_CHUNK_SIZE) {
+                if (!getline(in, line)) {
+                    eof = true;
+                    break;
+                }
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (!line.empty()) chunk->fens.push_back(line);
+            }
+
+            unique_lock<mutex> lock(chunk_mutex);
+            if (!chunk->fens.empty()) {
+                read_cv.wait(lock, [&]() { return in_flight < max_in_flight; });
+                chunk->idx = n_chunks++;
+                in_flight++;
+                pending.push(std::move(chunk));
+                work_cv.notify_one();
+            }
+        }
+
+        lock_guard<mutex> lock(chunk_mutex);
+        input_done = true;
+        work_cv.notify_all();
+        write_cv.notify_one();
+    });
+
+    // workers: score chunks with their own engine so results don't depend on the thread count
+    const auto work = [&]() {
+        auto engine = make_unique<Raphael>();
+        engine->set_uciinfolevel(Raphael::UciInfoLevel::NONE);
+        engine->set_option("Hash", EVALBATCH_HASH);
+        engine->set_option("Threads", 1);
+        chess::Board board;
+
+        while (true) {
+            unique_ptr<Chunk> chunk;
+            {
+                unique_lock<mutex> lock(chunk_mutex);
+                work_cv.wait(lock, [&]() { return !pending.empty() || input_done; });
+                if (pending.empty()) return;
+                chunk = std::move(pending.front());
+                pending.pop();
+            }
+
+            chunk->records.resize(chunk->fens.size());
+            for (usize i = 0; i < chunk->fens.size(); i++) {
+                auto& record = chunk->records[i];
+                if (nodes > 0) engine->reset();
+
+                board.set_fen(chunk->fens[i]);
+                engine->set_board(board);
+                record.raw_eval = engine->static_eval(false);
+                record.corrected_eval = engine->static_eval(true);
+                record.score = 0;
+                record.move = 0;
+
+                if (nodes > 0) {
+                    const auto res = engine->search({.maxnodes = nodes});
+                    const i32 plies = 2 * abs(res.score) - (res.score > 0);
+                    record.score = (!res.is_mate)     ? res.score
+                                   : (res.score > 0) ? MATE_SCORE - plies
+                                                     : -(MATE_SCORE - plies);
+                    record.move = static_cast<u16>(res.move);
+                }
+            }
+
+            lock_guard<mutex> lock(chunk_mutex);
+            const auto idx = chunk->idx;
+            scored[idx] = std::move(chunk);
+            write_cv.notify_one();
+        }
+    };
+
+    vector<thread> workers;
+    workers.reserve(threads);
+    for (i32 t = 0; t < threads; t++) workers.emplace_back(work);
+
+    // writer: writes chunks in input order as they complete
+    u64 positions = 0;
+    for (u64 next = 0;; next++) {
+        unique_ptr<Chunk> chunk;
+        {
+            unique_lock<mutex> lock(chunk_mutex);
+            write_cv.wait(lock, [&]() {
+                return scored.contains(next) || (input_done && next == n_chunks);
+            });
+            if (!scored.contains(next)) break;
+            chunk = std::move(scored[next]);
+            scored.erase(next);
+        }
+
+        for (usize i = 0; i < chunk->fens.size(); i++) {
+            const auto& record = chunk->records[i];
+            if (binary) {
+                out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+                continue;
+            }
+
+            out << chunk->fens[i] << " | " << record.raw_eval << " | " << record.corrected_eval;
+            if (nodes > 0) {
+                const auto move = chess::Move(record.move);
+                const auto movestr
+                    = (move == chess::Move::NO_MOVE) ? "none" : chess::uci::from_move(move);
+                out << " | " << movestr << " | " << record.score;
+            }
+            out << "\n";
+        }
+        positions += chunk->fens.size();
+
+        lock_guard<mutex> lock(chunk_mutex);
+        in_flight--;
+        read_cv.notify_one();
+    }
+
+    reader.join();
+    for (auto& worker : workers) worker.join();
+    out.close();
+
+    const auto dtime = ch::duration_cast<ch::milliseconds>(ch::steady_clock::now() - start_t);
+    cout << "evaluated " << positions << " positions in " << dtime.count() << "ms ("
+         << positions * 1000 / max<i64>(dtime.count(), 1) << " pos/s)\n"
+         << flush;
+}
 }  // namespace raphael::commands
@@ -3,11 +3,31 @@
 
 
 namespace raphael::commands {
-/** Runs the benchmark
+/** Returns the positions searched by bench
+ *
+ * \returns the bench fens
+ */
+const std::vector<const char*>& bench_fens();
+
+/** Runs the benchmark, reporting nps per numa node if threads are bound to nodes
  *
  * \param engine engine to benchmark
+ * \returns the nps
  */
-void bench(Raphael& engine);
+i64 bench(Raphael& engine);
+
+
+/** Counts the leaves of the legal move tree, printing the count under each root move (divide)
+ * and the speed. Root moves are split between threads, and leaves are bulk counted from the
+ * length of the move list at depth 1
+ *
+ * \param board position to count from
+ * \param depth depth to count to
+ * \param threads number of threads to count with
+ * \param hash_mb size of the shared perft hash table in MiB, 0 to disable it
+ * \returns the number of leaves
+ */
+u64 perft(const chess::Board& board, i32 depth, i32 threads, i32 hash_mb);
 
 
 /** Generates randomized fens
@@ -28,6 +48,40 @@ void genfens(
  *
  * \param engine engine for evaluating positions
  * \param book book to use
+ * \param threads number of threads to evaluate with
  */
-void evalstats(Raphael& engine, const std::string& book);
+void evalstats(Raphael& engine, const std::string& book, i32 threads);
+
+
+/** Measures how often each ft neuron fires over a book and writes the neuron order that sorts
+ * them by activation frequency, for perm to apply to a network
+ *
+ * \param book book to profile with
+ * \param outfile file to write the neuron order to
+ * \param threads number of threads to evaluate with
+ */
+void sparsityprofile(const std::string& book, const std::string& outfile, i32 threads);
+
+
+/** Binary output of evalbatch, one record per input position */
+struct EvalBatchRecord {
+    i16 raw_eval;
+    i16 corrected_eval;
+    i16 score;  // search score, mates are stored as +-(MATE_SCORE - plies). 0 if not searched
+    u16 move;   // search bestmove, 0 if not searched
+};
+
+/** Scores every position in a fen/epd file with the raw and corrected static eval and optionally
+ * a fixed node search. A reader thread streams the input in chunks to a pool of workers, and the
+ * results are written in input order as they complete
+ *
+ * \param infile fen/epd file to score
+ * \param outfile file to write the results to
+ * \param threads number of worker threads, each with its own single threaded engine
+ * \param nodes nodes to search each position with, or 0 to skip the search
+ * \param binary whether to write EvalBatchRecords instead of text lines
+ */
+void evalbatch(
+    const std::string& infile, const std::string& outfile, i32 threads, u64 nodes, bool binary
+);
 }  // namespace raphael::commands
@@ -1,25 +1,130 @@
 #include <Raphael/nnue.h>
+#include <Raphael/nnue_kernels.h>
+#include <Raphael/utils.h>
 
+#define INCBIN_ALIGNMENT_INDEX 6  // align to Nnue::MEM_ALIGNMENT regardless of instruction set
 #define INCBIN_PREFIX g_
 #define INCBIN_STYLE INCBIN_STYLE_SNAKE
 #include <thirdparty/incbin.h>
 
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 using namespace raphael;
+using std::atomic;
+using std::bit_width;
 using std::copy;
+using std::lock_guard;
+using std::make_unique;
 using std::max;
+using std::memcpy;
 using std::min;
+using std::mutex;
 using std::ofstream;
 using std::popcount;
 using std::runtime_error;
+using std::shared_ptr;
+using std::span;
+using std::string;
+using std::thread;
 using std::vector;
+namespace ch = std::chrono;
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 
+#ifdef EMBEDDED_NETWORK_FILE
+INCBIN(unsigned char, netfile, TOSTRING(EMBEDDED_NETWORK_FILE));
+#else
 INCBIN(unsigned char, netfile, TOSTRING(NETWORK_FILE));
+#endif
+
+// packed networks store W0 in chunks of PACK_CHUNK_ROWS feature rows of every king bucket, each
+// split into blocks of PACK_BLOCK weights led by a byte holding the bit width and PACK_DELTA flag
+static constexpr char PACKED_MAGIC[4] = {'R', 'N', 'P', 'K'};
+static constexpr i32 PACK_CHUNK_ROWS = 16;
+static constexpr i32 PACK_BLOCK = 64;
+static constexpr u8 PACK_DELTA = 0x80;  // block stores the delta to the previous king bucket
+static constexpr u8 PACK_WIDTH = 0x1F;
+static constexpr usize PACK_PADDING = 8;  // so blocks can be read 8 bytes at a time
+
+static_assert(Nnue::N_INPUTS % PACK_CHUNK_ROWS == 0);
+static_assert(Nnue::L1_SIZE % PACK_BLOCK == 0);
+
+/** Header of a packed network, followed by the offset of each chunk and the packed data */
+struct PackedHeader {
+    char magic[4];
+    u32 chunk_rows;   // feature rows of each king bucket per chunk
+    u64 params_size;  // size of the unpacked network
+    u64 n_chunks;
+};
+
+static constexpr usize PACKED_W0_END = offsetof(Nnue::NnueParams, b0);
+static constexpr usize PACKED_TAIL_SIZE = sizeof(Nnue::NnueParams) - PACKED_W0_END;
+
+/** Maps small magnitude weights of either sign to small unsigned values
+ *
+ * \param value value to map
+ * \returns the zigzag encoded value
+ */
+static u16 zigzag(i16 value) { return static_cast<u16>((value << 1) ^ (value >> 15)); }
+
+/** Inverse of zigzag
+ *
+ * \param value zigzag encoded value
+ * \returns the decoded value
+ */
+static i16 unzigzag(u16 value) { return static_cast<i16>((value >> 1) ^ -(value & 1)); }
+
+/** Unpacks the W0 blocks of one chunk of a packed network
+ *
+ * \param net network to unpack into
+ * \param chunk chunk index
+ * \param data start of the packed chunk
+ * \param end end of the packed chunk, followed by at least PACK_PADDING readable bytes
+ * \returns whether the chunk was well formed
+ */
+static bool unpack_chunk(Nnue::NnueParams& net, usize chunk, const u8* data, const u8* end) {
+    for (usize f = chunk * PACK_CHUNK_ROWS; f < (chunk + 1) * PACK_CHUNK_ROWS; f++) {
+        for (i32 b = 0; b < Nnue::N_INBUCKETS; b++) {
+            for (i32 i = 0; i < Nnue::L1_SIZE; i += PACK_BLOCK) {
+                if (data >= end) return false;
+                const i32 width = *data & PACK_WIDTH;
+                const bool delta = *data & PACK_DELTA;
+                data++;
+                if (width > 16 || (delta && b == 0) || end - data < PACK_BLOCK / 8 * width)
+                    return false;
+
+                const u64 mask = (u64(1) << width) - 1;
+                Nnue::FtWeight* out = &net.W0[b][f][i];
+                const Nnue::FtWeight* ref = (delta) ? &net.W0[b - 1][f][i] : nullptr;
+                for (i32 k = 0; k < PACK_BLOCK; k++) {
+                    const usize bit = static_cast<usize>(k) * width;
+                    u64 word;
+                    memcpy(&word, data + bit / 8, sizeof(word));
+                    const i16 value = unzigzag((word >> (bit % 8)) & mask);
+                    out[k] = (delta) ? ref[k] + value : value;
+                }
+                data += PACK_BLOCK / 8 * width;
+            }
+        }
+    }
+    return data == end;
+}
 
 
 
@@ -30,6 +135,10 @@ i32 Nnue::NnueFeature::index(chess::Color perspective, bool mirror) const {
     return 64 * pc + sq.relative(perspective);
 }
 
+i32 Nnue::NnueFeature::small_index(chess::Color perspective) const {
+    return 64 * piece.relative(perspective) + square.relative(perspective);
+}
+
 
 
 Nnue::NnueFinnyEntry::NnueFinnyEntry() {}
@@ -39,7 +148,8 @@ void Nnue::NnueFinnyEntry::initialize(const i16 biases[L1_SIZE]) {
 }
 
 void Nnue::NnueFinnyEntry::update(
-    const i16 weights[N_INPUTS][L1_SIZE],
+    const nnue_kernels::Kernels& kernels,
+    const FtWeight weights[N_INPUTS][L1_SIZE],
     const chess::Board& board,
     chess::Color perspective,
     bool mirror
@@ -81,44 +191,7 @@ void Nnue::NnueFinnyEntry::update(
     for (const auto color : {chess::Color::WHITE, chess::Color::BLACK})
         occ_[color] = board.occ(color);
 
-#ifdef USE_SIMD
-    constexpr i32 regw = ALIGNMENT / sizeof(i16);
-    constexpr i32 n_chunks = L1_SIZE / regw;
-    static_assert(L1_SIZE % regw == 0);
-    static_assert(n_chunks % SIMD_REGS == 0);
-    VecI16 accs[SIMD_REGS];
-
-    for (i32 i = 0; i < n_chunks; i += SIMD_REGS) {
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < SIMD_REGS; r++) accs[r] = load_i16(&values[(i + r) * regw]);
-
-        // add features
-        for (i32 f = 0; f < n_adds; f++) {
-            const auto fidx = adds[f];
-
-            #pragma GCC unroll 32  // fmt: skip
-            for (i32 r = 0; r < SIMD_REGS; r++)
-                accs[r] = add_i16(accs[r], load_i16(&weights[fidx][(i + r) * regw]));
-        }
-
-        // rem features
-        for (i32 f = 0; f < n_subs; f++) {
-            const auto fidx = subs[f];
-
-            #pragma GCC unroll 32  // fmt: skip
-            for (i32 r = 0; r < SIMD_REGS; r++)
-                accs[r] = sub_i16(accs[r], load_i16(&weights[fidx][(i + r) * regw]));
-        }
-
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < SIMD_REGS; r++) store_i16(&values[(i + r) * regw], accs[r]);
-    }
-#else
-    for (i32 f = 0; f < n_adds; f++)
-        for (i32 i = 0; i < L1_SIZE; i++) values[i] += weights[adds[f]][i];
-    for (i32 f = 0; f < n_subs; f++)
-        for (i32 i = 0; i < L1_SIZE; i++) values[i] -= weights[subs[f]][i];
-#endif
+    kernels.update_finny(values, weights, adds, n_adds, subs, n_subs);
 }
 
 chess::BitBoard Nnue::NnueFinnyEntry::occ(chess::PieceType pt, chess::Color color) const {
@@ -149,63 +222,17 @@ void Nnue::NnueAccumulator::reset_updates() {
     n_subs = 0;
 }
 
-void Nnue::NnueAccumulator::update(
-    const NnueAccumulator& old_acc,
-    const i16 weights[N_INPUTS][L1_SIZE],
-    chess::Color perspective,
-    bool mirror
+void Nnue::NnueAccumulator::take_update(
+    nnue_kernels::AccumulatorUpdate& update, chess::Color perspective, bool mirror
 ) {
     assert(dirty());
-    assert(!old_acc.dirty());
-    assert(!old_acc.needs_refresh);
-
-    i32 add1 = adds[0].index(perspective, mirror);
-    i32 add2 = adds[1].index(perspective, mirror);
-    i32 sub1 = subs[0].index(perspective, mirror);
-    i32 sub2 = subs[1].index(perspective, mirror);
-
-#ifdef USE_SIMD
-    constexpr i32 regw = ALIGNMENT / sizeof(i16);
-    constexpr i32 n_chunks = L1_SIZE / regw;
-    static_assert(L1_SIZE % regw == 0);
-    static_assert(n_chunks % SIMD_REGS == 0);
-    VecI16 accs[SIMD_REGS];
-
-    for (i32 i = 0; i < n_chunks; i += SIMD_REGS) {
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < SIMD_REGS; r++) accs[r] = load_i16(&old_acc.values[(i + r) * regw]);
-
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < SIMD_REGS; r++)
-            accs[r] = sub_i16(accs[r], load_i16(&weights[sub1][(i + r) * regw]));
-
-        if (n_subs > 1)
-            #pragma GCC unroll 32  // fmt: skip
-            for (i32 r = 0; r < SIMD_REGS; r++)
-                accs[r] = sub_i16(accs[r], load_i16(&weights[sub2][(i + r) * regw]));
-
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < SIMD_REGS; r++)
-            accs[r] = add_i16(accs[r], load_i16(&weights[add1][(i + r) * regw]));
-
-        if (n_adds > 1)
-            #pragma GCC unroll 32  // fmt: skip
-            for (i32 r = 0; r < SIMD_REGS; r++)
-                accs[r] = add_i16(accs[r], load_i16(&weights[add2][(i + r) * regw]));
-
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < SIMD_REGS; r++) store_i16(&values[(i + r) * regw], accs[r]);
-    }
-#else
-    for (i32 i = 0; i < L1_SIZE; i++) {
-        values[i] = old_acc.values[i];
+    assert(!needs_refresh);
 
-        values[i] -= weights[sub1][i];
-        if (n_subs > 1) values[i] -= weights[sub2][i];
-        values[i] += weights[add1][i];
-        if (n_adds > 1) values[i] += weights[add2][i];
-    }
-#endif
+    update.values = values;
+    for (i32 i = 0; i < n_adds; i++) update.adds[i] = adds[i].index(perspective, mirror);
+    for (i32 i = 0; i < n_subs; i++) update.subs[i] = subs[i].index(perspective, mirror);
+    update.n_adds = n_adds;
+    update.n_subs = n_subs;
 
     reset_updates();
 }
@@ -216,67 +243,452 @@ void Nnue::NnueAccumulator::refresh_from(const NnueFinnyEntry& finny_entry) {
     needs_refresh = false;
 }
 
-#ifdef USE_SIMD
-void Nnue::SparseIterator::add_nonzeros(VecU8 l0_out0, VecU8 l0_out1) {
-    constexpr i32 regw32 = ALIGNMENT / sizeof(i32);
-    static_assert(regw32 % 8 == 0);
 
-    #ifdef __AVX512VBMI2__
-    static_assert(USE_SIMD == 512);
-    const auto mask = _mm512_kunpackw(nonzero_mask(l0_out1), nonzero_mask(l0_out0));
 
-    const auto idxs = _mm512_maskz_compress_epi16(mask, offset_);
-    _mm512_storeu_si512(&indices_[count_], idxs);
-    offset_ = add_i16(offset_, full_i16(32));
-    count_ += popcount(mask);
+Nnue::Nnue()
+    : network_(loaded_network().params),
+      params(network_.get()),
+      kernels_(&kernels()),
+      small_network_(loaded_small_network().params),
+      small_params(small_network_.get()),
+      idx_(0) {
+    // set the finny table entries to the bias
+    for (const auto perspective : {chess::Color::WHITE, chess::Color::BLACK})
+        for (const auto mirror : {false, true})
+            for (i32 bucket = 0; bucket < N_INBUCKETS; bucket++)
+                finny_table[perspective][mirror][bucket].initialize(params->b0);
+}
+
+Nnue::LoadedNetwork Nnue::embedded_network(bool huge_pages) {
+#ifdef NNUE_PACKED
+    // unpack once per process, later loads of the embedded network reuse the decoded copy
+    static const LoadedNetwork unpacked = unpack_loaded(
+        span<const u8>(g_netfile_data, g_netfile_size), EMBEDDED_NETWORK, true
+    );
+    auto loaded = unpacked;
+    loaded.huge_pages = huge_pages;
+    return loaded;
+#else
+    constexpr usize padded_size = 64 * ((sizeof(NnueParams) + 63) / 64);
+    if (g_netfile_size != padded_size)
+        throw runtime_error("network file and architecture doesn't match");
+
+    if (reinterpret_cast<uintptr_t>(g_netfile_data) % alignof(NnueParams) != 0)
+        throw runtime_error("network file isn't aligned properly");
+
+    LoadedNetwork loaded;
+    loaded.source = shared_ptr<const NnueParams>(
+        reinterpret_cast<const NnueParams*>(g_netfile_data), [](const NnueParams*) {}
+    );
+    loaded.name = EMBEDDED_NETWORK;
+    loaded.huge_pages = huge_pages;
+    loaded.params = prepare_network(loaded);
+    return loaded;
+#endif
+}
 
-    #else
-    u32 full_mask = (nonzero_mask(l0_out1) << regw32) | nonzero_mask(l0_out0);
+Nnue::LoadedNetwork Nnue::unpack_loaded(span<const u8> data, const string& name, bool huge_pages) {
+    const i32 num_threads = max(1u, thread::hardware_concurrency());
+    const auto start = ch::steady_clock::now();
+
+    const auto net = unpack_network(data, num_threads);
+    permute_network(*net, kernels().perm);
+
+    const auto ms = ch::duration_cast<ch::milliseconds>(ch::steady_clock::now() - start).count();
+    return LoadedNetwork{
+        .source = net,
+        .params = net,
+        .name = name,
+        .huge_pages = huge_pages,
+        .unpacked = true,
+        .decode_info = "unpacked " + std::to_string(data.size() >> 20) + " MB network into "
+                       + std::to_string(sizeof(NnueParams) >> 20) + " MB in "
+                       + std::to_string(ms) + "ms with " + std::to_string(num_threads)
+                       + " threads",
+    };
+}
 
-    for (i32 i = 0; i < regw32 / 4; i++) {
-        // get offset of up to 8 nonzeros at a time
-        const u8 mask = full_mask & 0xFF;
-        full_mask >>= 8;
+Nnue::LoadedNetwork& Nnue::loaded_network() {
+    static LoadedNetwork loaded = embedded_network(true);
+    return loaded;
+}
 
-        const auto idxs = _mm_add_epi16(
-            offset_, _mm_load_si128(reinterpret_cast<const __m128i*>(&nonzero_idx[mask]))
-        );
-        _mm_storeu_si128(reinterpret_cast<__m128i*>(&indices_[count_]), idxs);
-        offset_ = _mm_add_epi16(offset_, _mm_set1_epi16(8));
-        count_ += popcount(mask);
+shared_ptr<Nnue::NnueParams> Nnue::huge_page_alloc() {
+#ifdef __linux__
+    constexpr usize page_size = 2 * 1024 * 1024;
+    constexpr usize bytes = ((sizeof(NnueParams) + page_size - 1) / page_size) * page_size;
+
+    void* data = aligned_alloc(page_size, bytes);
+    if (data) {
+        madvise(data, bytes, MADV_HUGEPAGE);
+        return shared_ptr<NnueParams>(static_cast<NnueParams*>(data), [](NnueParams* p) {
+            free(p);
+        });
     }
-    #endif
+#endif
+    return std::make_shared_for_overwrite<NnueParams>();
+}
 
-    assert(count_ <= L1_SIZE / 4);
+shared_ptr<Nnue::NnueParams> Nnue::huge_page_copy(const NnueParams& net) {
+    auto copy = huge_page_alloc();
+    memcpy(copy.get(), &net, sizeof(NnueParams));
+    return copy;
 }
 
-i32 Nnue::SparseIterator::count() const { return count_; }
+shared_ptr<const Nnue::NnueParams> Nnue::prepare_network(const LoadedNetwork& loaded) {
+    const auto perm = kernels().perm;
+    const bool huge_pages = loaded.huge_pages && !loaded.unpacked;
+    if (!huge_pages && loaded.source->permutation == perm) return loaded.source;
 
-i32 Nnue::SparseIterator::index(i32 nnz_id) const {
-    assert(nnz_id < count_);
-    return indices_[nnz_id];
+    const auto net = (huge_pages) ? huge_page_copy(*loaded.source)
+                                  : std::make_shared<NnueParams>(*loaded.source);
+    permute_network(*net, perm);
+    return net;
 }
+
+void Nnue::load_network(const string& path) {
+    auto& loaded = loaded_network();
+
+    if (path == EMBEDDED_NETWORK) {
+        loaded = embedded_network(loaded.huge_pages);
+        return;
+    }
+
+    // packed networks are read whole and unpacked instead of mapped
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) throw runtime_error("could not open network file '" + path + "'");
+        const auto file_size = static_cast<usize>(file.tellg());
+        file.seekg(0);
+
+        char magic[sizeof(PACKED_MAGIC)] = {};
+        file.read(magic, sizeof(magic));
+        if (file && std::memcmp(magic, PACKED_MAGIC, sizeof(magic)) == 0) {
+            vector<u8> data(file_size);
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(data.data()), file_size);
+            if (!file) throw runtime_error("could not read network file '" + path + "'");
+
+            loaded = unpack_loaded(data, path, loaded.huge_pages);
+            return;
+        }
+    }
+
+    constexpr usize padded_size = 64 * ((sizeof(NnueParams) + 63) / 64);
+    shared_ptr<NnueParams> net;
+
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) throw runtime_error("could not open network file '" + path + "'");
+    if (static_cast<usize>(file.tellg()) != padded_size)
+        throw runtime_error("network file and architecture doesn't match");
+    file.seekg(0);
+
+    net = std::make_shared<NnueParams>();
+    file.read(reinterpret_cast<char*>(net.get()), sizeof(NnueParams));
+    if (!file) throw runtime_error("could not read network file '" + path + "'");
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("could not open network file '" + path + "'");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<usize>(st.st_size) != padded_size) {
+        close(fd);
+        throw runtime_error("network file and architecture doesn't match");
+    }
+
+    // a private mapping shares its pages with other processes until they are written to, which
+    // only happens if the network needs to be permuted
+    void* data = mmap(nullptr, padded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) throw runtime_error("could not map network file '" + path + "'");
+    net = shared_ptr<NnueParams>(static_cast<NnueParams*>(data), [](NnueParams* p) {
+        munmap(p, padded_size);
+    });
 #endif
 
+    permute_network(*net, kernels().perm);
+    loaded.source = net;
+    loaded.name = path;
+    loaded.unpacked = false;
+    loaded.decode_info.clear();
+    loaded.params = prepare_network(loaded);
+}
 
+Nnue::LoadedSmallNetwork& Nnue::loaded_small_network() {
+    static LoadedSmallNetwork loaded;
+    return loaded;
+}
 
-Nnue::Nnue(): params(load_network()), idx_(0) {
-    // set the finny table entries to the bias
-    for (const auto perspective : {chess::Color::WHITE, chess::Color::BLACK})
-        for (const auto mirror : {false, true})
-            for (i32 bucket = 0; bucket < N_INBUCKETS; bucket++)
-                finny_table[perspective][mirror][bucket].initialize(params->b0);
+void Nnue::load_small_network(const string& path) {
+    auto& loaded = loaded_small_network();
+
+    if (path == NO_SMALL_NETWORK) {
+        loaded = LoadedSmallNetwork();
+        return;
+    }
+
+    constexpr usize padded_size = 64 * ((sizeof(SmallNnueParams) + 63) / 64);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) throw runtime_error("could not open small network file '" + path + "'");
+    if (static_cast<usize>(file.tellg()) != padded_size)
+        throw runtime_error("small network file and architecture doesn't match");
+    file.seekg(0);
+
+    auto net = std::make_shared<SmallNnueParams>();
+    file.read(reinterpret_cast<char*>(net.get()), sizeof(SmallNnueParams));
+    if (!file) throw runtime_error("could not read small network file '" + path + "'");
+
+    loaded.params = net;
+    loaded.name = path;
 }
 
-const Nnue::NnueParams* Nnue::load_network() {
-    constexpr usize padded_size = 64 * ((sizeof(NnueParams) + 63) / 64);
-    if (g_netfile_size != padded_size)
+const string& Nnue::small_network_name() { return loaded_small_network().name; }
+
+const string& Nnue::network_name() { return loaded_network().name; }
+
+const string& Nnue::network_decode_info() { return loaded_network().decode_info; }
+
+bool Nnue::network_sparsity_permed() { return loaded_network().params->sparsity_permed; }
+
+void Nnue::set_huge_pages(bool enabled) {
+    auto& loaded = loaded_network();
+    if (enabled == loaded.huge_pages) return;
+
+    loaded.huge_pages = enabled;
+    loaded.params = prepare_network(loaded);
+}
+
+string Nnue::network_page_info() {
+    const auto& loaded = loaded_network();
+    if (!loaded.huge_pages && !loaded.unpacked) return "4KB pages";
+
+    return "transparent huge pages ("
+           + std::to_string(utils::huge_page_bytes(loaded.params.get(), sizeof(NnueParams)) >> 20)
+           + " of " + std::to_string(sizeof(NnueParams) >> 20) + " MB backed by 2MB pages)";
+}
+
+const nnue_kernels::Kernels& Nnue::kernels() {
+#ifdef NNUE_MULTI_ARCH
+    static const nnue_kernels::Kernels& kernels = []() -> const nnue_kernels::Kernels& {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq")
+            && __builtin_cpu_supports("bmi2")) {
+            if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vbmi")
+                && __builtin_cpu_supports("avx512vbmi2"))
+                return nnue_kernels::avx512_vnni::KERNELS;
+            return nnue_kernels::avx512::KERNELS;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+            && __builtin_cpu_supports("bmi"))
+            return nnue_kernels::avx2::KERNELS;
+        return nnue_kernels::sse41::KERNELS;  // x86-64-v2 baseline
+    }();
+    return kernels;
+#else
+    return nnue_kernels::SIMD_ISA::KERNELS;
+#endif
+}
+
+const char* Nnue::kernel_name() { return kernels().name; }
+
+template <typename Params>
+void Nnue::permute_network(Params& net, NnuePerm target) {
+    static constexpr u8 PERMS[3][8] = {
+        {0, 1, 2, 3, 4, 5, 6, 7},  // generic, sse41
+        {0, 2, 1, 3, 4, 6, 5, 7},  // avx2
+        {0, 4, 1, 5, 2, 6, 3, 7},  // avx512
+    };
+
+    const auto current_idx = static_cast<u8>(net.permutation);
+    const auto target_idx = static_cast<u8>(target);
+    if (current_idx > 2) throw runtime_error("invalid network permutation");
+    if (current_idx == target_idx) return;
+
+    // compose the inverse of the current perm with the target perm
+    u8 inv_perm[8];
+    for (usize i = 0; i < 8; i++) inv_perm[PERMS[current_idx][i]] = i;
+    u8 perm[8];
+    for (usize i = 0; i < 8; i++) perm[i] = PERMS[target_idx][inv_perm[i]];
+
+    // permute 8-element chunks within each 64-element block to cancel out packus
+    const auto permute_block = [&]<typename T>(T* block) {
+        T src[64];
+        copy(block, block + 64, src);
+        for (usize jj = 0; jj < 64; jj++) block[8 * perm[jj / 8] + jj % 8] = src[jj];
+    };
+
+    for (usize b = 0; b < N_INBUCKETS; b++)
+        for (usize i = 0; i < N_INPUTS; i++)
+            for (usize j = 0; j < L1_SIZE; j += 64) permute_block(&net.W0[b][i][j]);
+    for (usize j = 0; j < L1_SIZE; j += 64) permute_block(&net.b0[j]);
+
+    net.permutation = target;
+}
+
+template void Nnue::permute_network(NnueParamsT<i16>& net, NnuePerm target);
+template void Nnue::permute_network(NnueParamsT<i8>& net, NnuePerm target);
+
+
+template <typename Params>
+void Nnue::permute_neurons(Params& net, span<const i32> order) {
+    constexpr i32 n_neurons = L1_SIZE / 2;
+    if (order.size() != n_neurons) throw runtime_error("permutation has the wrong size");
+
+    vector<bool> seen(n_neurons, false);
+    for (const auto idx : order) {
+        if (idx < 0 || idx >= n_neurons || seen[idx])
+            throw runtime_error("invalid neuron permutation");
+        seen[idx] = true;
+    }
+
+    // W0 and b0 are reordered in their unpermuted layout
+    const auto packus_perm = net.permutation;
+    permute_network(net, NnuePerm::NONE);
+
+    const auto permute_row = [&]<typename T>(T* row) {
+        T src[L1_SIZE];
+        copy(row, row + L1_SIZE, src);
+        for (i32 i = 0; i < n_neurons; i++) {
+            row[i] = src[order[i]];
+            row[i + n_neurons] = src[order[i] + n_neurons];
+        }
+    };
+    for (usize b = 0; b < N_INBUCKETS; b++)
+        for (usize i = 0; i < N_INPUTS; i++) permute_row(net.W0[b][i]);
+    permute_row(net.b0);
+
+    // l1 input k is stored at W1[k / 4][4 * out + k % 4], and neuron i feeds inputs i and i + n
+    for (usize b = 0; b < N_OUTBUCKETS; b++) {
+        const auto src = make_unique<i8[][L2_SIZE * 4]>(L1_SIZE / 4);
+        copy(&net.W1[b][0][0], &net.W1[b][0][0] + L1_SIZE * L2_SIZE, &src[0][0]);
+
+        for (i32 i = 0; i < n_neurons; i++) {
+            for (const i32 half : {0, n_neurons}) {
+                const i32 dst_k = i + half;
+                const i32 src_k = order[i] + half;
+                for (i32 out = 0; out < L2_SIZE; out++)
+                    net.W1[b][dst_k / 4][4 * out + dst_k % 4]
+                        = src[src_k / 4][4 * out + src_k % 4];
+            }
+        }
+    }
+
+    permute_network(net, packus_perm);
+    net.sparsity_permed = true;
+}
+
+template void Nnue::permute_neurons(NnueParamsT<i16>& net, span<const i32> order);
+template void Nnue::permute_neurons(NnueParamsT<i8>& net, span<const i32> order);
+
+vector<u8> Nnue::pack_network(const NnueParams& net) {
+    constexpr usize n_chunks = N_INPUTS / PACK_CHUNK_ROWS;
+
+    vector<u64> offsets;
+    vector<u8> payload;
+    for (usize chunk = 0; chunk < n_chunks; chunk++) {
+        offsets.push_back(payload.size());
+
+        for (usize f = chunk * PACK_CHUNK_ROWS; f < (chunk + 1) * PACK_CHUNK_ROWS; f++) {
+            for (i32 b = 0; b < N_INBUCKETS; b++) {
+                for (i32 i = 0; i < L1_SIZE; i += PACK_BLOCK) {
+                    u16 raw[PACK_BLOCK];
+                    u16 delta[PACK_BLOCK];
+                    u16 raw_bits = 0;
+                    u16 delta_bits = 0;
+                    for (i32 k = 0; k < PACK_BLOCK; k++) {
+                        // deltas wrap around so they still fit in 16 bits
+                        const i16 w = net.W0[b][f][i + k];
+                        const i16 d = (b > 0) ? static_cast<i16>(w - net.W0[b - 1][f][i + k]) : w;
+                        raw[k] = zigzag(w);
+                        delta[k] = zigzag(d);
+                        raw_bits |= raw[k];
+                        delta_bits |= delta[k];
+                    }
+
+                    const bool use_delta = b > 0 && bit_width(delta_bits) < bit_width(raw_bits);
+                    const u16* values = (use_delta) ? delta : raw;
+                    const i32 width = bit_width((use_delta) ? delta_bits : raw_bits);
+                    payload.push_back(width | ((use_delta) ? PACK_DELTA : 0));
+
+                    u64 bits = 0;
+                    i32 n_bits = 0;
+                    for (i32 k = 0; k < PACK_BLOCK; k++) {
+                        bits |= static_cast<u64>(values[k]) << n_bits;
+                        n_bits += width;
+                        for (; n_bits >= 8; n_bits -= 8, bits >>= 8) payload.push_back(bits);
+                    }
+                }
+            }
+        }
+    }
+    offsets.push_back(payload.size());
+
+    // the other layers are small and stored as is
+    const auto* bytes = reinterpret_cast<const u8*>(&net);
+    payload.insert(payload.end(), bytes + PACKED_W0_END, bytes + sizeof(NnueParams));
+    payload.resize(payload.size() + PACK_PADDING);
+
+    PackedHeader header{
+        .magic = {},
+        .chunk_rows = PACK_CHUNK_ROWS,
+        .params_size = sizeof(NnueParams),
+        .n_chunks = n_chunks,
+    };
+    memcpy(header.magic, PACKED_MAGIC, sizeof(PACKED_MAGIC));
+
+    vector<u8> packed(sizeof(header) + offsets.size() * sizeof(u64));
+    memcpy(packed.data(), &header, sizeof(header));
+    memcpy(packed.data() + sizeof(header), offsets.data(), offsets.size() * sizeof(u64));
+    packed.insert(packed.end(), payload.begin(), payload.end());
+    return packed;
+}
+
+shared_ptr<Nnue::NnueParams> Nnue::unpack_network(span<const u8> data, i32 num_threads) {
+    assert(num_threads > 0);
+    constexpr usize n_chunks = N_INPUTS / PACK_CHUNK_ROWS;
+    constexpr usize table_size = sizeof(PackedHeader) + (n_chunks + 1) * sizeof(u64);
+
+    PackedHeader header;
+    if (data.size() < sizeof(header)) throw runtime_error("network file isn't a packed network");
+    memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) != 0)
+        throw runtime_error("network file isn't a packed network");
+    if (header.chunk_rows != PACK_CHUNK_ROWS || header.params_size != sizeof(NnueParams)
+        || header.n_chunks != n_chunks || data.size() < table_size)
         throw runtime_error("network file and architecture doesn't match");
 
-    if (reinterpret_cast<uintptr_t>(g_netfile_data) % alignof(NnueParams) != 0)
-        throw runtime_error("network file isn't aligned properly");
+    u64 offsets[n_chunks + 1];
+    memcpy(offsets, data.data() + sizeof(header), sizeof(offsets));
+    const auto payload = data.subspan(table_size);
+    for (usize chunk = 0; chunk < n_chunks; chunk++)
+        if (offsets[chunk] > offsets[chunk + 1])
+            throw runtime_error("packed network is corrupted");
+    if (offsets[n_chunks] + PACKED_TAIL_SIZE + PACK_PADDING != payload.size())
+        throw runtime_error("packed network is corrupted");
+
+    const auto net = huge_page_alloc();
+    auto* bytes = reinterpret_cast<u8*>(net.get());
+    memcpy(bytes + PACKED_W0_END, payload.data() + offsets[n_chunks], PACKED_TAIL_SIZE);
+
+    // each thread writes its own chunks so their pages are first touched in parallel
+    atomic<bool> corrupted = false;
+    const auto unpack_chunks = [&](i32 t) {
+        for (usize chunk = t; chunk < n_chunks; chunk += num_threads) {
+            const auto* start = payload.data() + offsets[chunk];
+            const auto* end = payload.data() + offsets[chunk + 1];
+            if (!unpack_chunk(*net, chunk, start, end)) corrupted = true;
+        }
+    };
+
+    vector<thread> threads;
+    for (i32 t = 1; t < min<i32>(num_threads, n_chunks); t++)
+        threads.emplace_back(unpack_chunks, t);
+    unpack_chunks(0);
+    for (auto& thread : threads) thread.join();
 
-    return reinterpret_cast<const NnueParams*>(g_netfile_data);
+    if (corrupted) throw runtime_error("packed network is corrupted");
+    return net;
 }
 
 
@@ -292,24 +704,152 @@ i32 Nnue::evaluate(const chess::Board& board) {
     assert(!stm_acc.dirty());
     assert(!ntm_acc.dirty());
 
-    alignas(ALIGNMENT) u8 l0_out[L1_SIZE];
-    SparseIterator sp;
-    activate_l0(stm_acc, l0_out, sp);
-    activate_l0(ntm_acc, l0_out + L1_SIZE / 2, sp);
+    const i32 bucket_idx = output_bucket(board);
 
-    constexpr i32 bucket_div = (32 + N_OUTBUCKETS - 1) / N_OUTBUCKETS;
-    const i32 bucket_idx = (board.occ().count() - 2) / bucket_div;
+    alignas(MEM_ALIGNMENT) u8 l0_out[L1_SIZE];
+    i64 eval = kernels_->forward(stm_acc.values, ntm_acc.values, *params, bucket_idx, l0_out);
 
-    alignas(ALIGNMENT) i32 l1_out[L2_SIZE];
-    i64 eval;
-    forward_l1(l0_out, l1_out, sp, bucket_idx);
-    forward_l2l3(l1_out, eval, bucket_idx);
+#ifdef MEASURE_SPARSITY
+    record_ft_activations(l0_out);
+    record_ft_activations(l0_out + L1_SIZE / 2);
+#endif
 
     eval *= OUTPUT_SCALE;
     eval /= (QC * QC * QC * QC);
     return static_cast<i32>(eval);
 }
 
+bool Nnue::has_small_network() const { return small_params != nullptr; }
+
+i32 Nnue::evaluate_small(const chess::Board& board) {
+    assert(has_small_network());
+
+    // apply lazy updates up the stack from the last computed accumulator
+    i32 clean_idx = idx_;
+    while (!small_accumulators[clean_idx].computed) clean_idx--;
+
+    while (clean_idx++ < idx_) {
+        const auto& prev = small_accumulators[clean_idx - 1];
+        auto& acc = small_accumulators[clean_idx];
+
+        for (const auto perspective : {chess::Color::WHITE, chess::Color::BLACK}) {
+            i32 adds[2];
+            i32 subs[2];
+            for (i32 i = 0; i < acc.n_adds; i++) adds[i] = acc.adds[i].small_index(perspective);
+            for (i32 i = 0; i < acc.n_subs; i++) subs[i] = acc.subs[i].small_index(perspective);
+            kernels_->update_small(
+                prev.values[perspective],
+                acc.values[perspective],
+                small_params->W0,
+                adds,
+                acc.n_adds,
+                subs,
+                acc.n_subs
+            );
+        }
+        acc.computed = true;
+    }
+
+    const auto& acc = small_accumulators[idx_];
+    i64 eval = kernels_->forward_small(
+        acc.values[board.stm()], acc.values[~board.stm()], *small_params
+    );
+
+    eval = eval / SMALL_QA + small_params->b1;
+    eval *= SMALL_OUTPUT_SCALE;
+    eval /= (SMALL_QA * SMALL_QB);
+    return static_cast<i32>(eval);
+}
+
+void Nnue::evaluate_batch(
+    span<const chess::Board> boards, span<i32> evals, i32 num_threads, ActivationStats* stats
+) {
+    assert(boards.size() == evals.size());
+    assert(num_threads > 0);
+    mutex stats_mutex;
+
+    struct BatchEntry {
+        alignas(MEM_ALIGNMENT) i16 values[2][L1_SIZE];  // stm, ntm accumulator values
+        i32 bucket;
+    };
+
+    const auto evaluate_range = [&](usize start, usize end) {
+        auto net = make_unique<Nnue>();
+        auto batch = make_unique<BatchEntry[]>(BATCH_SIZE);
+        alignas(MEM_ALIGNMENT) u8 l0_out[L1_SIZE];
+        auto local_stats = (stats) ? make_unique<ActivationStats>() : nullptr;
+
+        for (usize batch_start = start; batch_start < end; batch_start += BATCH_SIZE) {
+            const usize n = min<usize>(BATCH_SIZE, end - batch_start);
+
+            // build all accumulators first so W0 doesn't evict the other layers
+            i32 bucket_counts[N_OUTBUCKETS + 1] = {};
+            for (usize i = 0; i < n; i++) {
+                const auto& board = boards[batch_start + i];
+                net->set_board(board);
+                copy(
+                    net->accumulators[0][board.stm()].values,
+                    net->accumulators[0][board.stm()].values + L1_SIZE,
+                    batch[i].values[0]
+                );
+                copy(
+                    net->accumulators[0][~board.stm()].values,
+                    net->accumulators[0][~board.stm()].values + L1_SIZE,
+                    batch[i].values[1]
+                );
+                batch[i].bucket = output_bucket(board);
+                bucket_counts[batch[i].bucket + 1]++;
+            }
+
+            // forward pass one output bucket at a time
+            u16 order[BATCH_SIZE];
+            for (i32 b = 0; b < N_OUTBUCKETS; b++) bucket_counts[b + 1] += bucket_counts[b];
+            for (usize i = 0; i < n; i++) order[bucket_counts[batch[i].bucket]++] = i;
+
+            for (usize k = 0; k < n; k++) {
+                const auto& entry = batch[order[k]];
+                i64 eval = net->kernels_->forward(
+                    entry.values[0], entry.values[1], *net->params, entry.bucket, l0_out
+                );
+                eval *= OUTPUT_SCALE;
+                eval /= (QC * QC * QC * QC);
+                evals[batch_start + order[k]] = static_cast<i32>(eval);
+
+                if (local_stats) {
+                    for (i32 i = 0; i < L1_SIZE; i++)
+                        local_stats->activations[i % (L1_SIZE / 2)] += (l0_out[i] != 0);
+                    for (i32 i = 0; i < L1_SIZE; i += 4) {
+                        u32 block;
+                        memcpy(&block, &l0_out[i], sizeof(block));
+                        local_stats->nnz_blocks += (block != 0);
+                    }
+                    local_stats->samples += 2;
+                }
+            }
+        }
+
+        if (local_stats) {
+            lock_guard<mutex> lock(stats_mutex);
+            for (i32 i = 0; i < L1_SIZE / 2; i++)
+                stats->activations[i] += local_stats->activations[i];
+            stats->nnz_blocks += local_stats->nnz_blocks;
+            stats->samples += local_stats->samples;
+        }
+    };
+
+    const usize chunk_size = (boards.size() + num_threads - 1) / num_threads;
+    vector<thread> threads;
+    threads.reserve(num_threads);
+
+    for (i32 t = 0; t < num_threads; t++) {
+        const usize start = min(t * chunk_size, boards.size());
+        const usize end = min(start + chunk_size, boards.size());
+        if (start == end) break;
+        threads.emplace_back(evaluate_range, start, end);
+    }
+    for (auto& thread : threads) thread.join();
+}
+
 
 void Nnue::set_board(const chess::Board& board) {
     idx_ = 0;
@@ -318,10 +858,11 @@ void Nnue::set_board(const chess::Board& board) {
         const auto bucket = king_bucket(board.king_square(perspective), perspective);
 
         finny_table[perspective][mirror][bucket].update(
-            params->W0[bucket], board, perspective, mirror
+            *kernels_, params->W0[bucket], board, perspective, mirror
         );
         accumulators[idx_][perspective].refresh_from(finny_table[perspective][mirror][bucket]);
     }
+    if (has_small_network()) refresh_small(board);
 }
 
 void Nnue::make_move(const chess::Board& board, chess::Move move) {
@@ -385,6 +926,17 @@ void Nnue::make_move(const chess::Board& board, chess::Move move) {
         && ((needs_mirroring(from_sq) != needs_mirroring(new_king_sq))
             || (king_bucket(from_sq, stm) != king_bucket(new_king_sq, stm))))
         accumulators[idx_][stm].needs_refresh = true;
+
+    // the small network has no king buckets, so it is only ever updated
+    if (has_small_network()) {
+        const auto& acc = accumulators[idx_][chess::Color::WHITE];
+        auto& small_acc = small_accumulators[idx_];
+        copy(acc.adds, acc.adds + acc.n_adds, small_acc.adds);
+        copy(acc.subs, acc.subs + acc.n_subs, small_acc.subs);
+        small_acc.n_adds = acc.n_adds;
+        small_acc.n_subs = acc.n_subs;
+        small_acc.computed = false;
+    }
 }
 
 void Nnue::unmake_move() {
@@ -401,6 +953,32 @@ i32 Nnue::king_bucket(chess::Square king_sq, chess::Color perspective) {
     return BUCKETS[4 * sq.rank() + sq.file()];
 }
 
+i32 Nnue::output_bucket(const chess::Board& board) {
+    constexpr i32 bucket_div = (32 + N_OUTBUCKETS - 1) / N_OUTBUCKETS;
+    return (board.occ().count() - 2) / bucket_div;
+}
+
+void Nnue::refresh_small(const chess::Board& board) {
+    auto& acc = small_accumulators[idx_];
+
+    for (const auto perspective : {chess::Color::WHITE, chess::Color::BLACK}) {
+        i32 adds[32];
+        i32 n_adds = 0;
+
+        auto occ = board.occ();
+        while (occ) {
+            const auto sq = chess::Square(occ.poplsb());
+            assert(n_adds < 32);
+            adds[n_adds++] = NnueFeature(board.at(sq), sq).small_index(perspective);
+        }
+
+        kernels_->update_small(
+            small_params->b0, acc.values[perspective], small_params->W0, adds, n_adds, nullptr, 0
+        );
+    }
+    acc.computed = true;
+}
+
 void Nnue::lazy_update(const chess::Board& board, chess::Color perspective) {
     // find first clean/needs_refresh accumulator
     i32 clean_idx = idx_;
@@ -415,227 +993,25 @@ void Nnue::lazy_update(const chess::Board& board, chess::Color perspective) {
     // if an accumulator needs refresh, refresh at idx_ since we don't know the board at clean_idx
     if (accumulators[clean_idx][perspective].needs_refresh) {
         finny_table[perspective][mirror][bucket].update(
-            params->W0[bucket], board, perspective, mirror
+            *kernels_, params->W0[bucket], board, perspective, mirror
         );
         accumulators[idx_][perspective].refresh_from(finny_table[perspective][mirror][bucket]);
         return;
     }
 
-    // update up the stack
+    // update up the stack in a single pass
+    nnue_kernels::AccumulatorUpdate updates[MAX_DEPTH];
+    const i32 base_idx = clean_idx;
+    i32 n_updates = 0;
     while (clean_idx++ < idx_)
-        accumulators[clean_idx][perspective].update(
-            accumulators[clean_idx - 1][perspective], params->W0[bucket], perspective, mirror
-        );
-}
-
-void Nnue::activate_l0(
-    const NnueAccumulator& acc, u8 l0_out[L1_SIZE / 2], [[maybe_unused]] SparseIterator& sp
-) const {
-    constexpr i32 n_pairs = L1_SIZE / 2;
-
-#ifdef USE_SIMD
-    constexpr i32 regw16 = ALIGNMENT / sizeof(i16);
-    static_assert(L1_SIZE % (8 * regw16) == 0);
-
-    constexpr i32 n_chunks = n_pairs / regw16;
-    const VecI16 zs = zero_i16();
-    const VecI16 qa = full_i16(QA);
-
-    for (i32 i = 0; i < n_chunks; i += 4) {
-        // compute 4 * regw16 values of the pairwise mul at once, input in [0, QA]
-        const VecI16 acc0_v0 = clamp_i16(load_i16(&acc.values[(i + 0) * regw16]), zs, qa);
-        const VecI16 acc1_v0 = clamp_i16(load_i16(&acc.values[(i + 1) * regw16]), zs, qa);
-        const VecI16 acc2_v0 = clamp_i16(load_i16(&acc.values[(i + 2) * regw16]), zs, qa);
-        const VecI16 acc3_v0 = clamp_i16(load_i16(&acc.values[(i + 3) * regw16]), zs, qa);
-        const VecI16 acc0_v1 = clamp_i16(load_i16(&acc.values[(i + 0) * regw16 + n_pairs]), zs, qa);
-        const VecI16 acc1_v1 = clamp_i16(load_i16(&acc.values[(i + 1) * regw16 + n_pairs]), zs, qa);
-        const VecI16 acc2_v1 = clamp_i16(load_i16(&acc.values[(i + 2) * regw16 + n_pairs]), zs, qa);
-        const VecI16 acc3_v1 = clamp_i16(load_i16(&acc.values[(i + 3) * regw16 + n_pairs]), zs, qa);
-
-        const VecI16 pw0 = mulhi_i16(lshift_i16(acc0_v0, 7), acc0_v1);
-        const VecI16 pw1 = mulhi_i16(lshift_i16(acc1_v0, 7), acc1_v1);
-        const VecI16 pw2 = mulhi_i16(lshift_i16(acc2_v0, 7), acc2_v1);
-        const VecI16 pw3 = mulhi_i16(lshift_i16(acc3_v0, 7), acc3_v1);
-
-        // packus will interleave every 8 values thus l1w must be permuted, output in [0, 127]
-        const VecU8 out0 = pack_u8_i16(pw0, pw1);
-        const VecU8 out1 = pack_u8_i16(pw2, pw3);
-        store_u8(&l0_out[(i + 0) * regw16], out0);
-        store_u8(&l0_out[(i + 2) * regw16], out1);
-
-        // track nonzero blocks
-        sp.add_nonzeros(out0, out1);
-    }
-#else
-    for (i32 i = 0; i < n_pairs; i++) {
-        const i32 acc_v0 = min(max(acc.values[i], i16(0)), i16(QA));
-        const i32 acc_v1 = min(max(acc.values[i + n_pairs], i16(0)), i16(QA));
-
-        // simulate mulhi, assuming non-permuted weights
-        l0_out[i] = ((acc_v0 << 7) * acc_v1) >> 16;
-    }
-#endif
+        accumulators[clean_idx][perspective].take_update(updates[n_updates++], perspective, mirror);
 
-#ifdef MEASURE_SPARSITY
-    record_ft_activations(l0_out);
-#endif
-}
-
-void Nnue::forward_l1(
-    const u8 l0_out[L1_SIZE],
-    i32 l1_out[L2_SIZE],
-    [[maybe_unused]] const SparseIterator& sp,
-    i32 bucket_idx
-) const {
-#ifdef USE_SIMD
-    // get nnz
-    constexpr i32 regw8 = ALIGNMENT / sizeof(i8);
-    constexpr i32 regw32 = ALIGNMENT / sizeof(i32);
-    static_assert(L2_SIZE % regw32 == 0);
-    static_assert(L1_SIZE % 16 == 0);
-
-    const i32 nnz = sp.count();
-    const i32 nnz4 = (nnz / 4) * 4;
-
-    // compute l1 matmul
-    constexpr i32 n_chunks = L2_SIZE / regw32;
-    VecI32 l1_pre[n_chunks][4];
-
-    #pragma GCC unroll 32  // fmt: skip
-    for (i32 r = 0; r < n_chunks; r++) {
-        l1_pre[r][0] = zero_i32();
-        l1_pre[r][1] = zero_i32();
-        l1_pre[r][2] = zero_i32();
-        l1_pre[r][3] = zero_i32();
-    }
-
-    for (i32 nnz_id = 0; nnz_id < nnz4; nnz_id += 4) {
-        const i32 tile_id0 = sp.index(nnz_id + 0);
-        const i32 tile_id1 = sp.index(nnz_id + 1);
-        const i32 tile_id2 = sp.index(nnz_id + 2);
-        const i32 tile_id3 = sp.index(nnz_id + 3);
-
-        const VecU8 inputs0 = tile_u8(&l0_out[4 * tile_id0]);
-        const VecU8 inputs1 = tile_u8(&l0_out[4 * tile_id1]);
-        const VecU8 inputs2 = tile_u8(&l0_out[4 * tile_id2]);
-        const VecU8 inputs3 = tile_u8(&l0_out[4 * tile_id3]);
-
-        for (i32 r = 0; r < n_chunks; r++) {
-            const VecI8 weights0 = load_i8(&params->W1[bucket_idx][tile_id0][r * regw8]);
-            const VecI8 weights1 = load_i8(&params->W1[bucket_idx][tile_id1][r * regw8]);
-            const VecI8 weights2 = load_i8(&params->W1[bucket_idx][tile_id2][r * regw8]);
-            const VecI8 weights3 = load_i8(&params->W1[bucket_idx][tile_id3][r * regw8]);
-
-            l1_pre[r][0] = dpbusd_i32(l1_pre[r][0], inputs0, weights0);
-            l1_pre[r][1] = dpbusd_i32(l1_pre[r][1], inputs1, weights1);
-            l1_pre[r][2] = dpbusd_i32(l1_pre[r][2], inputs2, weights2);
-            l1_pre[r][3] = dpbusd_i32(l1_pre[r][3], inputs3, weights3);
-        }
-    }
-
-    for (i32 nnz_id = nnz4; nnz_id < nnz; nnz_id++) {
-        const i32 tile_id = sp.index(nnz_id);
-        const VecU8 inputs = tile_u8(&l0_out[4 * tile_id]);
-
-        for (i32 r = 0; r < n_chunks; r++) {
-            const VecI8 weights = load_i8(&params->W1[bucket_idx][tile_id][r * regw8]);
-            l1_pre[r][0] = dpbusd_i32(l1_pre[r][0], inputs, weights);
-        }
-    }
-
-    // activate l1
-    const VecI32 zs = zero_i32();
-    const VecI32 qs = full_i32(QC << L1_SHIFT);
-
-    for (i32 r = 0; r < n_chunks; r++) {
-        const VecI32 pre0 = add_i32(l1_pre[r][0], l1_pre[r][1]);
-        const VecI32 pre1 = add_i32(l1_pre[r][2], l1_pre[r][3]);
-
-        // apply screlu and downshift into QC^2 space
-        const VecI32 bias = load_i32(&params->b1[bucket_idx][r * regw32]);
-        const VecI32 pre = add_i32(add_i32(pre0, pre1), bias);
-        const VecI32 crelu = clamp_i32(pre, zs, qs);
-        const VecI32 screlu = rshift_i32(mullo_i32(crelu, crelu), 2 * L1_SHIFT);
-        store_i32(&l1_out[r * regw32], screlu);
-    }
-#else
-    constexpr i32 n_tiles = L1_SIZE / 4;
-    i32 l1_pre[L2_SIZE] = {0};
-
-    // compute l1 matmul
-    for (i32 i = 0; i < n_tiles; i++)
-        for (i32 j = 0; j < L2_SIZE; j++)
-            for (i32 k = 0; k < 4; k++)
-                l1_pre[j] += l0_out[4 * i + k] * params->W1[bucket_idx][i][4 * j + k];
-
-    // activate l1
-    for (i32 i = 0; i < L2_SIZE; i++) {
-        const i32 bias = params->b1[bucket_idx][i];
-        const i32 pre = l1_pre[i] + bias;
-        const i32 crelu = min(max(pre, 0), QC << L1_SHIFT);
-        const i32 screlu = (crelu * crelu) >> (2 * L1_SHIFT);
-        l1_out[i] = screlu;
-    }
-#endif
-}
-
-void Nnue::forward_l2l3(const i32 l1_out[L2_SIZE], i64& l3_out, i32 bucket_idx) const {
-#ifdef USE_SIMD
-    // compute l2 matmul
-    constexpr i32 regw32 = ALIGNMENT / sizeof(i32);
-    static_assert(L3_SIZE % regw32 == 0);
-
-    constexpr i32 n_chunks = L3_SIZE / regw32;
-    VecI32 l2_pre[n_chunks];
-
-    #pragma GCC unroll 32  // fmt: skip
-    for (i32 r = 0; r < n_chunks; r++) l2_pre[r] = load_i32(&params->b2[bucket_idx][r * regw32]);
-
-    for (i32 i = 0; i < L2_SIZE; i++) {
-        // l1_pre += W2[:, i] * l1_out[i], inputs in QC^2 space, weights in QC space
-        VecI32 input = full_i32(l1_out[i]);
-        VecI32 weights[n_chunks];
-
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < n_chunks; r++)
-            weights[r] = load_i32(&params->W2[bucket_idx][i][r * regw32]);
-
-        #pragma GCC unroll 32  // fmt: skip
-        for (i32 r = 0; r < n_chunks; r++) l2_pre[r] = fmadd_i32(input, weights[r], l2_pre[r]);
-    }
-
-    // activate l2 and compute l3 matmul
-    const VecI32 zs = zero_i32();
-    const VecI32 qs = full_i32(QC * QC * QC);
-
-    l3_out = params->b3[bucket_idx];
-    VecI32 sums = zero_i32();
-
-    for (i32 r = 0; r < n_chunks; r++) {
-        const VecI32 crelu = clamp_i32(l2_pre[r], zs, qs);
-        const VecI32 weights = load_i32(&params->W3[bucket_idx][r * regw32]);
-        sums = fmadd_i32(crelu, weights, sums);
-    }
-
-    l3_out += hadd_i32(sums);
-#else
-    i32 l2_out[L3_SIZE];
-    for (i32 i = 0; i < L3_SIZE; i++) l2_out[i] = params->b2[bucket_idx][i];
-
-    // compute l2 matmul
-    for (i32 i = 0; i < L2_SIZE; i++)
-        for (i32 j = 0; j < L3_SIZE; j++) l2_out[j] += l1_out[i] * params->W2[bucket_idx][i][j];
-
-    // activate l2 and compute l3 dotprod
-    l3_out = params->b3[bucket_idx];
-    for (i32 i = 0; i < L3_SIZE; i++) {
-        const i32 crelu = min(max(l2_out[i], 0), QC * QC * QC);
-        l3_out += crelu * params->W3[bucket_idx][i];
-    }
-#endif
+    if (n_updates > 0)
+        kernels_->update_accumulators(
+            accumulators[base_idx][perspective].values, params->W0[bucket], updates, n_updates
+        );
 }
 
-
 #ifdef MEASURE_SPARSITY
 u64 Nnue::save_ft_activations() {
     ofstream outfile("ft_activations.json");
@@ -1,13 +1,20 @@
 #pragma once
 #include <Raphael/consts.h>
-#include <Raphael/simd.h>
 #include <chess/include.h>
 
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
 
 
 namespace raphael {
+namespace nnue_kernels {
+struct AccumulatorUpdate;
+struct Kernels;
+}
+
 class Nnue {
 public:
     static constexpr i32 OUTPUT_SCALE = 278;
@@ -31,28 +38,73 @@ public:
         14, 14, 15, 15
     };  // clang-format on
     static constexpr i32 L1_SHIFT = 8;
+    // small network for quiescence: SMALL_N_INPUTS -> SMALL_L1_SIZE (per perspective) -> 1
+    static constexpr i32 SMALL_N_INPUTS = 12 * 64;
+    static constexpr i32 SMALL_L1_SIZE = 128;
+    static constexpr i32 SMALL_QA = 255;
+    static constexpr i32 SMALL_QB = 64;
+    static constexpr i32 SMALL_OUTPUT_SCALE = 400;
+    static constexpr i32 BATCH_SIZE = 256;  // positions per thread batch in evaluate_batch
+    static constexpr usize MEM_ALIGNMENT = 64;  // widest simd register of any kernel
 
     enum class NnuePerm : u8 { NONE = 0, AVX2 = 1, AVX512 = 2 };
-    struct NnueParams {
+    template <typename FtW>
+    struct NnueParamsT {
         // accumulator: N_INPUTS -> L1_SIZE
-        alignas(ALIGNMENT) i16 W0[N_INBUCKETS][N_INPUTS][L1_SIZE];
-        alignas(ALIGNMENT) i16 b0[L1_SIZE];
+        alignas(MEM_ALIGNMENT) FtW W0[N_INBUCKETS][N_INPUTS][L1_SIZE];
+        alignas(MEM_ALIGNMENT) i16 b0[L1_SIZE];
         // layer1: L1_SIZE -> L2_SIZE
-        alignas(ALIGNMENT) i8 W1[N_OUTBUCKETS][L1_SIZE / 4][L2_SIZE * 4];
-        alignas(ALIGNMENT) i32 b1[N_OUTBUCKETS][L2_SIZE];
+        alignas(MEM_ALIGNMENT) i8 W1[N_OUTBUCKETS][L1_SIZE / 4][L2_SIZE * 4];
+        alignas(MEM_ALIGNMENT) i32 b1[N_OUTBUCKETS][L2_SIZE];
         // layer2: L2_SIZE -> L3_SIZE
-        alignas(ALIGNMENT) i32 W2[N_OUTBUCKETS][L2_SIZE][L3_SIZE];
-        alignas(ALIGNMENT) i32 b2[N_OUTBUCKETS][L3_SIZE];
+        alignas(MEM_ALIGNMENT) i32 W2[N_OUTBUCKETS][L2_SIZE][L3_SIZE];
+        alignas(MEM_ALIGNMENT) i32 b2[N_OUTBUCKETS][L3_SIZE];
         // layer3: L3_SIZE -> 1
-        alignas(ALIGNMENT) i32 W3[N_OUTBUCKETS][L3_SIZE];
-        alignas(ALIGNMENT) i32 b3[N_OUTBUCKETS];
+        alignas(MEM_ALIGNMENT) i32 W3[N_OUTBUCKETS][L3_SIZE];
+        alignas(MEM_ALIGNMENT) i32 b3[N_OUTBUCKETS];
 
         // flags
         NnuePerm permutation;
         bool sparsity_permed;
     };
 
+    struct SmallNnueParams {
+        // accumulator: SMALL_N_INPUTS -> SMALL_L1_SIZE
+        alignas(MEM_ALIGNMENT) i16 W0[SMALL_N_INPUTS][SMALL_L1_SIZE];
+        alignas(MEM_ALIGNMENT) i16 b0[SMALL_L1_SIZE];
+        // output: 2 * SMALL_L1_SIZE -> 1, screlu activated, weights must be within [-127, 127]
+        alignas(MEM_ALIGNMENT) i16 W1[2 * SMALL_L1_SIZE];
+        i32 b1;
+    };
+
+    // feature transformer weight type, i8 halves W0 but needs networks trained to fit in range
+#ifdef NNUE_I8_FT
+    using FtWeight = i8;
+#else
+    using FtWeight = i16;
+#endif
+    using NnueParams = NnueParamsT<FtWeight>;
+    using NnueParamsI16 = NnueParamsT<i16>;  // layout of trained networks
+
+    struct ActivationStats {
+        u64 activations[L1_SIZE / 2] = {};  // number of times each ft neuron fired
+        u64 nnz_blocks = 0;                 // number of nonzero blocks of 4 neurons
+        u64 samples = 0;                    // number of activated perspectives
+    };
+
+    // permutation of the kernels for the build's instruction set, networks are permuted again at
+    // runtime if different kernels are dispatched
+#if defined(__AVX512F__)
+    static constexpr NnuePerm TARGET_PERM = NnuePerm::AVX512;
+#elif defined(__AVX__) || defined(__AVX2__)
+    static constexpr NnuePerm TARGET_PERM = NnuePerm::AVX2;
+#else
+    static constexpr NnuePerm TARGET_PERM = NnuePerm::NONE;
+#endif
+
 private:
+    friend class NnueMicrobench;  // src/NNUE/microbench.cpp
+
     struct NnueFeature {
         chess::Piece piece;
         chess::Square square;
@@ -64,11 +116,18 @@ private:
          * \return the feature index
          */
         i32 index(chess::Color perspective, bool mirror) const;
+
+        /** Returns the feature index in the small network, which has no king buckets or mirroring
+         *
+         * \param perspective feature perspective
+         * \return the feature index
+         */
+        i32 small_index(chess::Color perspective) const;
     };
 
     class NnueFinnyEntry {
     public:
-        alignas(ALIGNMENT) i16 values[L1_SIZE];
+        alignas(MEM_ALIGNMENT) i16 values[L1_SIZE];
 
     private:
         std::array<chess::BitBoard, 6> pieces_ = {};  // bitboard per piece type
@@ -87,13 +146,15 @@ private:
 
         /** Updates the finny entry incrementally to match the new board state
          *
+         * \param kernels simd kernels to use
          * \param weights start of W0
          * \param board new board state, should match this entry's king bucket index & mirroring
          * \param perspective accumulator perspective, should match this entry's perspective
          * \param mirror whether to mirror the board, should match this entry's mirroring
          */
         void update(
-            const i16 weights[N_INPUTS][L1_SIZE],
+            const nnue_kernels::Kernels& kernels,
+            const FtWeight weights[N_INPUTS][L1_SIZE],
             const chess::Board& board,
             chess::Color perspective,
             bool mirror
@@ -111,7 +172,7 @@ private:
 
     class NnueAccumulator {
     public:
-        alignas(ALIGNMENT) i16 values[L1_SIZE];
+        alignas(MEM_ALIGNMENT) i16 values[L1_SIZE];
         NnueFeature adds[2];
         NnueFeature subs[2];
         u8 n_adds = 0;
@@ -144,18 +205,14 @@ private:
         /** Resets updates stored on this accumulator */
         void reset_updates();
 
-        /** Updates the accumulator values
+        /** Moves the updates stored on this accumulator into an update for the kernels to apply
          *
-         * \param old_acc accumulator to use as base
-         * \param weights start of W0
+         * \param update update to write the feature indices and this accumulator's values to
          * \param perspective accumulator perspective
          * \param mirror whether to mirror the board
          */
-        void update(
-            const NnueAccumulator& old_acc,
-            const i16 weights[N_INPUTS][L1_SIZE],
-            chess::Color perspective,
-            bool mirror
+        void take_update(
+            nnue_kernels::AccumulatorUpdate& update, chess::Color perspective, bool mirror
         );
 
         /** Refreshes the accumulator by copying the finny entry
@@ -165,87 +222,213 @@ private:
         void refresh_from(const NnueFinnyEntry& finny_entry);
     };
 
-    class SparseIterator {
-#ifdef USE_SIMD
-    private:
-        u16 indices_[L1_SIZE / 4] = {};
-        i32 count_ = 0;
+    struct SmallAccumulator {
+        alignas(MEM_ALIGNMENT) i16 values[2][SMALL_L1_SIZE];  // values[perspective]
+        NnueFeature adds[2];
+        NnueFeature subs[2];
+        u8 n_adds = 0;
+        u8 n_subs = 0;
+        bool computed = false;  // whether values are up to date with this ply's adds and subs
+    };
 
-    #ifdef __AVX512VBMI2__
-        // clang-format off
-        __m512i offset_ = _mm512_set_epi16(
-            31, 30, 29, 28, 27, 26, 25, 24,
-            23, 22, 21, 20, 19, 18, 17, 16,
-            15, 14, 13, 12, 11, 10,  9,  8,
-             7,  6,  5,  4,  3,  2,  1,  0
-        );  // clang-format on
-    #else
-        __m128i offset_ = _mm_setzero_si128();
+    struct LoadedSmallNetwork {
+        std::shared_ptr<const SmallNnueParams> params;  // null if no small network is loaded
+        std::string name = NO_SMALL_NETWORK;
+    };
 
-        // precompute nonzero_idx[mask][nnz_idx] = position of nonzero block
-        alignas(16) static constexpr MultiArray<u16, 256, 8> nonzero_idx = [] {
-            MultiArray<u16, 256, 8> idx{};
+#ifdef MEASURE_SPARSITY
+    static inline u64 ft_activations[L1_SIZE / 2] = {};  // number of times each ft neuron fired
 
-            for (i32 i = 0; i < 256; i++) {
-                i32 nnz = 0;
+    static inline u64 total_nnz = 0;
+    static inline u64 total_calls = 0;
+#endif
 
-                for (u8 mask = i; mask != 0; mask &= mask - 1)
-                    idx[i][nnz++] = std::countr_zero(mask);
-            }
+    struct LoadedNetwork {
+        std::shared_ptr<const NnueParams> source;  // embedded or mapped network
+        std::shared_ptr<const NnueParams> params;  // network in use, may be a huge page copy
+        std::string name;
+        bool huge_pages = true;
+        bool unpacked = false;    // source was unpacked into huge pages and is never copied
+        std::string decode_info;  // how long unpacking took, empty if the network wasn't packed
+    };
 
-            return idx;
-        }();
-    #endif
+    std::shared_ptr<const NnueParams> network_;  // keeps the network alive while in use
+    const NnueParams* params;                    // network weights and biases
+    const nnue_kernels::Kernels* kernels_;       // simd kernels for this cpu
 
+    std::shared_ptr<const SmallNnueParams> small_network_;  // null if no small network is used
+    const SmallNnueParams* small_params;                    // small network weights and biases
 
-    public:
-        /** Adds the nonzero indices to the sparse iterator
-         *
-         * \param l0_out0 first chunk of l0 outputs
-         * \param l0_out1 second chunk of l0 outputs
-         */
-        void add_nonzeros(VecU8 l0_out0, VecU8 l0_out1);
+    /** Returns the embedded network, prepared for the dispatched kernels. Packed embedded networks
+     * are unpacked on the first call only
+     *
+     * \param huge_pages whether to use huge pages
+     * \returns the embedded network
+     */
+    static LoadedNetwork embedded_network(bool huge_pages);
 
-        /** Returns the number of nonezero blocks
-         *
-         * \returns the nnz count
-         */
-        i32 count() const;
+    /** Unpacks a packed network with one thread per core and permutes it for the dispatched
+     * kernels, timing the decode
+     *
+     * \param data packed network
+     * \param name network name
+     * \param huge_pages whether to use huge pages
+     * \returns the unpacked network
+     */
+    static LoadedNetwork unpack_loaded(
+        std::span<const u8> data, const std::string& name, bool huge_pages
+    );
 
-        /** Returns the tile id for a nonzero block
-         *
-         * \param nnz_id which nonzero chunk we want the index for
-         * \returns the corresponding tile id
-         */
-        i32 index(i32 nnz_id) const;
-#endif
-    };
+    /** Returns the network new Nnue instances will use
+     *
+     * \returns reference to the loaded network
+     */
+    static LoadedNetwork& loaded_network();
 
-#ifdef MEASURE_SPARSITY
-    static inline u64 ft_activations[L1_SIZE / 2] = {};  // number of times each ft neuron fired
+    /** Allocates an uninitialized network in a 2MB aligned region backed by transparent huge pages
+     * to reduce TLB misses on weight lookups. Falls back to a regular allocation if huge pages
+     * aren't supported
+     *
+     * \returns the allocated network
+     */
+    static std::shared_ptr<NnueParams> huge_page_alloc();
 
-    static inline u64 total_nnz = 0;
-    static inline u64 total_calls = 0;
-#endif
+    /** Copies a network into huge pages, see huge_page_alloc
+     *
+     * \param net network to copy
+     * \returns the copied network
+     */
+    static std::shared_ptr<NnueParams> huge_page_copy(const NnueParams& net);
 
-    const NnueParams* params;  // network weights and biases
+    /** Returns the network to use for a loaded network, copying its source if it needs to be moved
+     * into huge pages or permuted for the dispatched kernels
+     *
+     * \param loaded the loaded network
+     * \returns the network to use
+     */
+    static std::shared_ptr<const NnueParams> prepare_network(const LoadedNetwork& loaded);
 
-    /** Loads the embedded network
+    /** Returns the small network new Nnue instances will use
      *
-     * \returns the pointer to the loaded network
+     * \returns reference to the loaded small network
      */
-    static const NnueParams* load_network();
+    static LoadedSmallNetwork& loaded_small_network();
 
 
     // state variables
     NnueFinnyEntry finny_table[2][2][N_INBUCKETS];  // finny_table[perspective][mirror][bucket]
     NnueAccumulator accumulators[MAX_DEPTH][2];     // accumulators[ply][perspective][index]
+    SmallAccumulator small_accumulators[MAX_DEPTH];  // small_accumulators[ply]
     i32 idx_ = 0;
 
 
 public:
     Nnue();
 
+    static constexpr const char* EMBEDDED_NETWORK = "<embedded>";
+    static constexpr const char* NO_SMALL_NETWORK = "<none>";
+
+    /** Loads a network file with mmap, permuting it in memory if it doesn't match the target
+     * architecture. Packed network files are unpacked instead. Only Nnue instances constructed
+     * afterwards will use the new network. Throws a runtime_error on failure
+     *
+     * \param path path to the network file, or EMBEDDED_NETWORK to use the embedded network
+     */
+    static void load_network(const std::string& path);
+
+    /** Loads a small network file for quiescence. Only Nnue instances constructed afterwards will
+     * use the new network. Throws a runtime_error on failure
+     *
+     * \param path path to the small network file, or NO_SMALL_NETWORK to not use a small network
+     */
+    static void load_small_network(const std::string& path);
+
+    /** Returns the name of the small network new Nnue instances will use
+     *
+     * \returns the small network path, or NO_SMALL_NETWORK
+     */
+    static const std::string& small_network_name();
+
+    /** Returns the name of the network new Nnue instances will use
+     *
+     * \returns the network path, or EMBEDDED_NETWORK
+     */
+    static const std::string& network_name();
+
+    /** Returns whether the network new Nnue instances will use is permuted for sparsity
+     *
+     * \returns whether the network is permuted for sparsity
+     */
+    static bool network_sparsity_permed();
+
+    /** Sets whether networks should be copied into huge pages. Only Nnue instances constructed
+     * afterwards will use the new copy
+     *
+     * \param enabled whether to use huge pages
+     */
+    static void set_huge_pages(bool enabled);
+
+    /** Returns a description of the pages backing the network new Nnue instances will use
+     *
+     * \returns the page description
+     */
+    static std::string network_page_info();
+
+    /** Returns how long unpacking the network new Nnue instances will use took
+     *
+     * \returns the decode description, or an empty string if the network wasn't packed
+     */
+    static const std::string& network_decode_info();
+
+    /** Returns the simd kernels for this cpu, choosing the best supported instruction set on the
+     * first call
+     *
+     * \returns the kernels
+     */
+    static const nnue_kernels::Kernels& kernels();
+
+    /** Returns the name of the instruction set of the dispatched kernels
+     *
+     * \returns the instruction set name
+     */
+    static const char* kernel_name();
+
+    /** Permutes the l0 weights and biases in place to cancel out packus on the target architecture
+     *
+     * \param net network to permute, with i16 or i8 W0
+     * \param target permutation to apply
+     */
+    template <typename Params>
+    static void permute_network(Params& net, NnuePerm target);
+
+    /** Reorders the ft neurons so that neuron order[i] becomes neuron i, moving the W0 columns,
+     * b0, and W1 rows of both halves of each pairwise neuron. Throws a runtime_error if order
+     * isn't a permutation
+     *
+     * \param net network to permute, with i16 or i8 W0
+     * \param order old neuron index of each new neuron, of size L1_SIZE / 2
+     */
+    template <typename Params>
+    static void permute_neurons(Params& net, std::span<const i32> order);
+
+    /** Compresses a network into a packed network. W0 is split into blocks of 64 weights, each
+     * bit-packed as the zigzag of either the weights or their delta to the same weights of the
+     * previous king bucket, whichever needs fewer bits. The other layers are stored as is
+     *
+     * \param net network to pack
+     * \returns the packed network
+     */
+    static std::vector<u8> pack_network(const NnueParams& net);
+
+    /** Decodes a packed network into huge pages, splitting its W0 chunks between threads. Throws a
+     * runtime_error if the data isn't a packed network of this architecture
+     *
+     * \param data packed network
+     * \param num_threads number of threads to decode with
+     * \returns the unpacked network, with the permutation it was packed with
+     */
+    static std::shared_ptr<NnueParams> unpack_network(std::span<const u8> data, i32 num_threads);
+
     /** Evaluates the board from the current side to move's perspective
      *
      * \param board current board (should match either set_board or new_board in make_move)
@@ -253,6 +436,35 @@ public:
      */
     i32 evaluate(const chess::Board& board);
 
+    /** Returns whether this instance has a small network to evaluate with
+     *
+     * \returns whether evaluate_small can be called
+     */
+    bool has_small_network() const;
+
+    /** Evaluates the board from the current side to move's perspective with the small network
+     *
+     * \param board current board (should match either set_board or new_board in make_move)
+     * \returns the small NNUE evaluation of the board in centipawns
+     */
+    i32 evaluate_small(const chess::Board& board);
+
+    /** Evaluates many boards from each board's side to move's perspective. Each thread builds the
+     * accumulators of a batch of boards using its own finny table, then runs the forward pass
+     * grouped by output bucket so the layer 1-3 weights of a bucket stay in cache
+     *
+     * \param boards boards to evaluate
+     * \param evals output NNUE evaluations in centipawns, same size as boards
+     * \param num_threads number of threads to evaluate with
+     * \param stats if not null, accumulates how often each ft neuron fired
+     */
+    static void evaluate_batch(
+        std::span<const chess::Board> boards,
+        std::span<i32> evals,
+        i32 num_threads,
+        ActivationStats* stats = nullptr
+    );
+
     /** Sets internal states to match the given board
      *
      * \param board the board to set
@@ -294,44 +506,25 @@ private:
      */
     static i32 king_bucket(chess::Square king_sq, chess::Color perspective);
 
-    /** Lazily updates the accumulator stack for one perspective
+    /** Returns the output bucket index
      *
-     * \param board current board
-     * \param perspective accumulator perspective
+     * \param board board to evaluate
+     * \returns output bucket index
      */
-    void lazy_update(const chess::Board& board, chess::Color perspective);
+    static i32 output_bucket(const chess::Board& board);
 
-    /** Activates the output of l0 (the accumulators)
+    /** Refreshes the small accumulator of the current ply from scratch
      *
-     * \param acc accumulator of perspective
-     * \param l0_out output buffer to write activated l0 outputs to
-     * \param sp an iterator into the nonzero blocks of l0_out
-     */
-    void activate_l0(
-        const NnueAccumulator& acc, u8 l0_out[L1_SIZE / 2], [[maybe_unused]] SparseIterator& sp
-    ) const;
-
-    /** Does a forward pass through l1
-     *
-     * \param l0_out activated outputs of l0
-     * \param l1_out output buffer to write activated l1 outputs to
-     * \param sp an iterator into the nonzero blocks of l0_out
-     * \param bucket_idx output bucket
+     * \param board current board
      */
-    void forward_l1(
-        const u8 l0_out[L1_SIZE],
-        i32 l1_out[L2_SIZE],
-        [[maybe_unused]] const SparseIterator& sp,
-        i32 bucket_idx
-    ) const;
+    void refresh_small(const chess::Board& board);
 
-    /** Does a forward pass through l2 and l3
+    /** Lazily updates the accumulator stack for one perspective
      *
-     * \param l1_out activated outputs of l1
-     * \param l3_out output buffer
-     * \param bucket_idx output bucket
+     * \param board current board
+     * \param perspective accumulator perspective
      */
-    void forward_l2l3(const i32 l1_out[L2_SIZE], i64& l3_out, i32 bucket_idx) const;
+    void lazy_update(const chess::Board& board, chess::Color perspective);
 
 #ifdef MEASURE_SPARSITY
     /** Updates the ft activation count and tracks the number of nonzero blocks
@@ -0,0 +1,643 @@
+#include <Raphael/nnue_kernels.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+using std::make_unique;
+using std::max;
+using std::memcpy;
+using std::min;
+using std::popcount;
+namespace ch = std::chrono;
+
+
+
+namespace raphael::nnue_kernels::SIMD_ISA {
+using namespace raphael::simd::SIMD_ISA;
+
+static constexpr i32 L1_SIZE = Nnue::L1_SIZE;
+static constexpr i32 L2_SIZE = Nnue::L2_SIZE;
+static constexpr i32 L3_SIZE = Nnue::L3_SIZE;
+static constexpr i32 QA = Nnue::QA;
+static constexpr i32 QC = Nnue::QC;
+static constexpr i32 L1_SHIFT = Nnue::L1_SHIFT;
+static constexpr i32 SMALL_L1_SIZE = Nnue::SMALL_L1_SIZE;
+static constexpr i32 SMALL_QA = Nnue::SMALL_QA;
+
+#ifdef USE_SIMD
+static_assert(Nnue::MEM_ALIGNMENT % ALIGNMENT == 0);
+
+class SparseIterator {
+private:
+    u16 indices_[L1_SIZE / 4] = {};
+    i32 count_ = 0;
+
+    #ifdef __AVX512VBMI2__
+    // clang-format off
+    __m512i offset_ = _mm512_set_epi16(
+        31, 30, 29, 28, 27, 26, 25, 24,
+        23, 22, 21, 20, 19, 18, 17, 16,
+        15, 14, 13, 12, 11, 10,  9,  8,
+         7,  6,  5,  4,  3,  2,  1,  0
+    );  // clang-format on
+    #else
+    __m128i offset_ = _mm_setzero_si128();
+
+    // precompute nonzero_idx[mask][nnz_idx] = position of nonzero block
+    alignas(16) static constexpr MultiArray<u16, 256, 8> nonzero_idx = [] {
+        MultiArray<u16, 256, 8> idx{};
+
+        for (i32 i = 0; i < 256; i++) {
+            i32 nnz = 0;
+
+            for (u8 mask = i; mask != 0; mask &= mask - 1) idx[i][nnz++] = std::countr_zero(mask);
+        }
+
+        return idx;
+    }();
+    #endif
+
+
+public:
+    /** Adds the nonzero indices to the sparse iterator
+     *
+     * \param l0_out0 first chunk of l0 outputs
+     * \param l0_out1 second chunk of l0 outputs
+     */
+    void add_nonzeros(VecU8 l0_out0, VecU8 l0_out1) {
+        constexpr i32 regw32 = ALIGNMENT / sizeof(i32);
+        static_assert((2 * regw32) % 8 == 0);
+
+    #ifdef __AVX512VBMI2__
+        static_assert(USE_SIMD == 512);
+        const auto mask = _mm512_kunpackw(nonzero_mask(l0_out1), nonzero_mask(l0_out0));
+
+        const auto idxs = _mm512_maskz_compress_epi16(mask, offset_);
+        _mm512_storeu_si512(&indices_[count_], idxs);
+        offset_ = add_i16(offset_, full_i16(32));
+        count_ += popcount(mask);
+
+    #else
+        u32 full_mask = (nonzero_mask(l0_out1) << regw32) | nonzero_mask(l0_out0);
+
+        for (i32 i = 0; i < 2 * regw32 / 8; i++) {
+            // get offset of up to 8 nonzeros at a time
+            const u8 mask = full_mask & 0xFF;
+            full_mask >>= 8;
+
+            const auto idxs = _mm_add_epi16(
+                offset_, _mm_load_si128(reinterpret_cast<const __m128i*>(&nonzero_idx[mask]))
+            );
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&indices_[count_]), idxs);
+            offset_ = _mm_add_epi16(offset_, _mm_set1_epi16(8));
+            count_ += popcount(mask);
+        }
+    #endif
+
+        assert(count_ <= L1_SIZE / 4);
+    }
+
+    /** Marks every block as nonzero, for running the sparse kernels densely */
+    void fill_dense() {
+        for (i32 i = 0; i < L1_SIZE / 4; i++) indices_[i] = i;
+        count_ = L1_SIZE / 4;
+    }
+
+    /** Returns the number of nonezero blocks
+     *
+     * \returns the nnz count
+     */
+    i32 count() const { return count_; }
+
+    /** Returns the tile id for a nonzero block
+     *
+     * \param nnz_id which nonzero chunk we want the index for
+     * \returns the corresponding tile id
+     */
+    i32 index(i32 nnz_id) const {
+        assert(nnz_id < count_);
+        return indices_[nnz_id];
+    }
+};
+
+/** Loads the feature transformer weights of one register, widening i8 weights to i16
+ *
+ * \param src weights to load
+ * \returns the loaded register
+ */
+inline VecI16 load_ft(const i16* src) { return load_i16(src); }
+inline VecI16 load_ft(const i8* src) { return load_i8_i16(src); }
+#else
+class SparseIterator {
+public:
+    void fill_dense() {}
+};
+#endif
+
+
+
+void update_accumulators(
+    const i16* old_values,
+    const Nnue::FtWeight (*weights)[L1_SIZE],
+    const AccumulatorUpdate* updates,
+    i32 n_updates
+) {
+#ifdef USE_SIMD
+    constexpr i32 regw = ALIGNMENT / sizeof(i16);
+    constexpr i32 n_chunks = L1_SIZE / regw;
+    static_assert(L1_SIZE % regw == 0);
+    static_assert(n_chunks % SIMD_REGS == 0);
+    VecI16 accs[SIMD_REGS];
+
+    for (i32 i = 0; i < n_chunks; i += SIMD_REGS) {
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < SIMD_REGS; r++) accs[r] = load_i16(&old_values[(i + r) * regw]);
+
+        // apply each ply on top of the previous one while the chunk stays in registers
+        for (i32 u = 0; u < n_updates; u++) {
+            const auto& update = updates[u];
+
+            #pragma GCC unroll 32  // fmt: skip
+            for (i32 r = 0; r < SIMD_REGS; r++)
+                accs[r] = sub_i16(accs[r], load_ft(&weights[update.subs[0]][(i + r) * regw]));
+
+            if (update.n_subs > 1)
+                #pragma GCC unroll 32  // fmt: skip
+                for (i32 r = 0; r < SIMD_REGS; r++)
+                    accs[r] = sub_i16(accs[r], load_ft(&weights[update.subs[1]][(i + r) * regw]));
+
+            #pragma GCC unroll 32  // fmt: skip
+            for (i32 r = 0; r < SIMD_REGS; r++)
+                accs[r] = add_i16(accs[r], load_ft(&weights[update.adds[0]][(i + r) * regw]));
+
+            if (update.n_adds > 1)
+                #pragma GCC unroll 32  // fmt: skip
+                for (i32 r = 0; r < SIMD_REGS; r++)
+                    accs[r] = add_i16(accs[r], load_ft(&weights[update.adds[1]][(i + r) * regw]));
+
+            #pragma GCC unroll 32  // fmt: skip
+            for (i32 r = 0; r < SIMD_REGS; r++) store_i16(&update.values[(i + r) * regw], accs[r]);
+        }
+    }
+#else
+    for (i32 u = 0; u < n_updates; u++) {
+        const auto& update = updates[u];
+        const i16* prev_values = (u == 0) ? old_values : updates[u - 1].values;
+
+        for (i32 i = 0; i < L1_SIZE; i++) {
+            update.values[i] = prev_values[i];
+
+            update.values[i] -= weights[update.subs[0]][i];
+            if (update.n_subs > 1) update.values[i] -= weights[update.subs[1]][i];
+            update.values[i] += weights[update.adds[0]][i];
+            if (update.n_adds > 1) update.values[i] += weights[update.adds[1]][i];
+        }
+    }
+#endif
+}
+
+void update_finny(
+    i16* values,
+    const Nnue::FtWeight (*weights)[L1_SIZE],
+    const i32* adds,
+    i32 n_adds,
+    const i32* subs,
+    i32 n_subs
+) {
+#ifdef USE_SIMD
+    constexpr i32 regw = ALIGNMENT / sizeof(i16);
+    constexpr i32 n_chunks = L1_SIZE / regw;
+    static_assert(L1_SIZE % regw == 0);
+    static_assert(n_chunks % SIMD_REGS == 0);
+    VecI16 accs[SIMD_REGS];
+
+    for (i32 i = 0; i < n_chunks; i += SIMD_REGS) {
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < SIMD_REGS; r++) accs[r] = load_i16(&values[(i + r) * regw]);
+
+        // add features
+        for (i32 f = 0; f < n_adds; f++) {
+            const auto fidx = adds[f];
+
+            #pragma GCC unroll 32  // fmt: skip
+            for (i32 r = 0; r < SIMD_REGS; r++)
+                accs[r] = add_i16(accs[r], load_ft(&weights[fidx][(i + r) * regw]));
+        }
+
+        // rem features
+        for (i32 f = 0; f < n_subs; f++) {
+            const auto fidx = subs[f];
+
+            #pragma GCC unroll 32  // fmt: skip
+            for (i32 r = 0; r < SIMD_REGS; r++)
+                accs[r] = sub_i16(accs[r], load_ft(&weights[fidx][(i + r) * regw]));
+        }
+
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < SIMD_REGS; r++) store_i16(&values[(i + r) * regw], accs[r]);
+    }
+#else
+    for (i32 f = 0; f < n_adds; f++)
+        for (i32 i = 0; i < L1_SIZE; i++) values[i] += weights[adds[f]][i];
+    for (i32 f = 0; f < n_subs; f++)
+        for (i32 i = 0; i < L1_SIZE; i++) values[i] -= weights[subs[f]][i];
+#endif
+}
+
+void update_small(
+    const i16* old_values,
+    i16* new_values,
+    const i16 (*weights)[SMALL_L1_SIZE],
+    const i32* adds,
+    i32 n_adds,
+    const i32* subs,
+    i32 n_subs
+) {
+#ifdef USE_SIMD
+    constexpr i32 regw = ALIGNMENT / sizeof(i16);
+    constexpr i32 n_chunks = SMALL_L1_SIZE / regw;
+    static_assert(SMALL_L1_SIZE % regw == 0);
+    static_assert(n_chunks <= SIMD_REGS);
+    VecI16 accs[n_chunks];
+
+    #pragma GCC unroll 32  // fmt: skip
+    for (i32 r = 0; r < n_chunks; r++) accs[r] = load_i16(&old_values[r * regw]);
+
+    for (i32 f = 0; f < n_adds; f++)
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < n_chunks; r++)
+            accs[r] = add_i16(accs[r], load_i16(&weights[adds[f]][r * regw]));
+
+    for (i32 f = 0; f < n_subs; f++)
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < n_chunks; r++)
+            accs[r] = sub_i16(accs[r], load_i16(&weights[subs[f]][r * regw]));
+
+    #pragma GCC unroll 32  // fmt: skip
+    for (i32 r = 0; r < n_chunks; r++) store_i16(&new_values[r * regw], accs[r]);
+#else
+    for (i32 i = 0; i < SMALL_L1_SIZE; i++) {
+        i16 value = old_values[i];
+        for (i32 f = 0; f < n_adds; f++) value += weights[adds[f]][i];
+        for (i32 f = 0; f < n_subs; f++) value -= weights[subs[f]][i];
+        new_values[i] = value;
+    }
+#endif
+}
+
+i64 forward_small(
+    const i16* stm_values, const i16* ntm_values, const Nnue::SmallNnueParams& params
+) {
+#ifdef USE_SIMD
+    constexpr i32 regw = ALIGNMENT / sizeof(i16);
+    static_assert(SMALL_L1_SIZE % regw == 0);
+    const VecI16 zs = zero_i16();
+    const VecI16 qa = full_i16(SMALL_QA);
+    VecI32 sum = zero_i32();
+
+    // screlu, v * w fits in i16 as v is in [0, SMALL_QA] and w in [-127, 127]
+    for (i32 i = 0; i < SMALL_L1_SIZE; i += regw) {
+        const VecI16 stm_v = clamp_i16(load_i16(&stm_values[i]), zs, qa);
+        const VecI16 ntm_v = clamp_i16(load_i16(&ntm_values[i]), zs, qa);
+        const VecI16 stm_vw = mullo_i16(stm_v, load_i16(&params.W1[i]));
+        const VecI16 ntm_vw = mullo_i16(ntm_v, load_i16(&params.W1[i + SMALL_L1_SIZE]));
+        sum = add_i32(sum, madd_i16(stm_vw, stm_v));
+        sum = add_i32(sum, madd_i16(ntm_vw, ntm_v));
+    }
+    return hadd_i32(sum);
+#else
+    i64 sum = 0;
+    for (i32 i = 0; i < SMALL_L1_SIZE; i++) {
+        const i32 stm_v = min(max(stm_values[i], i16(0)), i16(SMALL_QA));
+        const i32 ntm_v = min(max(ntm_values[i], i16(0)), i16(SMALL_QA));
+        sum += stm_v * stm_v * params.W1[i];
+        sum += ntm_v * ntm_v * params.W1[i + SMALL_L1_SIZE];
+    }
+    return sum;
+#endif
+}
+
+
+/** Activates the output of l0 (the accumulators)
+ *
+ * \param acc accumulator values of perspective
+ * \param l0_out output buffer to write activated l0 outputs to
+ * \param sp an iterator into the nonzero blocks of l0_out
+ */
+void activate_l0(const i16* acc, u8 l0_out[L1_SIZE / 2], [[maybe_unused]] SparseIterator& sp) {
+    constexpr i32 n_pairs = L1_SIZE / 2;
+
+#ifdef USE_SIMD
+    constexpr i32 regw16 = ALIGNMENT / sizeof(i16);
+    static_assert(L1_SIZE % (8 * regw16) == 0);
+
+    constexpr i32 n_chunks = n_pairs / regw16;
+    const VecI16 zs = zero_i16();
+    const VecI16 qa = full_i16(QA);
+
+    for (i32 i = 0; i < n_chunks; i += 4) {
+        // compute 4 * regw16 values of the pairwise mul at once, input in [0, QA]
+        const VecI16 acc0_v0 = clamp_i16(load_i16(&acc[(i + 0) * regw16]), zs, qa);
+        const VecI16 acc1_v0 = clamp_i16(load_i16(&acc[(i + 1) * regw16]), zs, qa);
+        const VecI16 acc2_v0 = clamp_i16(load_i16(&acc[(i + 2) * regw16]), zs, qa);
+        const VecI16 acc3_v0 = clamp_i16(load_i16(&acc[(i + 3) * regw16]), zs, qa);
+        const VecI16 acc0_v1 = clamp_i16(load_i16(&acc[(i + 0) * regw16 + n_pairs]), zs, qa);
+        const VecI16 acc1_v1 = clamp_i16(load_i16(&acc[(i + 1) * regw16 + n_pairs]), zs, qa);
+        const VecI16 acc2_v1 = clamp_i16(load_i16(&acc[(i + 2) * regw16 + n_pairs]), zs, qa);
+        const VecI16 acc3_v1 = clamp_i16(load_i16(&acc[(i + 3) * regw16 + n_pairs]), zs, qa);
+
+        const VecI16 pw0 = mulhi_i16(lshift_i16(acc0_v0, 7), acc0_v1);
+        const VecI16 pw1 = mulhi_i16(lshift_i16(acc1_v0, 7), acc1_v1);
+        const VecI16 pw2 = mulhi_i16(lshift_i16(acc2_v0, 7), acc2_v1);
+        const VecI16 pw3 = mulhi_i16(lshift_i16(acc3_v0, 7), acc3_v1);
+
+        // packus will interleave every 8 values thus l1w must be permuted, output in [0, 127]
+        const VecU8 out0 = pack_u8_i16(pw0, pw1);
+        const VecU8 out1 = pack_u8_i16(pw2, pw3);
+        store_u8(&l0_out[(i + 0) * regw16], out0);
+        store_u8(&l0_out[(i + 2) * regw16], out1);
+
+        // track nonzero blocks
+        sp.add_nonzeros(out0, out1);
+    }
+#else
+    for (i32 i = 0; i < n_pairs; i++) {
+        const i32 acc_v0 = min(max(acc[i], i16(0)), i16(QA));
+        const i32 acc_v1 = min(max(acc[i + n_pairs], i16(0)), i16(QA));
+
+        // simulate mulhi, assuming non-permuted weights
+        l0_out[i] = ((acc_v0 << 7) * acc_v1) >> 16;
+    }
+#endif
+}
+
+/** Does a forward pass through l1
+ *
+ * \param params network weights and biases
+ * \param l0_out activated outputs of l0
+ * \param l1_out output buffer to write activated l1 outputs to
+ * \param sp an iterator into the nonzero blocks of l0_out
+ * \param bucket_idx output bucket
+ */
+void forward_l1(
+    const Nnue::NnueParams& params,
+    const u8 l0_out[L1_SIZE],
+    i32 l1_out[L2_SIZE],
+    [[maybe_unused]] const SparseIterator& sp,
+    i32 bucket_idx
+) {
+#ifdef USE_SIMD
+    // get nnz
+    constexpr i32 regw8 = ALIGNMENT / sizeof(i8);
+    constexpr i32 regw32 = ALIGNMENT / sizeof(i32);
+    static_assert(L2_SIZE % regw32 == 0);
+    static_assert(L1_SIZE % 16 == 0);
+
+    const i32 nnz = sp.count();
+    const i32 nnz4 = (nnz / 4) * 4;
+
+    // compute l1 matmul
+    constexpr i32 n_chunks = L2_SIZE / regw32;
+    VecI32 l1_pre[n_chunks][4];
+
+    #pragma GCC unroll 32  // fmt: skip
+    for (i32 r = 0; r < n_chunks; r++) {
+        l1_pre[r][0] = zero_i32();
+        l1_pre[r][1] = zero_i32();
+        l1_pre[r][2] = zero_i32();
+        l1_pre[r][3] = zero_i32();
+    }
+
+    for (i32 nnz_id = 0; nnz_id < nnz4; nnz_id += 4) {
+        const i32 tile_id0 = sp.index(nnz_id + 0);
+        const i32 tile_id1 = sp.index(nnz_id + 1);
+        const i32 tile_id2 = sp.index(nnz_id + 2);
+        const i32 tile_id3 = sp.index(nnz_id + 3);
+
+        const VecU8 inputs0 = tile_u8(&l0_out[4 * tile_id0]);
+        const VecU8 inputs1 = tile_u8(&l0_out[4 * tile_id1]);
+        const VecU8 inputs2 = tile_u8(&l0_out[4 * tile_id2]);
+        const VecU8 inputs3 = tile_u8(&l0_out[4 * tile_id3]);
+
+        for (i32 r = 0; r < n_chunks; r++) {
+            const VecI8 weights0 = load_i8(&params.W1[bucket_idx][tile_id0][r * regw8]);
+            const VecI8 weights1 = load_i8(&params.W1[bucket_idx][tile_id1][r * regw8]);
+            const VecI8 weights2 = load_i8(&params.W1[bucket_idx][tile_id2][r * regw8]);
+            const VecI8 weights3 = load_i8(&params.W1[bucket_idx][tile_id3][r * regw8]);
+
+            l1_pre[r][0] = dpbusd_i32(l1_pre[r][0], inputs0, weights0);
+            l1_pre[r][1] = dpbusd_i32(l1_pre[r][1], inputs1, weights1);
+            l1_pre[r][2] = dpbusd_i32(l1_pre[r][2], inputs2, weights2);
+            l1_pre[r][3] = dpbusd_i32(l1_pre[r][3], inputs3, weights3);
+        }
+    }
+
+    for (i32 nnz_id = nnz4; nnz_id < nnz; nnz_id++) {
+        const i32 tile_id = sp.index(nnz_id);
+        const VecU8 inputs = tile_u8(&l0_out[4 * tile_id]);
+
+        for (i32 r = 0; r < n_chunks; r++) {
+            const VecI8 weights = load_i8(&params.W1[bucket_idx][tile_id][r * regw8]);
+            l1_pre[r][0] = dpbusd_i32(l1_pre[r][0], inputs, weights);
+        }
+    }
+
+    // activate l1
+    const VecI32 zs = zero_i32();
+    const VecI32 qs = full_i32(QC << L1_SHIFT);
+
+    for (i32 r = 0; r < n_chunks; r++) {
+        const VecI32 pre0 = add_i32(l1_pre[r][0], l1_pre[r][1]);
+        const VecI32 pre1 = add_i32(l1_pre[r][2], l1_pre[r][3]);
+
+        // apply screlu and downshift into QC^2 space
+        const VecI32 bias = load_i32(&params.b1[bucket_idx][r * regw32]);
+        const VecI32 pre = add_i32(add_i32(pre0, pre1), bias);
+        const VecI32 crelu = clamp_i32(pre, zs, qs);
+        const VecI32 screlu = rshift_i32(mullo_i32(crelu, crelu), 2 * L1_SHIFT);
+        store_i32(&l1_out[r * regw32], screlu);
+    }
+#else
+    constexpr i32 n_tiles = L1_SIZE / 4;
+    i32 l1_pre[L2_SIZE] = {0};
+
+    // compute l1 matmul
+    for (i32 i = 0; i < n_tiles; i++)
+        for (i32 j = 0; j < L2_SIZE; j++)
+            for (i32 k = 0; k < 4; k++)
+                l1_pre[j] += l0_out[4 * i + k] * params.W1[bucket_idx][i][4 * j + k];
+
+    // activate l1
+    for (i32 i = 0; i < L2_SIZE; i++) {
+        const i32 bias = params.b1[bucket_idx][i];
+        const i32 pre = l1_pre[i] + bias;
+        const i32 crelu = min(max(pre, 0), QC << L1_SHIFT);
+        const i32 screlu = (crelu * crelu) >> (2 * L1_SHIFT);
+        l1_out[i] = screlu;
+    }
+#endif
+}
+
+/** Does a forward pass through l2 and l3
+ *
+ * \param params network weights and biases
+ * \param l1_out activated outputs of l1
+ * \param bucket_idx output bucket
+ * \returns the output of l3
+ */
+i64 forward_l2l3(const Nnue::NnueParams& params, const i32 l1_out[L2_SIZE], i32 bucket_idx) {
+    i64 l3_out;
+#ifdef USE_SIMD
+    // compute l2 matmul
+    constexpr i32 regw32 = ALIGNMENT / sizeof(i32);
+    static_assert(L3_SIZE % regw32 == 0);
+
+    constexpr i32 n_chunks = L3_SIZE / regw32;
+    VecI32 l2_pre[n_chunks];
+
+    #pragma GCC unroll 32  // fmt: skip
+    for (i32 r = 0; r < n_chunks; r++) l2_pre[r] = load_i32(&params.b2[bucket_idx][r * regw32]);
+
+    for (i32 i = 0; i < L2_SIZE; i++) {
+        // l1_pre += W2[:, i] * l1_out[i], inputs in QC^2 space, weights in QC space
+        VecI32 input = full_i32(l1_out[i]);
+        VecI32 weights[n_chunks];
+
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < n_chunks; r++)
+            weights[r] = load_i32(&params.W2[bucket_idx][i][r * regw32]);
+
+        #pragma GCC unroll 32  // fmt: skip
+        for (i32 r = 0; r < n_chunks; r++) l2_pre[r] = fmadd_i32(input, weights[r], l2_pre[r]);
+    }
+
+    // activate l2 and compute l3 matmul
+    const VecI32 zs = zero_i32();
+    const VecI32 qs = full_i32(QC * QC * QC);
+
+    l3_out = params.b3[bucket_idx];
+    VecI32 sums = zero_i32();
+
+    for (i32 r = 0; r < n_chunks; r++) {
+        const VecI32 crelu = clamp_i32(l2_pre[r], zs, qs);
+        const VecI32 weights = load_i32(&params.W3[bucket_idx][r * regw32]);
+        sums = fmadd_i32(crelu, weights, sums);
+    }
+
+    l3_out += hadd_i32(sums);
+#else
+    i32 l2_out[L3_SIZE];
+    for (i32 i = 0; i < L3_SIZE; i++) l2_out[i] = params.b2[bucket_idx][i];
+
+    // compute l2 matmul
+    for (i32 i = 0; i < L2_SIZE; i++)
+        for (i32 j = 0; j < L3_SIZE; j++) l2_out[j] += l1_out[i] * params.W2[bucket_idx][i][j];
+
+    // activate l2 and compute l3 dotprod
+    l3_out = params.b3[bucket_idx];
+    for (i32 i = 0; i < L3_SIZE; i++) {
+        const i32 crelu = min(max(l2_out[i], 0), QC * QC * QC);
+        l3_out += crelu * params.W3[bucket_idx][i];
+    }
+#endif
+    return l3_out;
+}
+
+i64 forward(
+    const i16* stm_values,
+    const i16* ntm_values,
+    const Nnue::NnueParams& params,
+    i32 bucket_idx,
+    u8 l0_out[L1_SIZE]
+) {
+    SparseIterator sp;
+    activate_l0(stm_values, l0_out, sp);
+    activate_l0(ntm_values, l0_out + L1_SIZE / 2, sp);
+
+    alignas(Nnue::MEM_ALIGNMENT) i32 l1_out[L2_SIZE];
+    forward_l1(params, l0_out, l1_out, sp, bucket_idx);
+    return forward_l2l3(params, l1_out, bucket_idx);
+}
+
+
+void profile_forward(
+    const Nnue::NnueParams& params,
+    const i16 (*accs)[2][L1_SIZE],
+    const i32* buckets,
+    i32 n,
+    ForwardProfile& profile
+) {
+    struct Sample {
+        alignas(Nnue::MEM_ALIGNMENT) u8 l0_out[L1_SIZE];
+        alignas(Nnue::MEM_ALIGNMENT) i32 l1_out[L2_SIZE];
+        SparseIterator sp;
+    };
+    const auto samples = make_unique<Sample[]>(n);
+    SparseIterator dense;
+    dense.fill_dense();
+
+    const auto elapsed_ns = [](ch::steady_clock::time_point start) {
+        return static_cast<u64>(
+            ch::duration_cast<ch::nanoseconds>(ch::steady_clock::now() - start).count()
+        );
+    };
+
+    // time each stage over every position so the clock isn't read per call
+    auto start = ch::steady_clock::now();
+    for (i32 i = 0; i < n; i++) {
+        activate_l0(accs[i][0], samples[i].l0_out, samples[i].sp);
+        activate_l0(accs[i][1], samples[i].l0_out + L1_SIZE / 2, samples[i].sp);
+    }
+    profile.activate_ns += elapsed_ns(start);
+
+    start = ch::steady_clock::now();
+    for (i32 i = 0; i < n; i++)
+        forward_l1(params, samples[i].l0_out, samples[i].l1_out, samples[i].sp, buckets[i]);
+    profile.l1_sparse_ns += elapsed_ns(start);
+
+    start = ch::steady_clock::now();
+    for (i32 i = 0; i < n; i++)
+        forward_l1(params, samples[i].l0_out, samples[i].l1_out, dense, buckets[i]);
+    profile.l1_dense_ns += elapsed_ns(start);
+
+    start = ch::steady_clock::now();
+    for (i32 i = 0; i < n; i++)
+        profile.checksum += forward_l2l3(params, samples[i].l1_out, buckets[i]);
+    profile.l2l3_ns += elapsed_ns(start);
+
+    for (i32 i = 0; i < n; i++) {
+        for (i32 b = 0; b < L1_SIZE / 4; b++) {
+            u32 block;
+            memcpy(&block, &samples[i].l0_out[4 * b], sizeof(block));
+            profile.nnz_blocks += (block != 0);
+        }
+    }
+}
+
+
+
+#if defined(USE_AVX512)
+static constexpr Nnue::NnuePerm PERM = Nnue::NnuePerm::AVX512;
+#elif defined(USE_AVX2)
+static constexpr Nnue::NnuePerm PERM = Nnue::NnuePerm::AVX2;
+#else
+static constexpr Nnue::NnuePerm PERM = Nnue::NnuePerm::NONE;
+#endif
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+
+extern const Kernels KERNELS = {
+    .name = TOSTRING(SIMD_ISA),
+    .perm = PERM,
+    .update_accumulators = update_accumulators,
+    .update_finny = update_finny,
+    .forward = forward,
+    .update_small = update_small,
+    .forward_small = forward_small,
+    .profile_forward = profile_forward,
+};
+}  // namespace raphael::nnue_kernels::SIMD_ISA
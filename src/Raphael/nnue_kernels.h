@@ -0,0 +1,149 @@
+#pragma once
+#include <Raphael/nnue.h>
+#include <Raphael/simd.h>
+
+
+
+namespace raphael::nnue_kernels {
+/** The pending adds and subs of one ply's accumulator, as feature indices */
+struct AccumulatorUpdate {
+    i16* values;  // accumulator values to write to
+    i32 adds[2];
+    i32 subs[2];
+    i32 n_adds;
+    i32 n_subs;
+};
+
+/** Time spent in each stage of the forward pass, accumulated by Kernels::profile_forward */
+struct ForwardProfile {
+    u64 activate_ns = 0;   // activate_l0 of both perspectives
+    u64 l1_sparse_ns = 0;  // forward_l1 over the nonzero blocks
+    u64 l1_dense_ns = 0;   // forward_l1 over every block
+    u64 l2l3_ns = 0;       // forward_l2l3
+    u64 nnz_blocks = 0;    // number of nonzero blocks of l0_out
+    i64 checksum = 0;      // sum of the outputs so the passes aren't optimized out
+};
+
+/** The simd kernels of the network, compiled for one instruction set */
+struct Kernels {
+    const char* name;     // instruction set name
+    Nnue::NnuePerm perm;  // l0 permutation the kernels expect
+
+    /** Updates a chain of consecutive accumulators from the last clean accumulator in a single
+     * pass, each ply applying its 1-2 adds and subs on top of the previous ply
+     *
+     * \param old_values accumulator values of the last clean accumulator
+     * \param weights start of W0
+     * \param updates pending updates of each ply, in order
+     * \param n_updates number of plies to update
+     */
+    void (*update_accumulators)(
+        const i16* old_values,
+        const Nnue::FtWeight (*weights)[Nnue::L1_SIZE],
+        const AccumulatorUpdate* updates,
+        i32 n_updates
+    );
+
+    /** Updates the finny entry values in place with any number of adds and subs
+     *
+     * \param values finny entry values to update
+     * \param weights start of W0
+     * \param adds feature indices to add
+     * \param n_adds number of features to add
+     * \param subs feature indices to remove
+     * \param n_subs number of features to remove
+     */
+    void (*update_finny)(
+        i16* values,
+        const Nnue::FtWeight (*weights)[Nnue::L1_SIZE],
+        const i32* adds,
+        i32 n_adds,
+        const i32* subs,
+        i32 n_subs
+    );
+
+    /** Activates the accumulators and does a forward pass through l1, l2, and l3
+     *
+     * \param stm_values accumulator values of the side to move
+     * \param ntm_values accumulator values of the side not to move
+     * \param params network weights and biases
+     * \param bucket_idx output bucket
+     * \param l0_out output buffer to write activated l0 outputs to
+     * \returns the unscaled network output
+     */
+    i64 (*forward)(
+        const i16* stm_values,
+        const i16* ntm_values,
+        const Nnue::NnueParams& params,
+        i32 bucket_idx,
+        u8 l0_out[Nnue::L1_SIZE]
+    );
+
+    /** Writes the small network accumulator values of a ply, applying any number of adds and subs
+     * to the previous values
+     *
+     * \param old_values accumulator values to start from
+     * \param new_values accumulator values to write to
+     * \param weights start of the small network W0
+     * \param adds feature indices to add
+     * \param n_adds number of features to add
+     * \param subs feature indices to remove
+     * \param n_subs number of features to remove
+     */
+    void (*update_small)(
+        const i16* old_values,
+        i16* new_values,
+        const i16 (*weights)[Nnue::SMALL_L1_SIZE],
+        const i32* adds,
+        i32 n_adds,
+        const i32* subs,
+        i32 n_subs
+    );
+
+    /** Activates the small network accumulators and does a forward pass through its output layer
+     *
+     * \param stm_values accumulator values of the side to move
+     * \param ntm_values accumulator values of the side not to move
+     * \param params small network weights and biases
+     * \returns the output before dividing by SMALL_QA, without the output bias
+     */
+    i64 (*forward_small)(
+        const i16* stm_values, const i16* ntm_values, const Nnue::SmallNnueParams& params
+    );
+
+    /** Times each stage of forward separately over a set of accumulators, for microbenchmarks
+     *
+     * \param params network weights and biases
+     * \param accs stm and ntm accumulator values of each position
+     * \param buckets output bucket of each position
+     * \param n number of positions
+     * \param profile profile to accumulate the timings into
+     */
+    void (*profile_forward)(
+        const Nnue::NnueParams& params,
+        const i16 (*accs)[2][Nnue::L1_SIZE],
+        const i32* buckets,
+        i32 n,
+        ForwardProfile& profile
+    );
+};
+
+#ifdef NNUE_MULTI_ARCH
+namespace avx512_vnni {
+extern const Kernels KERNELS;
+}
+namespace avx512 {
+extern const Kernels KERNELS;
+}
+namespace avx2 {
+extern const Kernels KERNELS;
+}
+namespace sse41 {
+extern const Kernels KERNELS;
+}
+#else
+namespace SIMD_ISA {
+extern const Kernels KERNELS;
+}
+#endif
+}  // namespace raphael::nnue_kernels
@@ -0,0 +1,116 @@
+#include <Raphael/numa.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+using std::getline;
+using std::ifstream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+
+
+namespace raphael::numa {
+namespace internal {
+/** Parses a sysfs cpu/node list such as "0-7,16-23"
+ *
+ * \param list the list to parse
+ * \returns the listed indices
+ */
+vector<i32> parse_list(const string& list) {
+    vector<i32> res;
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        const auto dash = range.find('-');
+        try {
+            const i32 lo = std::stoi(range.substr(0, dash));
+            const i32 hi = (dash == string::npos) ? lo : std::stoi(range.substr(dash + 1));
+            for (i32 i = lo; i <= hi; i++) res.push_back(i);
+        } catch (const std::exception&) {
+            return {};
+        }
+    }
+    return res;
+}
+
+/** Reads the first line of a file
+ *
+ * \param path path to the file
+ * \returns the first line, or an empty string if unreadable
+ */
+string read_line(const string& path) {
+    ifstream file(path);
+    string line;
+    if (file) getline(file, line);
+    return line;
+}
+
+/** Detects the cpus of each node, restricted to the cpus this process may run on
+ *
+ * \returns list of cpus per node
+ */
+vector<vector<i32>> detect_nodes() {
+    vector<vector<i32>> nodes;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {{}};
+
+    for (const i32 node : parse_list(read_line("/sys/devices/system/node/online"))) {
+        const auto path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        vector<i32> cpus;
+        for (const i32 cpu : parse_list(read_line(path)))
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+
+    // no numa info (e.g., in a container), treat all allowed cpus as one node
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (i32 cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed)) nodes.back().push_back(cpu);
+    }
+#else
+    nodes.emplace_back();
+#endif
+    return nodes;
+}
+}  // namespace internal
+
+
+
+const vector<vector<i32>>& node_cpus() {
+    static const auto nodes = internal::detect_nodes();
+    return nodes;
+}
+
+i32 num_nodes() { return node_cpus().size(); }
+
+i32 node_of(i32 thread_id) { return thread_id % num_nodes(); }
+
+i32 bind_thread(i32 thread_id) {
+    const i32 node = node_of(thread_id);
+#ifdef __linux__
+    const auto& cpus = node_cpus()[node];
+    if (cpus.empty()) return -1;
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (const i32 cpu : cpus) CPU_SET(cpu, &mask);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) != 0) return -1;
+    return node;
+#else
+    (void)node;
+    return -1;
+#endif
+}
+}  // namespace raphael::numa
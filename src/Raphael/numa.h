@@ -0,0 +1,35 @@
+#pragma once
+#include <chess/include.h>
+
+#include <vector>
+
+
+
+namespace raphael::numa {
+/** Returns the cpus of each NUMA node available to this process.
+ * Falls back to a single node if the topology cannot be read
+ *
+ * \returns list of cpus per node
+ */
+const std::vector<std::vector<i32>>& node_cpus();
+
+/** Returns the number of NUMA nodes available to this process
+ *
+ * \returns number of nodes
+ */
+i32 num_nodes();
+
+/** Returns the node a searcher thread should be placed on, spreading threads evenly across nodes
+ *
+ * \param thread_id searcher thread id
+ * \returns node index
+ */
+i32 node_of(i32 thread_id);
+
+/** Binds the calling thread to the cpus of the node it should be placed on
+ *
+ * \param thread_id searcher thread id
+ * \returns the node the thread was bound to, or -1 on failure
+ */
+i32 bind_thread(i32 thread_id);
+}  // namespace raphael::numa
@@ -12,7 +12,8 @@ template <bool include_net>
 class Position {
 private:
     chess::Board current_;
-    std::vector<chess::Board> boards_;
+    std::vector<chess::Board::UndoInfo> undos_;  // undo record of every move played
+    std::vector<u64> hashes_;                    // hash of every previous board, for repetitions
     std::vector<chess::PieceMove> moves_;
 
     using NetType = std::conditional_t<include_net, Nnue, std::nullptr_t>;
@@ -21,7 +22,8 @@ private:
 public:
     /** Initializes the position to startpos */
     Position() {
-        boards_.reserve(256);
+        undos_.reserve(256);
+        hashes_.reserve(256);
         moves_.reserve(256);
         if constexpr (include_net) {
             net_.set_board(current_);
@@ -35,7 +37,8 @@ public:
      */
     void set_position(const Position<false>& position) {
         current_ = position.current_;
-        boards_ = position.boards_;
+        undos_ = position.undos_;
+        hashes_ = position.hashes_;
         moves_ = position.moves_;
         if constexpr (include_net) {
             net_.set_board(current_);
@@ -48,7 +51,8 @@ public:
      */
     void set_board(const chess::Board& board) {
         current_ = board;
-        boards_.clear();
+        undos_.clear();
+        hashes_.clear();
         moves_.clear();
         if constexpr (include_net) {
             net_.set_board(current_);
@@ -82,11 +86,11 @@ public:
      * \returns whether the position is in repetition
      */
     bool is_repetition(i32 count = 2) const {
-        const i32 size = boards_.size();
+        const i32 size = hashes_.size();
 
         u8 c = 0;
         for (i32 i = size - 2; i >= 0 && i >= size - current_.halfmoves() - 1; i -= 2) {
-            if (boards_[i].hash() == current_.hash()) c++;
+            if (hashes_[i] == current_.hash()) c++;
             if (c == count) return true;
         }
         return false;
@@ -101,18 +105,46 @@ public:
     i32 evaluate(bool do_scaling)
         requires(include_net)
     {
-        i32 static_eval = net_.evaluate(current_);
-        if (do_scaling) {
-            // material scaling
-            const i32 material_scale
-                = MAT_SCALE_BASE + current_.occ(chess::PieceType::PAWN).count() * MAT_SCALE_PAWN
-                  + current_.occ(chess::PieceType::KNIGHT).count() * MAT_SCALE_KNIGHT
-                  + current_.occ(chess::PieceType::BISHOP).count() * MAT_SCALE_BISHOP
-                  + current_.occ(chess::PieceType::ROOK).count() * MAT_SCALE_ROOK
-                  + current_.occ(chess::PieceType::QUEEN).count() * MAT_SCALE_QUEEN;
-            static_eval = static_eval * material_scale / 32768;
-        }
-        return static_eval;
+        const i32 static_eval = net_.evaluate(current_);
+        return (do_scaling) ? material_scaled(current_, static_eval) : static_eval;
+    }
+
+    /** Returns whether a small network is available for evaluate_small
+     *
+     * \returns whether the position has a small network
+     */
+    bool has_small_net() const
+        requires(include_net)
+    {
+        return net_.has_small_network();
+    }
+
+    /** Evaluates the current board from the current side to move with the small network
+     *
+     * \param do_scaling whether to apply material scaling
+     * \returns the small NNUE evaluation of the board in centipawns
+     */
+    i32 evaluate_small(bool do_scaling)
+        requires(include_net)
+    {
+        const i32 static_eval = net_.evaluate_small(current_);
+        return (do_scaling) ? material_scaled(current_, static_eval) : static_eval;
+    }
+
+    /** Applies material scaling to an evaluation
+     *
+     * \param board board the evaluation is of
+     * \param static_eval the NNUE evaluation of the board
+     * \returns the scaled evaluation
+     */
+    static i32 material_scaled(const chess::Board& board, i32 static_eval) {
+        const i32 material_scale
+            = MAT_SCALE_BASE + board.occ(chess::PieceType::PAWN).count() * MAT_SCALE_PAWN
+              + board.occ(chess::PieceType::KNIGHT).count() * MAT_SCALE_KNIGHT
+              + board.occ(chess::PieceType::BISHOP).count() * MAT_SCALE_BISHOP
+              + board.occ(chess::PieceType::ROOK).count() * MAT_SCALE_ROOK
+              + board.occ(chess::PieceType::QUEEN).count() * MAT_SCALE_QUEEN;
+        return static_eval * material_scale / 32768;
     }
 
 
@@ -124,16 +156,16 @@ public:
         if constexpr (include_net) {
             net_.make_move(current_, move);
         }
-        boards_.push_back(current_);
+        hashes_.push_back(current_.hash());
         moves_.push_back({.move = move, .moving = current_.at(move.from())});
-        current_.make_move(move);
+        current_.make_move(move, undos_.emplace_back());
     }
 
     /** Plays a nullmove */
     void make_nullmove() {
-        boards_.push_back(current_);
+        hashes_.push_back(current_.hash());
         moves_.push_back({.move = chess::Move::NO_MOVE, .moving = chess::Piece::NONE});
-        current_.make_nullmove();
+        current_.make_nullmove(undos_.emplace_back());
     }
 
     /** Unmakes the last move */
@@ -141,15 +173,17 @@ public:
         if constexpr (include_net) {
             net_.unmake_move();
         }
-        current_ = boards_.back();
-        boards_.pop_back();
+        current_.unmake_move(moves_.back().move, undos_.back());
+        undos_.pop_back();
+        hashes_.pop_back();
         moves_.pop_back();
     }
 
     /** Unmakes a nullmove */
     void unmake_nullmove() {
-        current_ = boards_.back();
-        boards_.pop_back();
+        current_.unmake_nullmove(undos_.back());
+        undos_.pop_back();
+        hashes_.pop_back();
         moves_.pop_back();
     }
 
@@ -1,8 +1,28 @@
 #pragma once
 #include <chess/types.h>
 
-#if defined(__AVX512F__)
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__AVX2__) || defined(__SSE4_1__)
     #include <immintrin.h>
+#endif
+
+// kernels can be compiled for several instruction sets in one binary, so the helpers of each
+// instruction set live in their own namespace
+#if defined(__AVX512F__) && defined(__AVX512VNNI__)
+    #define SIMD_ISA avx512_vnni
+#elif defined(__AVX512F__)
+    #define SIMD_ISA avx512
+#elif defined(__AVX__) || defined(__AVX2__)
+    #define SIMD_ISA avx2
+#elif defined(__SSE4_1__)
+    #define SIMD_ISA sse41
+#else
+    #define SIMD_ISA generic
+#endif
+
+
+
+namespace raphael::simd::SIMD_ISA {
+#if defined(__AVX512F__)
     #define USE_AVX512
     #define USE_SIMD 512
     #define ALIGNMENT 64
@@ -34,6 +54,15 @@ inline VecI8 load_i8(const i8* src) { return _mm512_load_si512(src); }
  */
 inline VecI16 load_i16(const i16* src) { return _mm512_load_si512(src); }
 
+/** Loads an i8[32] array into a VecI16 register, sign extending each element
+ *
+ * \param src an array of 32x i8 elements, aligned to 32 bytes
+ * \returns the loaded register
+ */
+inline VecI16 load_i8_i16(const i8* src) {
+    return _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(src)));
+}
+
 /** Loads an i32[16] array into a VecI32 register
  *
  * \param src an array of 16x i32 elements
@@ -120,6 +149,14 @@ inline VecI16 sub_i16(VecI16 a, VecI16 b) { return _mm512_sub_epi16(a, b); }
  */
 inline VecI32 mullo_i32(VecI32 a, VecI32 b) { return _mm512_mullo_epi32(a, b); }
 
+/** Does an element-wise product of two VecI16 registers and keeps the low 16 bits
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the multiplication
+ */
+inline VecI16 mullo_i16(VecI16 a, VecI16 b) { return _mm512_mullo_epi16(a, b); }
+
 /** Does an element-wise product of two VecI16 registers and keeps the high 16 bits
  *
  * \param a register 1
@@ -128,6 +165,14 @@ inline VecI32 mullo_i32(VecI32 a, VecI32 b) { return _mm512_mullo_epi32(a, b); }
  */
 inline VecI16 mulhi_i16(VecI16 a, VecI16 b) { return _mm512_mulhi_epi16(a, b); }
 
+/** Multiplies two VecI16 registers element-wise and adds adjacent pairs of the 32 bit products
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the pairwise sums of the products
+ */
+inline VecI32 madd_i16(VecI16 a, VecI16 b) { return _mm512_madd_epi16(a, b); }
+
 
 /** Does an element-wise clamping of a VecI16 register
  *
@@ -241,7 +286,6 @@ inline i32 hadd_i32(VecI32 reg) {
 }
 
 #elif defined(__AVX__) || defined(__AVX2__)
-    #include <immintrin.h>
     #define USE_AVX2
     #define USE_SIMD 256
     #define ALIGNMENT 32
@@ -279,6 +323,15 @@ inline VecI16 load_i16(const i16* src) {
     return _mm256_load_si256(reinterpret_cast<const VecI16*>(src));
 }
 
+/** Loads an i8[16] array into a VecI16 register, sign extending each element
+ *
+ * \param src an array of 16x i8 elements, aligned to 16 bytes
+ * \returns the loaded register
+ */
+inline VecI16 load_i8_i16(const i8* src) {
+    return _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(src)));
+}
+
 /** Loads an i32[8] array into a VecI32 register
  *
  * \param src an array of 8x i32 elements
@@ -371,6 +424,14 @@ inline VecI16 sub_i16(VecI16 a, VecI16 b) { return _mm256_sub_epi16(a, b); }
  */
 inline VecI32 mullo_i32(VecI32 a, VecI32 b) { return _mm256_mullo_epi32(a, b); }
 
+/** Does an element-wise product of two VecI16 registers and keeps the low 16 bits
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the multiplication
+ */
+inline VecI16 mullo_i16(VecI16 a, VecI16 b) { return _mm256_mullo_epi16(a, b); }
+
 /** Does an element-wise product of two VecI16 registers and keeps the high 16 bits
  *
  * \param a register 1
@@ -379,6 +440,14 @@ inline VecI32 mullo_i32(VecI32 a, VecI32 b) { return _mm256_mullo_epi32(a, b); }
  */
 inline VecI16 mulhi_i16(VecI16 a, VecI16 b) { return _mm256_mulhi_epi16(a, b); }
 
+/** Multiplies two VecI16 registers element-wise and adds adjacent pairs of the 32 bit products
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the pairwise sums of the products
+ */
+inline VecI32 madd_i16(VecI16 a, VecI16 b) { return _mm256_madd_epi16(a, b); }
+
 /** Does an element-wise clamping of a VecI16 register
  *
  * \param reg register to clamp
@@ -482,6 +551,264 @@ inline i32 hadd_i32(VecI32 reg) {
     return _mm_cvtsi128_si32(sum32);
 }
 
+#elif defined(__SSE4_1__)
+    #define USE_SSE41
+    #define USE_SIMD 128
+    #define ALIGNMENT 16
+    #define SIMD_REGS 16
+using VecU8 = __m128i;   // a list of 16x u8
+using VecI8 = __m128i;   // a list of 16x i8
+using VecI16 = __m128i;  // a list of 8x i16
+using VecI32 = __m128i;  // a list of 4x i32
+
+
+/** Loads an u8[16] array into a VecU8 register
+ *
+ * \param src an array of 16x u8 elements
+ * \returns the loaded register
+ */
+inline VecU8 load_u8(const u8* src) { return _mm_load_si128(reinterpret_cast<const VecU8*>(src)); }
+
+/** Loads an i8[16] array into a VecI8 register
+ *
+ * \param src an array of 16x i8 elements
+ * \returns the loaded register
+ */
+inline VecI8 load_i8(const i8* src) { return _mm_load_si128(reinterpret_cast<const VecI8*>(src)); }
+
+/** Loads an i16[8] array into a VecI16 register
+ *
+ * \param src an array of 8x i16 elements
+ * \returns the loaded register
+ */
+inline VecI16 load_i16(const i16* src) {
+    return _mm_load_si128(reinterpret_cast<const VecI16*>(src));
+}
+
+/** Loads an i8[8] array into a VecI16 register, sign extending each element
+ *
+ * \param src an array of 8x i8 elements
+ * \returns the loaded register
+ */
+inline VecI16 load_i8_i16(const i8* src) {
+    return _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+}
+
+/** Loads an i32[4] array into a VecI32 register
+ *
+ * \param src an array of 4x i32 elements
+ * \returns the loaded register
+ */
+inline VecI32 load_i32(const i32* src) {
+    return _mm_load_si128(reinterpret_cast<const VecI32*>(src));
+}
+
+/** Stores a VecU8 register into a u8[16] array
+ *
+ * \param dst the array of 16x u8 elements to store into
+ * \param src the register to store
+ */
+inline void store_u8(u8* dst, VecU8 src) { _mm_store_si128(reinterpret_cast<VecU8*>(dst), src); }
+
+/** Stores a VecI16 register into an i16[8] array
+ *
+ * \param dst the array of 8x i16 elements to store into
+ * \param src the register to store
+ */
+inline void store_i16(i16* dst, VecI16 src) {
+    _mm_store_si128(reinterpret_cast<VecI16*>(dst), src);
+}
+
+/** Stores a VecI32 register into an i32[4] array
+ *
+ * \param dst the array of 4x i32 elements to store into
+ * \param src the register to store
+ */
+inline void store_i32(i32* dst, VecI32 src) {
+    _mm_store_si128(reinterpret_cast<VecI32*>(dst), src);
+}
+
+/** Returns a VecI16 register with all zeros
+ *
+ * \returns an all zero register
+ */
+inline VecI16 zero_i16() { return _mm_setzero_si128(); }
+
+/** Returns a VecI32 register with all zeros
+ *
+ * \returns an all zero register
+ */
+inline VecI32 zero_i32() { return _mm_setzero_si128(); }
+
+/** Returns a VecI16 register with all values set to val
+ *
+ * \param val the value to set to
+ * \returns an all val register
+ */
+inline VecI16 full_i16(i16 val) { return _mm_set1_epi16(val); }
+
+/** Returns a VecI32 register with all values set to val
+ *
+ * \param val the value to set to
+ * \returns an all val register
+ */
+inline VecI32 full_i32(i32 val) { return _mm_set1_epi32(val); }
+
+/** Does an element-wise addition of two VecI16 registers
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the addition
+ */
+inline VecI16 add_i16(VecI16 a, VecI16 b) { return _mm_add_epi16(a, b); }
+
+/** Does an element-wise addition of two VecI32 registers
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the addition
+ */
+inline VecI32 add_i32(VecI32 a, VecI32 b) { return _mm_add_epi32(a, b); }
+
+/** Does an element-wise subtraction of two VecI16 registers
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the subtraction
+ */
+inline VecI16 sub_i16(VecI16 a, VecI16 b) { return _mm_sub_epi16(a, b); }
+
+/** Does an element-wise product of two VecI32 registers and keeps the low 16 bits
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the multiplication
+ */
+inline VecI32 mullo_i32(VecI32 a, VecI32 b) { return _mm_mullo_epi32(a, b); }
+
+/** Does an element-wise product of two VecI16 registers and keeps the low 16 bits
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the multiplication
+ */
+inline VecI16 mullo_i16(VecI16 a, VecI16 b) { return _mm_mullo_epi16(a, b); }
+
+/** Does an element-wise product of two VecI16 registers and keeps the high 16 bits
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the result of the multiplication
+ */
+inline VecI16 mulhi_i16(VecI16 a, VecI16 b) { return _mm_mulhi_epi16(a, b); }
+
+/** Multiplies two VecI16 registers element-wise and adds adjacent pairs of the 32 bit products
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the pairwise sums of the products
+ */
+inline VecI32 madd_i16(VecI16 a, VecI16 b) { return _mm_madd_epi16(a, b); }
+
+/** Does an element-wise clamping of a VecI16 register
+ *
+ * \param reg register to clamp
+ * \param mins register containing the min values
+ * \param maxs register containing the max values
+ * \returns the result of the clamp
+ */
+inline VecI16 clamp_i16(VecI16 reg, VecI16 mins, VecI16 maxs) {
+    return _mm_min_epi16(_mm_max_epi16(reg, mins), maxs);
+}
+
+/** Does an element-wise clamping of a VecI32 register
+ *
+ * \param reg register to clamp
+ * \param mins register containing the min values
+ * \param maxs register containing the max values
+ * \returns the result of the clamp
+ */
+inline VecI32 clamp_i32(VecI32 reg, VecI32 mins, VecI32 maxs) {
+    return _mm_min_epi32(_mm_max_epi32(reg, mins), maxs);
+}
+
+/** Does an element-wise logical left shift of a VecI16 register by a constexpr shift amount
+ *
+ * \param reg register to shift
+ * \param shift the amount to shift by, known at compile time
+ * \returns the shifted register
+ */
+inline VecI16 lshift_i16(VecI16 reg, i32 shift) { return _mm_slli_epi16(reg, shift); }
+
+/** Does an element-wise arithmetic right shift of a VecI32 register by a constexpr shift amount
+ *
+ * \param reg register to shift
+ * \param shift the amount to shift by, known at compile time
+ * \returns the shifted register
+ */
+inline VecI32 rshift_i32(VecI32 reg, i32 shift) { return _mm_srai_epi32(reg, shift); }
+
+/** Packs two VecI16 registers into a VecU8 register
+ * Result is [a b], so no weight permutation is needed
+ *
+ * \param a register 1
+ * \param b register 2
+ * \returns the packed register
+ */
+inline VecU8 pack_u8_i16(VecI16 a, VecI16 b) { return _mm_packus_epi16(a, b); }
+
+/** Tiles a u8[4] array 4 times into a VecU8 register
+ *
+ * \param vals the value to tile
+ * \returns the tiled register
+ */
+inline VecU8 tile_u8(const u8* vals) {
+    return _mm_set1_epi32(*reinterpret_cast<const u32*>(vals));  // technically UB
+}
+
+/** Returns a mask of nonzero groups of 4x u8 in the VecU8 register
+ *
+ * \param reg register to get mask for
+ * \returns a bitmask of nonzero blocks
+ */
+inline u32 nonzero_mask(VecU8 reg) {
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(reg, zero_i32())));
+}
+
+/** Computes out[i] = a[i] + dot(b[4*i : 4*(i+1)], c[4*i : 4*(i+1)])
+ *
+ * \param a register 1
+ * \param b register 2
+ * \param c register 3
+ * \returns the result of the accumulated dot product
+ */
+inline VecI32 dpbusd_i32(VecI32 a, VecU8 b, VecI8 c) {
+    return add_i32(a, _mm_madd_epi16(_mm_maddubs_epi16(b, c), full_i16(1)));
+}
+
+/** Does an element-wise fused multiply add a[i] * b[i] + c[i]
+ *
+ * \param a register 1
+ * \param b register 2
+ * \param c register 3
+ * \returns the result of the fused multiply add
+ */
+inline VecI32 fmadd_i32(VecI32 a, VecI32 b, VecI32 c) { return add_i32(mullo_i32(a, b), c); }
+
+/** Does a horizontal sum of a VecI32 register
+ *
+ * \param reg register to horizontally sum
+ * \returns the horizontally summed result
+ */
+inline i32 hadd_i32(VecI32 reg) {
+    __m128i hi64 = _mm_unpackhi_epi64(reg, reg);
+    __m128i sum64 = _mm_add_epi32(hi64, reg);
+    __m128i hi32 = _mm_shuffle_epi32(sum64, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128i sum32 = _mm_add_epi32(sum64, hi32);
+    return _mm_cvtsi128_si32(sum32);
+}
+
 #else
     #define ALIGNMENT 32
 #endif
+}  // namespace raphael::simd::SIMD_ISA
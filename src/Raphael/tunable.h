@@ -89,24 +89,39 @@ struct SpinOption {
 };
 
 struct CheckOption {
+    using CheckOptionCB = std::function<void()>;
+
     std::string name;
     bool value;
     bool def;
+    CheckOptionCB callback;
 
     /** Initializes a CheckOption
      *
      * \param name name of the option
      * \param value value to set as the default
+     * \param callback function to call when the option is set
      */
-    CheckOption(const std::string& name, bool value): name(name), value(value), def(value) {};
+    CheckOption(const std::string& name, bool value, CheckOptionCB callback = nullptr)
+        : name(name), value(value), def(value), callback(callback) {};
 
     /** Sets the value of the option
      *
      * \param val value to set to
      */
-    void set(bool val) { value = val; }
+    void set(bool val) {
+        value = val;
+        if (callback) callback();
+    }
     operator bool() const { return value; }
 
+
+    /** Sets a callback for the option
+     *
+     * \param cb function to call when the option is set
+     */
+    void set_callback(CheckOptionCB cb) { callback = cb; }
+
     /** Returns the UCI option info string
      *
      * \returns stringified option info
@@ -116,6 +131,103 @@ struct CheckOption {
     }
 };
 
+struct ComboOption {
+    using ComboOptionCB = std::function<void()>;
+
+    std::string name;
+    std::string value;
+    std::string def;
+    std::vector<std::string> vars;
+    ComboOptionCB callback;
+
+    /** Initializes a ComboOption
+     *
+     * \param name name of the option
+     * \param value value to set as the default
+     * \param vars allowed values of the option
+     * \param callback function to call when the option is set
+     */
+    ComboOption(
+        const std::string& name,
+        const std::string& value,
+        const std::vector<std::string>& vars,
+        ComboOptionCB callback = nullptr
+    )
+        : name(name), value(value), def(value), vars(vars), callback(callback) {};
+
+    /** Sets the value of the option
+     *
+     * \param val value to set to, must be one of vars
+     */
+    void set(const std::string& val) {
+        value = val;
+        if (callback) callback();
+    }
+    operator const std::string&() const { return value; }
+
+
+    /** Sets a callback for the option
+     *
+     * \param cb function to call when the option is set
+     */
+    void set_callback(ComboOptionCB cb) { callback = cb; }
+
+
+    /** Returns the UCI option info string
+     *
+     * \returns stringified option info
+     */
+    std::string uci() const {
+        std::string res = "option name " + name + " type combo default " + def;
+        for (const auto& var : vars) res += " var " + var;
+        return res + "\n";
+    }
+};
+
+struct StringOption {
+    using StringOptionCB = std::function<void()>;
+
+    std::string name;
+    std::string value;
+    std::string def;
+    StringOptionCB callback;
+
+    /** Initializes a StringOption
+     *
+     * \param name name of the option
+     * \param value value to set as the default
+     * \param callback function to call when the option is set
+     */
+    StringOption(
+        const std::string& name, const std::string& value, StringOptionCB callback = nullptr
+    )
+        : name(name), value(value), def(value), callback(callback) {};
+
+    /** Sets the value of the option
+     *
+     * \param val value to set to
+     */
+    void set(const std::string& val) {
+        value = val;
+        if (callback) callback();
+    }
+    operator const std::string&() const { return value; }
+
+
+    /** Sets a callback for the option
+     *
+     * \param cb function to call when the option is set
+     */
+    void set_callback(StringOptionCB cb) { callback = cb; }
+
+
+    /** Returns the UCI option info string
+     *
+     * \returns stringified option info
+     */
+    std::string uci() const { return "option name " + name + " type string default " + def + "\n"; }
+};
+
 
 
 // tunable helpers
@@ -297,6 +409,7 @@ Tunable(DO_SHALLOWER_RED, 136, 64, 256, true);
 Tunable(QS_MAX_MOVES, 3, 1, 5, false);
 Tunable(QS_FP_MARGIN, 158, 32, 384, true);
 Tunable(QS_SEE_THRESH, -182, -384, 32, true);
+Tunable(QS_SMALL_NET_MARGIN, 300, 64, 1024, true);
 
 // SEE
 inline MultiArray<i32, 13> SEE_TABLE;
@@ -360,6 +473,8 @@ static constexpr i32 BENCH_DEPTH = 14;
 static constexpr i32 BENCH_DEPTH = 15;
 #endif
 
+static constexpr i32 PERFT_MAX_HASH = 65536;
+
 static constexpr i32 GENFENS_MAX_NODES = 1000;
 static constexpr i32 GENFENS_MAX_SCORE = 1000;
 
@@ -371,6 +486,10 @@ static constexpr i32 DATAGEN_DRAW_ADJ_SCORE = 15;
 static constexpr i32 DATAGEN_HASH = 16;
 static constexpr i32 DATAGEN_BATCH_SIZE = 32;
 
+static constexpr i32 EVALBATCH_HASH = 16;
+static constexpr i32 EVALBATCH_CHUNK_SIZE = 1024;  // lines per chunk handed to a worker
+static constexpr i32 EVALBATCH_CHUNKS_PER_THREAD = 4;  // max chunks in flight per worker
+
 static constexpr f64 DEF_TARGET_ABS_MEAN = 491.0081;  // average for lichess-big3-resolved
 
 
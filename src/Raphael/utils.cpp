@@ -4,7 +4,11 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
 
+using std::string;
 using std::string_view;
 using std::tolower;
 using std::ranges::equal;
@@ -25,4 +29,31 @@ bool is_case_insensitive_equals(string_view str1, string_view str2) {
         return tolower(static_cast<unsigned char>(c1)) == tolower(static_cast<unsigned char>(c2));
     });
 }
+
+
+usize huge_page_bytes(const void* ptr, usize size) {
+#ifdef __linux__
+    // huge pages are only backed on first touch, so sum them over the mappings of the region
+    const auto start = reinterpret_cast<uintptr_t>(ptr);
+    const auto end = start + size;
+    usize huge_kb = 0;
+    bool in_region = false;
+
+    std::ifstream smaps("/proc/self/smaps");
+    string line;
+    while (getline(smaps, line)) {
+        unsigned long lo, hi;
+        usize kb;
+        if (sscanf(line.c_str(), "%lx-%lx ", &lo, &hi) == 2)
+            in_region = lo < end && hi > start;
+        else if (in_region && sscanf(line.c_str(), "AnonHugePages: %zu kB", &kb) == 1)
+            huge_kb += kb;
+    }
+    return std::min(huge_kb * 1024, size);
+#else
+    (void)ptr;
+    (void)size;
+    return 0;
+#endif
+}
 }  // namespace raphael::utils
@@ -40,4 +40,13 @@ i32 mate_distance(i32 score);
  * \returns whether the two strings are case-insensitive equal
  */
 bool is_case_insensitive_equals(std::string_view str1, std::string_view str2);
+
+
+/** Returns how much of a memory region is backed by transparent huge pages (Linux only)
+ *
+ * \param ptr start of the region
+ * \param size size of the region in bytes
+ * \returns number of bytes backed by huge pages, 0 if unknown
+ */
+usize huge_page_bytes(const void* ptr, usize size);
 }  // namespace raphael::utils
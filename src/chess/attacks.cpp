@@ -0,0 +1,449 @@
+#include <chess/attacks.h>
+
+
+
+// every table below is constinit, so it is generated by the compiler and stored fully initialized
+// instead of being filled in at startup. Constant evaluation is slow, so only the magic table (or
+// the pext tables without it) walks the rays for each occupancy and the rest is derived
+namespace chess {
+namespace {
+struct Magic {
+    u64 magic;
+    u32 offset;
+};
+
+// black magics found by Volker Annuss https://talkchess.com/forum/viewtopic.php?t=64790
+constexpr Magic BISHOP_MAGICS[64] = {
+    {0x107ac08050500bffULL, 66157},
+    {0x7fffdfdfd823fffdULL, 71730},
+    {0x0400c00fe8000200ULL, 37781},
+    {0x103f802004000000ULL, 21015},
+    {0xc03fe00100000000ULL, 47590},
+    {0x24c00bffff400000ULL, 835  },
+    {0x0808101f40007f04ULL, 23592},
+    {0x100808201ec00080ULL, 30599},
+    {0xffa2feffbfefb7ffULL, 68776},
+    {0x083e3ee040080801ULL, 19959},
+    {0x040180bff7e80080ULL, 21783},
+    {0x0440007fe0031000ULL, 64836},
+    {0x2010007ffc000000ULL, 23417},
+    {0x1079ffe000ff8000ULL, 66724},
+    {0x7f83ffdfc03fff80ULL, 74542},
+    {0x080614080fa00040ULL, 67266},
+    {0x7ffe7fff817fcff9ULL, 26575},
+    {0x7ffebfffa01027fdULL, 67543},
+    {0x20018000c00f3c01ULL, 24409},
+    {0x407e0001000ffb8aULL, 30779},
+    {0x201fe000fff80010ULL, 17384},
+    {0xffdfefffde39ffefULL, 18778},
+    {0x7ffff800203fbfffULL, 65109},
+    {0x7ff7fbfff8203fffULL, 20184},
+    {0x000000fe04004070ULL, 38240},
+    {0x7fff7f9fffc0eff9ULL, 16459},
+    {0x7ffeff7f7f01f7fdULL, 17432},
+    {0x3f6efbbf9efbffffULL, 81040},
+    {0x0410008f01003ffdULL, 84946},
+    {0x20002038001c8010ULL, 18276},
+    {0x087ff038000fc001ULL, 8512 },
+    {0x00080c0c00083007ULL, 78544},
+    {0x00000080fc82c040ULL, 19974},
+    {0x000000407e416020ULL, 23850},
+    {0x00600203f8008020ULL, 11056},
+    {0xd003fefe04404080ULL, 68019},
+    {0x100020801800304aULL, 85965},
+    {0x7fbffe700bffe800ULL, 80524},
+    {0x107ff00fe4000f90ULL, 38221},
+    {0x7f8fffcff1d007f8ULL, 64647},
+    {0x0000004100f88080ULL, 61320},
+    {0x00000020807c4040ULL, 67281},
+    {0x00000041018700c0ULL, 79076},
+    {0x0010000080fc4080ULL, 17115},
+    {0x1000003c80180030ULL, 50718},
+    {0x2006001cf00c0018ULL, 24659},
+    {0xffffffbfeff80fdcULL, 38291},
+    {0x000000101003f812ULL, 30605},
+    {0x0800001f40808200ULL, 37759},
+    {0x084000101f3fd208ULL, 4639 },
+    {0x080000000f808081ULL, 21759},
+    {0x0004000008003f80ULL, 67799},
+    {0x08000001001fe040ULL, 22841},
+    {0x085f7d8000200a00ULL, 66689},
+    {0xfffffeffbfeff81dULL, 62548},
+    {0xffbfffefefdff70fULL, 66597},
+    {0x100000101ec10082ULL, 86749},
+    {0x7fbaffffefe0c02fULL, 69558},
+    {0x7f83fffffff07f7fULL, 61589},
+    {0xfff1fffffff7ffc1ULL, 62533},
+    {0x0878040000ffe01fULL, 64387},
+    {0x005d00000120200aULL, 26581},
+    {0x0840800080200fdaULL, 76355},
+    {0x100000c05f582008ULL, 11140}
+};
+
+constexpr Magic ROOK_MAGICS[64] = {
+    {0x80280013ff84ffffULL, 10890},
+    {0x5ffbfefdfef67fffULL, 56054},
+    {0xffeffaffeffdffffULL, 67495},
+    {0x003000900300008aULL, 72797},
+    {0x0030018003500030ULL, 17179},
+    {0x0020012120a00020ULL, 63978},
+    {0x0030006000c00030ULL, 56650},
+    {0xffa8008dff09fff8ULL, 15929},
+    {0x7fbff7fbfbeafffcULL, 55905},
+    {0x0000140081050002ULL, 26301},
+    {0x0000180043800048ULL, 78100},
+    {0x7fffe800021fffb8ULL, 86245},
+    {0xffffcffe7fcfffafULL, 75228},
+    {0x00001800c0180060ULL, 31661},
+    {0xffffe7ff8fbfffe8ULL, 38053},
+    {0x0000180030620018ULL, 37433},
+    {0x00300018010c0003ULL, 74747},
+    {0x0003000c0085ffffULL, 53847},
+    {0xfffdfff7fbfefff7ULL, 70952},
+    {0x7fc1ffdffc001fffULL, 49447},
+    {0xfffeffdffdffdfffULL, 62629},
+    {0x7c108007befff81fULL, 58996},
+    {0x20408007bfe00810ULL, 36009},
+    {0x0400800558604100ULL, 21230},
+    {0x0040200010080008ULL, 51882},
+    {0x0010020008040004ULL, 11841},
+    {0xfffdfefff7fbfff7ULL, 25794},
+    {0xfebf7dfff8fefff9ULL, 49689},
+    {0xc00000ffe001ffe0ULL, 63400},
+    {0x2008208007004007ULL, 33958},
+    {0xbffbfafffb683f7fULL, 21991},
+    {0x0807f67ffa102040ULL, 45618},
+    {0x200008e800300030ULL, 70134},
+    {0x0000008780180018ULL, 75944},
+    {0x0000010300180018ULL, 68392},
+    {0x4000008180180018ULL, 66472},
+    {0x008080310005fffaULL, 23236},
+    {0x4000188100060006ULL, 19067},
+    {0xffffff7fffbfbfffULL, 0    },
+    {0x0000802000200040ULL, 43566},
+    {0x20000202ec002800ULL, 29810},
+    {0xfffff9ff7cfff3ffULL, 65558},
+    {0x000000404b801800ULL, 77684},
+    {0x2000002fe03fd000ULL, 73350},
+    {0xffffff6ffe7fcffdULL, 61765},
+    {0xbff7efffbfc00fffULL, 49282},
+    {0x000000100800a804ULL, 78840},
+    {0xfffbffefa7ffa7feULL, 82904},
+    {0x0000052800140028ULL, 24594},
+    {0x00000085008a0014ULL, 9513 },
+    {0x8000002b00408028ULL, 29012},
+    {0x4000002040790028ULL, 27684},
+    {0x7800002010288028ULL, 27901},
+    {0x0000001800e08018ULL, 61477},
+    {0x1890000810580050ULL, 25719},
+    {0x2003d80000500028ULL, 50020},
+    {0xfffff37eefefdfbeULL, 41547},
+    {0x40000280090013c1ULL, 4750 },
+    {0xbf7ffeffbffaf71fULL, 6014 },
+    {0xfffdffff777b7d6eULL, 41529},
+    {0xeeffffeff0080bfeULL, 84192},
+    {0xafe0000fff780402ULL, 33433},
+    {0xee73fffbffbb77feULL, 8555 },
+    {0x0002000308482882ULL, 1009 }
+};
+
+// (file, rank) steps of the bishop directions, then the rook directions
+constexpr i32 DIRECTIONS[8][2] = {
+    {1, 1}, {1, -1}, {-1, -1}, {-1, 1}, // bishops
+    {1, 0}, {0, -1}, {-1, 0},  {0, 1}   // rooks
+};
+
+// pre-calculated lookup table of the empty board ray from each square in each direction. The
+// generators below work on plain u64s, BitBoard operations make constant evaluation much slower
+constexpr MultiArray<u64, 8, 64> RAYS = [] {
+    MultiArray<u64, 8, 64> rays{};
+    for (i32 dir = 0; dir < 8; dir++) {
+        const i32 df = DIRECTIONS[dir][0];
+        const i32 dr = DIRECTIONS[dir][1];
+
+        for (i32 sq = 0; sq < 64; sq++) {
+            for (i32 f = sq % 8 + df, r = sq / 8 + dr; f >= 0 && f < 8 && r >= 0 && r < 8;
+                 f += df, r += dr)
+                rays[dir][sq] |= u64(1) << (r * 8 + f);
+        }
+    }
+    return rays;
+}();
+
+/** Returns the attacks of a bishop or rook by cutting each ray off behind its first blocker. Only
+ * used to generate the tables, so it works on plain u64s to keep constant evaluation cheap
+ *
+ * \param sq square of the slider
+ * \param occupied occupied squares
+ * \returns the attacked squares
+ */
+template <bool is_rook>
+[[nodiscard]] constexpr u64 get_slider_attacks(i32 sq, u64 occupied) {
+    u64 attacks = 0;
+    for (i32 dir = is_rook * 4; dir < is_rook * 4 + 4; dir++) {
+        const u64 ray = RAYS[dir][sq];
+        const u64 blockers = ray & occupied;
+        if (!blockers) {
+            attacks |= ray;
+            continue;
+        }
+
+        // the nearest blocker is the lowest square on rays going up the board
+        const auto [df, dr] = DIRECTIONS[dir];
+        const bool up = dr > 0 || (dr == 0 && df > 0);
+        const i32 blocker = (up) ? std::countr_zero(blockers) : 63 - std::countl_zero(blockers);
+        attacks |= ray ^ RAYS[dir][blocker];
+    }
+    return attacks;
+}
+
+/** Returns the squares that can block a bishop or rook, i.e. its empty board attacks without the
+ * edge squares that end each ray
+ *
+ * \param sq square of the slider
+ * \returns the relevant occupancy mask
+ */
+template <bool is_rook>
+[[nodiscard]] constexpr u64 get_slider_mask(i32 sq) {
+    const u64 edges = ((BitBoard::RANK1 | BitBoard::RANK8) & ~(BitBoard::RANK1 << (sq / 8 * 8)))
+                      | ((BitBoard::FILEA | BitBoard::FILEH) & ~(BitBoard::FILEA << (sq % 8)));
+    return get_slider_attacks<is_rook>(sq, 0) & ~edges;
+}
+
+#if !defined(CHESS_KINDERGARTEN) && !defined(CHESS_USE_PEXT)
+/** Generates the attacks for every occupancy of every square, indexed with the magics
+ *
+ * \returns the attack table shared by bishops and rooks
+ */
+[[nodiscard]] constexpr std::array<u64, 88507> generate_magic_attacks() {
+    std::array<u64, 88507> br_attacks{};
+    for (i32 sq = 0; sq < 64; sq++) {
+        // bishop
+        u64 mask = get_slider_mask<false>(sq);
+        u64 magic = BISHOP_MAGICS[sq].magic;
+        u64* attacks = br_attacks.data() + BISHOP_MAGICS[sq].offset;
+        u64 subset = 0;
+        do {
+            attacks[((subset | ~mask) * magic) >> 55] = get_slider_attacks<false>(sq, subset);
+            subset = (subset - mask) & mask;
+        } while (subset);
+
+        // rook
+        mask = get_slider_mask<true>(sq);
+        magic = ROOK_MAGICS[sq].magic;
+        attacks = br_attacks.data() + ROOK_MAGICS[sq].offset;
+        subset = 0;
+        do {
+            attacks[((subset | ~mask) * magic) >> 52] = get_slider_attacks<true>(sq, subset);
+            subset = (subset - mask) & mask;
+        } while (subset);
+    }
+    return br_attacks;
+}
+#endif
+
+#if defined(CHESS_USE_PEXT) || defined(CHESS_RUNTIME_PEXT)
+/** Generates the attacks for every occupancy of every square, indexed with pext
+ *
+ * \tparam is_rook whether to generate rook attacks, bishop attacks otherwise
+ * \tparam size total number of occupancies over all squares
+ * \returns the attack table
+ */
+template <bool is_rook, usize size>
+[[nodiscard]] constexpr std::array<u64, size> generate_pext_attacks() {
+    #ifdef CHESS_RUNTIME_PEXT
+    // gcc caches the magic table evaluated for BR_ATTACKS, so this costs a lookup, not a rebuild
+    constexpr auto magic_attacks = generate_magic_attacks();
+    #endif
+
+    std::array<u64, size> attacks{};
+    usize offset = 0;
+    for (i32 sq = 0; sq < 64; sq++) {
+        const u64 mask = get_slider_mask<is_rook>(sq);
+    #ifdef CHESS_RUNTIME_PEXT
+        const Magic magic = (is_rook) ? ROOK_MAGICS[sq] : BISHOP_MAGICS[sq];
+        const i32 shift = (is_rook) ? 52 : 55;
+    #endif
+
+        // subsets are enumerated in increasing order, matching pext
+        u64 subset = 0;
+        do {
+    #ifdef CHESS_RUNTIME_PEXT
+            // copy the attacks out of the magic table instead of walking the rays again
+            const u64 index = ((subset | ~mask) * magic.magic) >> shift;
+            attacks[offset++] = magic_attacks[magic.offset + index];
+    #else
+            attacks[offset++] = get_slider_attacks<is_rook>(sq, subset);
+    #endif
+            subset = (subset - mask) & mask;
+        } while (subset);
+    }
+    return attacks;
+}
+#endif
+}  // namespace
+
+
+
+#ifdef CHESS_KINDERGARTEN
+constinit const MultiArray<u8, 64, 8> Attacks::FIRST_RANK_ATTACKS = [] {
+    MultiArray<u8, 64, 8> first_rank_attacks{};
+    for (u64 occ = 0; occ < 64; occ++) {
+        for (File file = File::A; file <= File::H; ++file) {
+            const auto sq = Square(file, Rank::R1);
+            const u64 attacks = get_slider_attacks<true>(sq, occ << 1);
+            first_rank_attacks[occ][file] = static_cast<u8>(attacks & BitBoard::RANK1);
+        }
+    }
+    return first_rank_attacks;
+}();
+
+constinit const MultiArray<BitBoard, 8, 64> Attacks::FILL_UP_ATTACKS = [] {
+    MultiArray<BitBoard, 8, 64> fill_up_attacks{};
+    for (u64 occ = 0; occ < 64; occ++) {
+        for (File file = File::A; file <= File::H; ++file) {
+            const auto sq = Square(file, Rank::R1);
+            const u64 attacks = get_slider_attacks<true>(sq, occ << 1);
+            fill_up_attacks[file][occ] = (attacks & BitBoard::RANK1) * 0x0101010101010101ULL;
+        }
+    }
+    return fill_up_attacks;
+}();
+
+constinit const MultiArray<BitBoard, 8, 64> Attacks::A_FILE_ATTACKS = [] {
+    MultiArray<BitBoard, 8, 64> a_file_attacks{};
+
+    // the inner squares of file a are gathered in an order given by the multiply, so the
+    // occupancy each index stands for is found by enumerating them
+    const u64 inner_file = BitBoard::FILEA & ~(BitBoard::RANK1 | BitBoard::RANK8);
+    u64 subset = 0;
+    do {
+        const u64 index = (subset * DIAGONAL_C7H2) >> 58;
+        for (Rank rank = Rank::R1; rank <= Rank::R8; ++rank) {
+            const u64 attacks = get_slider_attacks<true>(Square(File::A, rank), subset);
+            a_file_attacks[rank][index] = attacks & BitBoard::FILEA;
+        }
+        subset = (subset - inner_file) & inner_file;
+    } while (subset);
+    return a_file_attacks;
+}();
+
+constinit const std::array<BitBoard, 64> Attacks::DIAGONAL_MASKS = [] {
+    std::array<BitBoard, 64> diagonal_masks{};
+    for (Square sq = Square::A1; sq <= Square::H8; ++sq) {
+        const auto bishop_rays = BitBoard(get_slider_attacks<false>(sq, 0));
+        for (Square to = Square::A1; to <= Square::H8; ++to) {
+            if (bishop_rays.is_set(to) && (to.file() - sq.file()) == (to.rank() - sq.rank()))
+                diagonal_masks[sq].set(to);
+        }
+    }
+    return diagonal_masks;
+}();
+
+constinit const std::array<BitBoard, 64> Attacks::ANTI_DIAGONAL_MASKS = [] {
+    std::array<BitBoard, 64> anti_diagonal_masks{};
+    for (Square sq = Square::A1; sq <= Square::H8; ++sq) {
+        const auto bishop_rays = BitBoard(get_slider_attacks<false>(sq, 0));
+        for (Square to = Square::A1; to <= Square::H8; ++to) {
+            if (bishop_rays.is_set(to) && (to.file() - sq.file()) != (to.rank() - sq.rank()))
+                anti_diagonal_masks[sq].set(to);
+        }
+    }
+    return anti_diagonal_masks;
+}();
+#else
+// the big tables go through a constexpr local, as gcc evaluates constinit initializers twice
+    #if defined(CHESS_USE_PEXT) || defined(CHESS_RUNTIME_PEXT)
+constinit const std::array<u64, 5248> Attacks::BISHOP_ATTACKS = [] {
+    constexpr auto bishop_attacks = generate_pext_attacks<false, 5248>();
+    return bishop_attacks;
+}();
+
+constinit const std::array<u64, 102400> Attacks::ROOK_ATTACKS = [] {
+    constexpr auto rook_attacks = generate_pext_attacks<true, 102400>();
+    return rook_attacks;
+}();
+    #endif
+
+    #ifndef CHESS_USE_PEXT
+constinit const std::array<u64, 88507> Attacks::BR_ATTACKS = [] {
+    constexpr auto br_attacks = generate_magic_attacks();
+    return br_attacks;
+}();
+    #endif
+
+constinit const std::array<Attacks::AttackEntry, 64> Attacks::BISHOP_TABLE = [] {
+    std::array<AttackEntry, 64> bishop_table{};
+    [[maybe_unused]] usize pext_offset = 0;
+    for (Square sq = Square::A1; sq <= Square::H8; ++sq) {
+        const BitBoard mask = get_slider_mask<false>(sq);
+    #ifdef CHESS_USE_PEXT
+        bishop_table[sq].mask = mask;
+        bishop_table[sq].attacks = BISHOP_ATTACKS.data() + pext_offset;
+    #else
+        bishop_table[sq].magic = BISHOP_MAGICS[sq].magic;
+        bishop_table[sq].negmask = ~mask;
+        bishop_table[sq].attacks = BR_ATTACKS.data() + BISHOP_MAGICS[sq].offset;
+        #ifdef CHESS_RUNTIME_PEXT
+        bishop_table[sq].mask = mask;
+        bishop_table[sq].pext_attacks = BISHOP_ATTACKS.data() + pext_offset;
+        #endif
+    #endif
+        pext_offset += usize(1) << mask.count();
+    }
+    return bishop_table;
+}();
+
+constinit const std::array<Attacks::AttackEntry, 64> Attacks::ROOK_TABLE = [] {
+    std::array<AttackEntry, 64> rook_table{};
+    [[maybe_unused]] usize pext_offset = 0;
+    for (Square sq = Square::A1; sq <= Square::H8; ++sq) {
+        const BitBoard mask = get_slider_mask<true>(sq);
+    #ifdef CHESS_USE_PEXT
+        rook_table[sq].mask = mask;
+        rook_table[sq].attacks = ROOK_ATTACKS.data() + pext_offset;
+    #else
+        rook_table[sq].magic = ROOK_MAGICS[sq].magic;
+        rook_table[sq].negmask = ~mask;
+        rook_table[sq].attacks = BR_ATTACKS.data() + ROOK_MAGICS[sq].offset;
+        #ifdef CHESS_RUNTIME_PEXT
+        rook_table[sq].mask = mask;
+        rook_table[sq].pext_attacks = ROOK_ATTACKS.data() + pext_offset;
+        #endif
+    #endif
+        pext_offset += usize(1) << mask.count();
+    }
+    return rook_table;
+}();
+
+    #ifdef CHESS_RUNTIME_PEXT
+// cpu detection and timing can only happen at runtime, so this is the one dynamic initializer.
+// Lookups made before it runs use the magic tables, which are already complete
+const bool Attacks::SLIDER_LOOKUP_SELECTED = [] {
+    __builtin_cpu_init();
+    has_pext_ = __builtin_cpu_supports("bmi2");
+    benchmark_slider_lookups();
+    return true;
+}();
+    #endif
+#endif
+
+constinit const MultiArray<BitBoard, 64, 64> Attacks::SQUARES_BETWEEN = [] {
+    MultiArray<BitBoard, 64, 64> squares_between{};
+    for (i32 dir = 0; dir < 8; dir++) {
+        for (Square sq1 = Square::A1; sq1 <= Square::H8; sq1++) {
+            // the ray from sq1 minus the ray from sq2 leaves the squares between them and sq2
+            BitBoard ray = RAYS[dir][sq1];
+            while (ray) {
+                const i32 sq2 = ray.poplsb();
+                squares_between[sq1][sq2] = RAYS[dir][sq1] & ~RAYS[dir][sq2];
+            }
+        }
+    }
+
+    for (Square sq1 = Square::A1; sq1 <= Square::H8; sq1++) {
+        for (Square sq2 = Square::A1; sq2 <= Square::H8; sq2++) squares_between[sq1][sq2].set(sq2);
+    }
+    return squares_between;
+}();
+}  // namespace chess
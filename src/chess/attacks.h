@@ -3,168 +3,67 @@
 #ifdef CHESS_USE_PEXT
     #include <immintrin.h>
 #endif
+#ifdef CHESS_RUNTIME_PEXT
+    #include <algorithm>
+    #include <chrono>
+#endif
+#if defined(CHESS_KINDERGARTEN) && (defined(CHESS_USE_PEXT) || defined(CHESS_RUNTIME_PEXT))
+    #error "CHESS_KINDERGARTEN replaces the pext and magic slider tables"
+#endif
 
 
 
 namespace chess {
 class Attacks {
+public:
+    enum class SliderLookup : u8 { AUTO, PEXT, MAGIC };
+
+    struct SliderTimings {
+        f64 pext_ns;   // ns per lookup with pext, 0 if not measured
+        f64 magic_ns;  // ns per lookup with magics, 0 if not measured
+    };
+
 private:
-#ifdef CHESS_USE_PEXT
+#if defined(CHESS_KINDERGARTEN)
+    // kindergarten tables, ~9KB instead of the ~700KB-1.5MB of the magic and pext tables
+    static const MultiArray<u8, 64, 8> FIRST_RANK_ATTACKS;      // [inner occupancy of rank][file]
+    static const MultiArray<BitBoard, 8, 64> FILL_UP_ATTACKS;  // [file][inner occupancy]
+    static const MultiArray<BitBoard, 8, 64> A_FILE_ATTACKS;   // [rank][inner occupancy]
+    static const std::array<BitBoard, 64> DIAGONAL_MASKS;       // a1-h8, excluding the square
+    static const std::array<BitBoard, 64> ANTI_DIAGONAL_MASKS;  // h1-a8, excluding the square
+
+    static constexpr u64 FILE_B = 0x0202020202020202ULL;
+    static constexpr u64 DIAGONAL_C7H2 = 0x0004081020408000ULL;
+#elif defined(CHESS_USE_PEXT)
     struct AttackEntry {
-        BitBoard mask;      // mask
-        BitBoard* attacks;  // BR_ATTACKS + offset
+        BitBoard mask;       // mask
+        const u64* attacks;  // BISHOP/ROOK_ATTACKS + offset
     };
 
-    static inline BitBoard BISHOP_ATTACKS[5248] = {};
-    static inline BitBoard ROOK_ATTACKS[102400] = {};
+    static const std::array<u64, 5248> BISHOP_ATTACKS;
+    static const std::array<u64, 102400> ROOK_ATTACKS;
 #else
     struct AttackEntry {
-        u64 magic;          // black magic
-        BitBoard negmask;   // negated mask
-        BitBoard* attacks;  // BR_ATTACKS + offset
+        u64 magic;           // black magic
+        BitBoard negmask;    // negated mask
+        const u64* attacks;  // BR_ATTACKS + offset
+    #ifdef CHESS_RUNTIME_PEXT
+        BitBoard mask;            // mask
+        const u64* pext_attacks;  // BISHOP/ROOK_ATTACKS + offset
+    #endif
     };
 
-    struct Magic {
-        u64 magic;
-        u32 offset;
-    };
-
-    static inline BitBoard BR_ATTACKS[88507] = {};
-
-    // black magics found by Volker Annuss https://talkchess.com/forum/viewtopic.php?t=64790
-    static constexpr Magic BISHOP_MAGICS[64] = {
-        {0x107ac08050500bffULL, 66157},
-        {0x7fffdfdfd823fffdULL, 71730},
-        {0x0400c00fe8000200ULL, 37781},
-        {0x103f802004000000ULL, 21015},
-        {0xc03fe00100000000ULL, 47590},
-        {0x24c00bffff400000ULL, 835  },
-        {0x0808101f40007f04ULL, 23592},
-        {0x100808201ec00080ULL, 30599},
-        {0xffa2feffbfefb7ffULL, 68776},
-        {0x083e3ee040080801ULL, 19959},
-        {0x040180bff7e80080ULL, 21783},
-        {0x0440007fe0031000ULL, 64836},
-        {0x2010007ffc000000ULL, 23417},
-        {0x1079ffe000ff8000ULL, 66724},
-        {0x7f83ffdfc03fff80ULL, 74542},
-        {0x080614080fa00040ULL, 67266},
-        {0x7ffe7fff817fcff9ULL, 26575},
-        {0x7ffebfffa01027fdULL, 67543},
-        {0x20018000c00f3c01ULL, 24409},
-        {0x407e0001000ffb8aULL, 30779},
-        {0x201fe000fff80010ULL, 17384},
-        {0xffdfefffde39ffefULL, 18778},
-        {0x7ffff800203fbfffULL, 65109},
-        {0x7ff7fbfff8203fffULL, 20184},
-        {0x000000fe04004070ULL, 38240},
-        {0x7fff7f9fffc0eff9ULL, 16459},
-        {0x7ffeff7f7f01f7fdULL, 17432},
-        {0x3f6efbbf9efbffffULL, 81040},
-        {0x0410008f01003ffdULL, 84946},
-        {0x20002038001c8010ULL, 18276},
-        {0x087ff038000fc001ULL, 8512 },
-        {0x00080c0c00083007ULL, 78544},
-        {0x00000080fc82c040ULL, 19974},
-        {0x000000407e416020ULL, 23850},
-        {0x00600203f8008020ULL, 11056},
-        {0xd003fefe04404080ULL, 68019},
-        {0x100020801800304aULL, 85965},
-        {0x7fbffe700bffe800ULL, 80524},
-        {0x107ff00fe4000f90ULL, 38221},
-        {0x7f8fffcff1d007f8ULL, 64647},
-        {0x0000004100f88080ULL, 61320},
-        {0x00000020807c4040ULL, 67281},
-        {0x00000041018700c0ULL, 79076},
-        {0x0010000080fc4080ULL, 17115},
-        {0x1000003c80180030ULL, 50718},
-        {0x2006001cf00c0018ULL, 24659},
-        {0xffffffbfeff80fdcULL, 38291},
-        {0x000000101003f812ULL, 30605},
-        {0x0800001f40808200ULL, 37759},
-        {0x084000101f3fd208ULL, 4639 },
-        {0x080000000f808081ULL, 21759},
-        {0x0004000008003f80ULL, 67799},
-        {0x08000001001fe040ULL, 22841},
-        {0x085f7d8000200a00ULL, 66689},
-        {0xfffffeffbfeff81dULL, 62548},
-        {0xffbfffefefdff70fULL, 66597},
-        {0x100000101ec10082ULL, 86749},
-        {0x7fbaffffefe0c02fULL, 69558},
-        {0x7f83fffffff07f7fULL, 61589},
-        {0xfff1fffffff7ffc1ULL, 62533},
-        {0x0878040000ffe01fULL, 64387},
-        {0x005d00000120200aULL, 26581},
-        {0x0840800080200fdaULL, 76355},
-        {0x100000c05f582008ULL, 11140}
-    };
-
-    static constexpr Magic ROOK_MAGICS[64] = {
-        {0x80280013ff84ffffULL, 10890},
-        {0x5ffbfefdfef67fffULL, 56054},
-        {0xffeffaffeffdffffULL, 67495},
-        {0x003000900300008aULL, 72797},
-        {0x0030018003500030ULL, 17179},
-        {0x0020012120a00020ULL, 63978},
-        {0x0030006000c00030ULL, 56650},
-        {0xffa8008dff09fff8ULL, 15929},
-        {0x7fbff7fbfbeafffcULL, 55905},
-        {0x0000140081050002ULL, 26301},
-        {0x0000180043800048ULL, 78100},
-        {0x7fffe800021fffb8ULL, 86245},
-        {0xffffcffe7fcfffafULL, 75228},
-        {0x00001800c0180060ULL, 31661},
-        {0xffffe7ff8fbfffe8ULL, 38053},
-        {0x0000180030620018ULL, 37433},
-        {0x00300018010c0003ULL, 74747},
-        {0x0003000c0085ffffULL, 53847},
-        {0xfffdfff7fbfefff7ULL, 70952},
-        {0x7fc1ffdffc001fffULL, 49447},
-        {0xfffeffdffdffdfffULL, 62629},
-        {0x7c108007befff81fULL, 58996},
-        {0x20408007bfe00810ULL, 36009},
-        {0x0400800558604100ULL, 21230},
-        {0x0040200010080008ULL, 51882},
-        {0x0010020008040004ULL, 11841},
-        {0xfffdfefff7fbfff7ULL, 25794},
-        {0xfebf7dfff8fefff9ULL, 49689},
-        {0xc00000ffe001ffe0ULL, 63400},
-        {0x2008208007004007ULL, 33958},
-        {0xbffbfafffb683f7fULL, 21991},
-        {0x0807f67ffa102040ULL, 45618},
-        {0x200008e800300030ULL, 70134},
-        {0x0000008780180018ULL, 75944},
-        {0x0000010300180018ULL, 68392},
-        {0x4000008180180018ULL, 66472},
-        {0x008080310005fffaULL, 23236},
-        {0x4000188100060006ULL, 19067},
-        {0xffffff7fffbfbfffULL, 0    },
-        {0x0000802000200040ULL, 43566},
-        {0x20000202ec002800ULL, 29810},
-        {0xfffff9ff7cfff3ffULL, 65558},
-        {0x000000404b801800ULL, 77684},
-        {0x2000002fe03fd000ULL, 73350},
-        {0xffffff6ffe7fcffdULL, 61765},
-        {0xbff7efffbfc00fffULL, 49282},
-        {0x000000100800a804ULL, 78840},
-        {0xfffbffefa7ffa7feULL, 82904},
-        {0x0000052800140028ULL, 24594},
-        {0x00000085008a0014ULL, 9513 },
-        {0x8000002b00408028ULL, 29012},
-        {0x4000002040790028ULL, 27684},
-        {0x7800002010288028ULL, 27901},
-        {0x0000001800e08018ULL, 61477},
-        {0x1890000810580050ULL, 25719},
-        {0x2003d80000500028ULL, 50020},
-        {0xfffff37eefefdfbeULL, 41547},
-        {0x40000280090013c1ULL, 4750 },
-        {0xbf7ffeffbffaf71fULL, 6014 },
-        {0xfffdffff777b7d6eULL, 41529},
-        {0xeeffffeff0080bfeULL, 84192},
-        {0xafe0000fff780402ULL, 33433},
-        {0xee73fffbffbb77feULL, 8555 },
-        {0x0002000308482882ULL, 1009 }
-    };
+    #ifdef CHESS_RUNTIME_PEXT
+    // pext tables, used instead of the magic tables if the cpu supports bmi2 and pext is fast
+    static const std::array<u64, 5248> BISHOP_ATTACKS;
+    static const std::array<u64, 102400> ROOK_ATTACKS;
+    static inline bool use_pext_ = false;
+    static inline bool has_pext_ = false;
+    static inline SliderTimings timings_ = {};
+    static const bool SLIDER_LOOKUP_SELECTED;  // set once bmi2 is detected and lookups are timed
+    #endif
+
+    static const std::array<u64, 88507> BR_ATTACKS;
 #endif
 
     // clang-format off
@@ -245,11 +144,15 @@ private:
            0x0203000000000000, 0x0507000000000000, 0x0A0E000000000000, 0x141C000000000000,
            0x2838000000000000, 0x5070000000000000, 0xA0E0000000000000, 0x40C0000000000000};
 
+    // the slider tables are generated at compile time in attacks.cpp, so they are stored fully
+    // initialized in the executable instead of being filled in at startup
+#ifndef CHESS_KINDERGARTEN
     // pre-calculated lookup table for bishop attacks
-    static inline AttackEntry BISHOP_TABLE[64] = {};
+    static const std::array<AttackEntry, 64> BISHOP_TABLE;
 
     // pre-calculated lookup table for rook attacks
-    static inline AttackEntry ROOK_TABLE[64] = {};
+    static const std::array<AttackEntry, 64> ROOK_TABLE;
+#endif
 
     // pre-calculated lookup table of ray between squares from (exclusive) and to (inclusive)
     static const MultiArray<BitBoard, 64, 64> SQUARES_BETWEEN;
@@ -273,23 +176,46 @@ public:
     [[nodiscard]] static BitBoard knight(Square sq) { return KNIGHT_ATTACKS[sq]; }
 
     [[nodiscard]] static BitBoard bishop(Square sq, BitBoard occupied) {
+#ifdef CHESS_KINDERGARTEN
+        return kindergarten_line(sq, occupied, DIAGONAL_MASKS[sq])
+               | kindergarten_line(sq, occupied, ANTI_DIAGONAL_MASKS[sq]);
+#else
         const auto& entry = BISHOP_TABLE[sq];
-#ifdef CHESS_USE_PEXT
+    #ifdef CHESS_USE_PEXT
         u64 index = _pext_u64(static_cast<u64>(occupied), static_cast<u64>(entry.mask));
-#else
+    #else
+        #ifdef CHESS_RUNTIME_PEXT
+        if (use_pext_) return entry.pext_attacks[pext(occupied, entry.mask)];
+        #endif
         u64 index = (static_cast<u64>(occupied | entry.negmask) * entry.magic) >> 55;
-#endif
+    #endif
         return entry.attacks[index];
+#endif
     }
 
     [[nodiscard]] static BitBoard rook(Square sq, BitBoard occupied) {
+#ifdef CHESS_KINDERGARTEN
+        // rank: shift the inner squares of the rank down to index the first rank attacks
+        const i32 rank_shift = sq.rank() * 8;
+        const u64 rank_occ = (static_cast<u64>(occupied) >> (rank_shift + 1)) & 63;
+        const u64 rank_attacks = u64(FIRST_RANK_ATTACKS[rank_occ][sq.file()]) << rank_shift;
+
+        // file: shift the file to file a and gather its inner squares into the top bits
+        const u64 file_occ = (static_cast<u64>(occupied) >> sq.file()) & BitBoard::FILEA;
+        const u64 index = (file_occ * DIAGONAL_C7H2) >> 58;
+        return (A_FILE_ATTACKS[sq.rank()][index] << sq.file()) | rank_attacks;
+#else
         const auto& entry = ROOK_TABLE[sq];
-#ifdef CHESS_USE_PEXT
+    #ifdef CHESS_USE_PEXT
         u64 index = _pext_u64(static_cast<u64>(occupied), static_cast<u64>(entry.mask));
-#else
+    #else
+        #ifdef CHESS_RUNTIME_PEXT
+        if (use_pext_) return entry.pext_attacks[pext(occupied, entry.mask)];
+        #endif
         u64 index = (static_cast<u64>(occupied | entry.negmask) * entry.magic) >> 52;
-#endif
+    #endif
         return entry.attacks[index];
+#endif
     }
 
     [[nodiscard]] static BitBoard queen(Square sq, BitBoard occupied) {
@@ -311,120 +237,137 @@ public:
         if constexpr (pt == PieceType::QUEEN) return queen(sq, occupied);
     }
 
-private:
-    static void init_attacks() {
-#ifdef CHESS_USE_PEXT
-        i32 bishop_offset = 0;
-        i32 rook_offset = 0;
-#endif
-
-        for (Square sq = Square::A1; sq <= Square::H8; ++sq) {
-            const BitBoard edges
-                = ((BitBoard(BitBoard::RANK1 | BitBoard::RANK8)) & ~BitBoard::from_rank(sq.rank()))
-                  | ((BitBoard(BitBoard::FILEA | BitBoard::FILEH))
-                     & ~BitBoard::from_file(sq.file()));
-
-            // bishop
-            BitBoard mask = get_slider_attacks<false>(sq, 0) & ~edges;
-#ifdef CHESS_USE_PEXT
-            BISHOP_TABLE[sq].mask = mask;
-            BitBoard* attacks = &BISHOP_ATTACKS[bishop_offset];
-            BISHOP_TABLE[sq].attacks = attacks;
-            bishop_offset += (u64(1) << mask.count());
+    /** Returns whether slider lookups use pext
+     *
+     * \returns whether pext is used
+     */
+    [[nodiscard]] static bool uses_pext() {
+#if defined(CHESS_USE_PEXT)
+        return true;
+#elif defined(CHESS_RUNTIME_PEXT)
+        return use_pext_;
 #else
-            BISHOP_TABLE[sq].magic = BISHOP_MAGICS[sq].magic;
-            BISHOP_TABLE[sq].negmask = ~mask;
-            BitBoard* attacks = &BR_ATTACKS[BISHOP_MAGICS[sq].offset];
-            BISHOP_TABLE[sq].attacks = attacks;
+        return false;
 #endif
+    }
 
-            BitBoard subset = 0;
-            do {
-#ifdef CHESS_USE_PEXT
-                u64 index = _pext_u64(static_cast<u64>(subset), static_cast<u64>(mask));
+    /** Returns the name of the slider lookup method in use
+     *
+     * \returns kindergarten, pext, or magic
+     */
+    [[nodiscard]] static const char* slider_lookup_name() {
+#ifdef CHESS_KINDERGARTEN
+        return "kindergarten";
 #else
-                u64 index = (static_cast<u64>(subset | ~mask) * BISHOP_MAGICS[sq].magic) >> 55;
+        return (uses_pext()) ? "pext" : "magic";
 #endif
-                attacks[index] = get_slider_attacks<false>(sq, subset);
-                subset = (subset - mask) & mask;
-            } while (subset);
-
+    }
 
-            // rook
-            mask = get_slider_attacks<true>(sq, 0) & ~edges;
-#ifdef CHESS_USE_PEXT
-            ROOK_TABLE[sq].mask = mask;
-            attacks = &ROOK_ATTACKS[rook_offset];
-            ROOK_TABLE[sq].attacks = attacks;
-            rook_offset += (u64(1) << mask.count());
+    /** Selects how slider attacks are looked up. Only builds with CHESS_RUNTIME_PEXT can switch,
+     * other builds are fixed to one method at compile time
+     *
+     * \param lookup method to use, AUTO picks the faster one in the startup benchmark
+     * \returns whether pext is used, false if pext was requested but bmi2 is unsupported
+     */
+    static bool set_slider_lookup(SliderLookup lookup) {
+#ifdef CHESS_RUNTIME_PEXT
+        if (lookup == SliderLookup::AUTO)
+            use_pext_ = has_pext_ && timings_.pext_ns < timings_.magic_ns;
+        else
+            use_pext_ = has_pext_ && lookup == SliderLookup::PEXT;
 #else
-            ROOK_TABLE[sq].magic = ROOK_MAGICS[sq].magic;
-            ROOK_TABLE[sq].negmask = ~mask;
-            attacks = &BR_ATTACKS[ROOK_MAGICS[sq].offset];
-            ROOK_TABLE[sq].attacks = attacks;
+        (void)lookup;
 #endif
+        return uses_pext();
+    }
 
-            subset = 0;
-            do {
-#ifdef CHESS_USE_PEXT
-                u64 index = _pext_u64(static_cast<u64>(subset), static_cast<u64>(mask));
+    /** Returns the slider lookup latencies measured at startup, to choose between pext and magics
+     * on cpus where pext is microcoded
+     *
+     * \returns the measured timings, zeroes if nothing was measured
+     */
+    [[nodiscard]] static SliderTimings slider_timings() {
+#ifdef CHESS_RUNTIME_PEXT
+        return timings_;
 #else
-                u64 index = (static_cast<u64>(subset | ~mask) * ROOK_MAGICS[sq].magic) >> 52;
+        return {};
 #endif
-                attacks[index] = get_slider_attacks<true>(sq, subset);
-                subset = (subset - mask) & mask;
-            } while (subset);
-        }
     }
 
-    template <bool is_rook>
-    [[nodiscard]] static BitBoard get_slider_attacks(Square sq, BitBoard occupied) {
-        static constexpr i32 dirs[2][4][2] = {
-            {{1, 1}, {1, -1}, {-1, -1}, {-1, 1}}, // bishops
-            {{1, 0}, {0, -1}, {-1, 0},  {0, 1} }  // rooks
-        };
-
-        i32 f0 = sq.file();
-        i32 r0 = sq.rank();
-
-        BitBoard attacks = 0;
-        for (i32 i = 0; i < 4; i++) {
-            const i32 df = dirs[is_rook][i][0];
-            const i32 dr = dirs[is_rook][i][1];
-
-            i32 f;
-            i32 r;
-            for (f = f0 + df, r = r0 + dr; f >= 0 && f < 8 && r >= 0 && r < 8; f += df, r += dr) {
-                const auto index = Square(static_cast<File>(f), static_cast<Rank>(r));
-                attacks.set(index);
-                if (occupied.is_set(index)) break;
-            }
-        }
-
-        return attacks;
+private:
+#ifdef CHESS_RUNTIME_PEXT
+    /** Extracts the bits of src selected by mask with the bmi2 pext instruction. Written in asm so
+     * it can be inlined without compiling the rest of the code for bmi2
+     *
+     * \param src bits to extract from
+     * \param mask bits to extract
+     * \returns the extracted bits
+     */
+    [[nodiscard]] static u64 pext(BitBoard src, BitBoard mask) {
+        u64 res;
+        asm("pextq %2, %1, %0" : "=r"(res) : "r"(static_cast<u64>(src)), "r"(static_cast<u64>(mask))
+        );
+        return res;
     }
-};
-
-
-inline const MultiArray<BitBoard, 64, 64> Attacks::SQUARES_BETWEEN = [] {
-    init_attacks();
 
-    MultiArray<BitBoard, 64, 64> squares_between{};
-    for (Square sq1 = Square::A1; sq1 <= Square::H8; sq1++) {
-        const BitBoard sq1bb = BitBoard::from_square(sq1);
-
-        for (Square sq2 = Square::A1; sq2 <= Square::H8; sq2++) {
-            const BitBoard sq2bb = BitBoard::from_square(sq2);
-
-            const bool bishop_sees = bishop(sq1, 0).is_set(sq2);
-            if (bishop_sees) squares_between[sq1][sq2] = bishop(sq1, sq2bb) & bishop(sq2, sq1bb);
+    /** Measures the latency of dependent bishop and rook lookups with the current method
+     *
+     * \returns ns per lookup
+     */
+    [[nodiscard]] static f64 time_slider_lookups() {
+        namespace ch = std::chrono;
+        constexpr i32 N_LOOKUPS = 1 << 14;
+
+        u64 seed = 0x9E3779B97F4A7C15ULL;  // xorshift, fixed so both methods see the same boards
+        u64 acc = 0;
+        const auto start_t = ch::steady_clock::now();
+        for (i32 i = 0; i < N_LOOKUPS; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+
+            // feed each result into the next occupancy to measure latency, not throughput
+            const auto occ = BitBoard((seed & (seed >> 11)) ^ (acc & 0x8100000000000081ULL));
+            acc ^= static_cast<u64>(bishop(Square(i & 63), occ));
+            acc ^= static_cast<u64>(rook(Square((i >> 6) & 63), occ ^ BitBoard(acc)));
+        }
+        const auto ns = ch::duration_cast<ch::nanoseconds>(ch::steady_clock::now() - start_t);
 
-            const bool rook_sees = rook(sq1, 0).is_set(sq2);
-            if (rook_sees) squares_between[sq1][sq2] = rook(sq1, sq2bb) & rook(sq2, sq1bb);
+        asm volatile("" : : "r"(acc));
+        return f64(ns.count()) / (2 * N_LOOKUPS);
+    }
 
-            squares_between[sq1][sq2].set(sq2);
+    /** Times pext and magic lookups and selects the faster, pext is microcoded and slow on some
+     * cpus with bmi2 (e.g., zen 1 and 2)
+     */
+    static void benchmark_slider_lookups() {
+        if (!has_pext_) return;
+
+        // best of a few interleaved rounds to filter out interrupts and frequency ramps
+        timings_ = {.pext_ns = 1e9, .magic_ns = 1e9};
+        for (i32 round = 0; round < 3; round++) {
+            use_pext_ = true;
+            timings_.pext_ns = std::min(timings_.pext_ns, time_slider_lookups());
+            use_pext_ = false;
+            timings_.magic_ns = std::min(timings_.magic_ns, time_slider_lookups());
         }
+        set_slider_lookup(SliderLookup::AUTO);
+    }
+#endif
+
+#ifdef CHESS_KINDERGARTEN
+    /** Looks up the attacks along a diagonal or anti-diagonal by gathering its inner squares into
+     * the top bits, where each file lands on its own bit
+     *
+     * \param sq square of the slider
+     * \param occupied occupied squares
+     * \param mask squares of the line through sq, excluding sq
+     * \returns the attacks along the line
+     */
+    [[nodiscard]] static BitBoard kindergarten_line(Square sq, BitBoard occupied, BitBoard mask) {
+        const u64 index = (static_cast<u64>(occupied & mask) * FILE_B) >> 58;
+        return FILL_UP_ATTACKS[sq.file()][index] & mask;
     }
-    return squares_between;
-}();
+#endif
+};
 }  // namespace chess
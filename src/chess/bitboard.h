@@ -16,7 +16,7 @@ public:
     constexpr BitBoard(u64 bits): bits_(bits) {}
 
     [[nodiscard]] explicit constexpr operator u64() const { return bits_; }
-    [[nodiscard]] explicit operator bool() const { return bits_ != 0; }
+    [[nodiscard]] explicit constexpr operator bool() const { return bits_ != 0; }
 
     [[nodiscard]] constexpr BitBoard operator&(BitBoard rhs) const { return bits_ & rhs.bits_; }
     [[nodiscard]] constexpr BitBoard operator|(BitBoard rhs) const { return bits_ | rhs.bits_; }
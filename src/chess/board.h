@@ -68,9 +68,47 @@ public:
         [[nodiscard]] static constexpr Side closest_side(File to, File from) {
             return to > from ? Side::KING_SIDE : Side::QUEEN_SIDE;
         }
+
+        [[nodiscard]] constexpr bool operator==(const CastlingRights&) const = default;
+    };
+
+    // state a move overwrites, recorded so unmake_move can restore it without copying the board
+    struct UndoInfo {
+        u64 hash;                         // zobrist hash
+        u64 pawn_hash;                    // zobrist hash of pawns
+        u64 major_hash;                   // zobrist hash of major pieces
+        u64 nonpawn_hash[2];              // zobrist hash of non-pawns per color
+        BitBoard threats;                 // attacked sqs by ntm
+#ifdef CHESS_COMPACT_BOARD
+        BitBoard pinmask;                 // pin rays of stm
+#else
+        std::array<BitBoard, 2> pinmask;  // pin rays per color
+#endif
+        CastlingRights castle_rights;     // allowed castling files
+        u8 halfmoves;                     // plies since last capture/pawn move
+        Square enpassant;                 // enpassant square
+        Piece captured;                   // piece captured on the move's to square, if any
     };
 
 private:
+#ifdef CHESS_COMPACT_BOARD
+    // compact layout, two cache lines: the mailbox, checkzones and castling paths are derived from
+    // the bitboards on demand and only the stm pinmask is kept, so copying a board is cheaper
+    std::array<BitBoard, 6> pieces_ = {};  // [048] 48  bitboard per piece type
+    std::array<BitBoard, 2> occ_ = {};     // [064] 16  bitboard per color
+    BitBoard threats_ = {};                // [072] 8   attacked sqs by ntm (xrays stm king)
+    BitBoard pinmask_ = {};                // [080] 8   pin rays of stm
+    u64 hash_ = 0;                         // [088] 8   zobrist hash
+    u64 pawn_hash_ = 0;                    // [096] 8   zobrist hash of pawns
+    u64 major_hash_ = 0;                   // [104] 8   zobrist hash of major pieces
+    u64 nonpawn_hash_[2] = {};             // [120] 16  zobrist hash of non-pawns per color
+    CastlingRights castle_rights_ = {};    // [128] 2   allowed castling files
+    u16 plies_ = 1;                        // [128] 2   number of plies
+    u8 halfmoves_ = 0;                     // [128] 1   plies since last capture/pawn move
+    Color stm_ = Color::WHITE;             // [128] 1   current stm
+    Square enpassant_ = Square::NONE;      // [128] 1   enpassant square
+    bool chess960_ = false;                // [128] 1   whether chess960 is enabled
+#else
     std::array<BitBoard, 6> pieces_ = {};          // [048] 48  bitboard per piece type
     std::array<BitBoard, 2> occ_ = {};             // [064] 16  bitboard per color
     std::array<Piece, 64> mailbox_ = {};           // [128] 64  piece on each square
@@ -88,6 +126,7 @@ private:
     Color stm_ = Color::WHITE;                     // [264] 1   current stm
     Square enpassant_ = Square::NONE;              // [264] 1   enpassant square
     bool chess960_ = false;                        // [264] 1   whether chess960 is enabled
+#endif
 
 
 public:
@@ -103,11 +142,27 @@ public:
     [[nodiscard]] BitBoard occ(Piece piece) const { return occ(piece.type(), piece.color()); }
     [[nodiscard]] BitBoard occ(Color color) const { return occ_[color]; }
 
+#ifdef CHESS_COMPACT_BOARD
+    [[nodiscard]] Piece at(Square sq) const {
+        const auto bb = BitBoard::from_square(sq);
+        if (!(occ() & bb)) return Piece::NONE;
+
+        const auto color = (occ_[Color::BLACK] & bb) ? Color::BLACK : Color::WHITE;
+        auto pt = PieceType(PieceType::PAWN);
+        while (!(pieces_[pt] & bb)) ++pt;
+        return Piece(pt, color);
+    }
+#else
     [[nodiscard]] Piece at(Square sq) const { return mailbox_[sq]; }
+#endif
 
     [[nodiscard]] CastlingRights castle_rights() const { return castle_rights_; }
     [[nodiscard]] BitBoard castle_path(Color color, bool is_king_side) const {
+#ifdef CHESS_COMPACT_BOARD
+        return compute_castle_path(color, is_king_side);
+#else
         return castle_path_[color][is_king_side];
+#endif
     }
     [[nodiscard]] Square enpassant_square() const { return enpassant_; }
 
@@ -122,6 +177,8 @@ public:
 
     [[nodiscard]] bool chess960() const { return chess960_; }
 
+    [[nodiscard]] bool operator==(const Board&) const = default;
+
     void set960(bool chess960) { chess960_ = chess960; }
 
 
@@ -191,8 +248,25 @@ public:
 
     [[nodiscard]] BitBoard threats() const { return threats_; }
 
-    [[nodiscard]] BitBoard pinned(Color color) const { return pinmask_[color] & occ(color); }
+    [[nodiscard]] BitBoard pinned(Color color) const { return pinmask(color) & occ(color); }
+
+#ifdef CHESS_COMPACT_BOARD
+    [[nodiscard]] BitBoard pinmask(Color color) const {
+        return (color == stm_) ? pinmask_ : compute_pinmask(color);
+    }
 
+    [[nodiscard]] BitBoard checkzones(PieceType pt) const {
+        assert(pt != PieceType::KING);
+        const auto king_sq = king_square(~stm_);
+        if (pt == PieceType::PAWN) return Attacks::pawn(king_sq, ~stm_);
+        if (pt == PieceType::KNIGHT) return Attacks::knight(king_sq);
+
+        BitBoard zones;
+        if (pt != PieceType::ROOK) zones |= Attacks::bishop(king_sq, occ());
+        if (pt != PieceType::BISHOP) zones |= Attacks::rook(king_sq, occ());
+        return zones;
+    }
+#else
     [[nodiscard]] BitBoard pinmask(Color color) const { return pinmask_[color]; }
 
     [[nodiscard]] BitBoard checkzones(PieceType pt) const {
@@ -201,6 +275,7 @@ public:
                    ? checkzones_[pt]
                    : checkzones_[PieceType::BISHOP] | checkzones_[PieceType::ROOK];
     }
+#endif
 
 
     [[nodiscard]] bool is_attacked(Square sq, Color color) const {
@@ -342,8 +417,7 @@ public:
         hash_ ^= Zobrist::stm();
         stm_ = ~stm_;
         threats_ = compute_threats();
-        pinmask_[Color::WHITE] = compute_pinmask(Color::WHITE);
-        pinmask_[Color::BLACK] = compute_pinmask(Color::BLACK);
+        update_pinmask();
         update_checkzones();
     }
 
@@ -355,6 +429,80 @@ public:
         plies_++;
         stm_ = ~stm_;
         threats_ = compute_threats();
+#ifdef CHESS_COMPACT_BOARD
+        pinmask_ = compute_pinmask(stm_);
+#endif
+        update_checkzones();
+    }
+
+    /** Plays a move, recording what unmake_move needs to take it back
+     *
+     * \param move move to play
+     * \param undo record to write the overwritten state to
+     */
+    void make_move(Move move, UndoInfo& undo) {
+        save_state(undo);
+        undo.captured = (move.type() == Move::CASTLING) ? Piece::NONE : at(move.to());
+        make_move(move);
+    }
+
+    /** Takes back the last move played with make_move(move, undo)
+     *
+     * \param move the move to take back
+     * \param undo record written when the move was played
+     */
+    void unmake_move(Move move, const UndoInfo& undo) {
+        stm_ = ~stm_;
+        plies_--;
+
+        // the hashes are restored from the record, so pieces are moved back without hashing
+        if (move.type() == Move::CASTLING) {
+            const bool is_king_side = move.to() > move.from();
+            const auto king = Piece(PieceType::KING, stm_);
+            const auto rook = Piece(PieceType::ROOK, stm_);
+
+            remove_piece<false>(king, Square::castling_king_dest(is_king_side, stm_));
+            remove_piece<false>(rook, Square::castling_rook_dest(is_king_side, stm_));
+
+            place_piece<false>(king, move.from());
+            place_piece<false>(rook, move.to());
+        } else if (move.type() == Move::PROMOTION) {
+            remove_piece<false>(at(move.to()), move.to());
+            place_piece<false>(Piece(PieceType::PAWN, stm_), move.from());
+        } else {
+            const auto piece = at(move.to());
+
+            remove_piece<false>(piece, move.to());
+            place_piece<false>(piece, move.from());
+        }
+
+        if (move.type() == Move::ENPASSANT)
+            place_piece<false>(Piece(PieceType::PAWN, ~stm_), move.to().ep_square());
+        else if (undo.captured != Piece::NONE)
+            place_piece<false>(undo.captured, move.to());
+
+        restore_state(undo);
+        update_checkzones();
+    }
+
+    /** Plays a nullmove, recording what unmake_nullmove needs to take it back
+     *
+     * \param undo record to write the overwritten state to
+     */
+    void make_nullmove(UndoInfo& undo) {
+        save_state(undo);
+        undo.captured = Piece::NONE;
+        make_nullmove();
+    }
+
+    /** Takes back the last nullmove played with make_nullmove(undo)
+     *
+     * \param undo record written when the nullmove was played
+     */
+    void unmake_nullmove(const UndoInfo& undo) {
+        stm_ = ~stm_;
+        plies_--;
+        restore_state(undo);
         update_checkzones();
     }
 
@@ -556,8 +704,7 @@ public:
         }
 
         threats_ = compute_threats();
-        pinmask_[Color::WHITE] = compute_pinmask(Color::WHITE);
-        pinmask_[Color::BLACK] = compute_pinmask(Color::BLACK);
+        update_pinmask();
         update_checkzones();
 
         // validate enpassant
@@ -571,26 +718,11 @@ public:
             if (!valid) enpassant_ = Square::NONE;
         }
 
-        // init castling_path
-        for (const Color color : {Color::WHITE, Color::BLACK}) {
-            const auto king_from = king_square(color);
-
-            for (const auto side :
-                 {CastlingRights::Side::KING_SIDE, CastlingRights::Side::QUEEN_SIDE})
-            {
-                if (!castle_rights_.has(color, side)) continue;
-
-                const bool is_king_side = (side == CastlingRights::Side::KING_SIDE);
-                const auto rook_from
-                    = Square(castle_rights_.get_rook_file(color, side), king_from.rank());
-                const auto king_to = Square::castling_king_dest(is_king_side, color);
-                const auto rook_to = Square::castling_rook_dest(is_king_side, color);
-
-                castle_path_[color][is_king_side]
-                    = (Attacks::between(rook_from, rook_to) | Attacks::between(king_from, king_to))
-                      & ~(BitBoard::from_square(king_from) | BitBoard::from_square(rook_from));
-            }
-        }
+#ifndef CHESS_COMPACT_BOARD
+        for (const Color color : {Color::WHITE, Color::BLACK})
+            for (const bool is_king_side : {false, true})
+                castle_path_[color][is_king_side] = compute_castle_path(color, is_king_side);
+#endif
 
         recompute_hash();
     }
@@ -727,12 +859,14 @@ private:
     void reset() {
         pieces_.fill(0);
         occ_.fill(0);
+#ifndef CHESS_COMPACT_BOARD
         mailbox_.fill(Piece::NONE);
+        castle_path_ = {};
+#endif
 
         threats_ = 0;
 
         castle_rights_.clear();
-        castle_path_ = {};
         enpassant_ = Square::NONE;
 
         stm_ = Color::WHITE;
@@ -747,8 +881,9 @@ private:
     }
 
 
+    template <bool UPDATE_HASH = true>
     void place_piece(Piece piece, Square sq) {
-        assert(mailbox_[sq] == Piece::NONE);
+        assert(at(sq) == Piece::NONE);
 
         auto pt = piece.type();
         auto color = piece.color();
@@ -758,13 +893,16 @@ private:
 
         pieces_[pt].set(sq);
         occ_[color].set(sq);
+#ifndef CHESS_COMPACT_BOARD
         mailbox_[sq] = piece;
+#endif
 
-        update_piece_hash(piece, sq);
+        if constexpr (UPDATE_HASH) update_piece_hash(piece, sq);
     }
 
+    template <bool UPDATE_HASH = true>
     void remove_piece(Piece piece, Square sq) {
-        assert(mailbox_[sq] == piece && piece != Piece::NONE);
+        assert(at(sq) == piece && piece != Piece::NONE);
 
         const auto pt = piece.type();
         const auto color = piece.color();
@@ -774,9 +912,38 @@ private:
 
         pieces_[pt].unset(sq);
         occ_[color].unset(sq);
+#ifndef CHESS_COMPACT_BOARD
         mailbox_[sq] = Piece::NONE;
+#endif
+
+        if constexpr (UPDATE_HASH) update_piece_hash(piece, sq);
+    }
+
+
+    void save_state(UndoInfo& undo) const {
+        undo.hash = hash_;
+        undo.pawn_hash = pawn_hash_;
+        undo.major_hash = major_hash_;
+        undo.nonpawn_hash[Color::WHITE] = nonpawn_hash_[Color::WHITE];
+        undo.nonpawn_hash[Color::BLACK] = nonpawn_hash_[Color::BLACK];
+        undo.threats = threats_;
+        undo.pinmask = pinmask_;
+        undo.castle_rights = castle_rights_;
+        undo.halfmoves = halfmoves_;
+        undo.enpassant = enpassant_;
+    }
 
-        update_piece_hash(piece, sq);
+    void restore_state(const UndoInfo& undo) {
+        hash_ = undo.hash;
+        pawn_hash_ = undo.pawn_hash;
+        major_hash_ = undo.major_hash;
+        nonpawn_hash_[Color::WHITE] = undo.nonpawn_hash[Color::WHITE];
+        nonpawn_hash_[Color::BLACK] = undo.nonpawn_hash[Color::BLACK];
+        threats_ = undo.threats;
+        pinmask_ = undo.pinmask;
+        castle_rights_ = undo.castle_rights;
+        halfmoves_ = undo.halfmoves;
+        enpassant_ = undo.enpassant;
     }
 
 
@@ -886,11 +1053,36 @@ private:
         return pin;
     }
 
+    [[nodiscard]] BitBoard compute_castle_path(Color color, bool is_king_side) const {
+        const auto side
+            = is_king_side ? CastlingRights::Side::KING_SIDE : CastlingRights::Side::QUEEN_SIDE;
+        if (!castle_rights_.has(color, side)) return 0;
+
+        const auto king_from = king_square(color);
+        const auto rook_from = Square(castle_rights_.get_rook_file(color, side), king_from.rank());
+        const auto king_to = Square::castling_king_dest(is_king_side, color);
+        const auto rook_to = Square::castling_rook_dest(is_king_side, color);
+
+        return (Attacks::between(rook_from, rook_to) | Attacks::between(king_from, king_to))
+               & ~(BitBoard::from_square(king_from) | BitBoard::from_square(rook_from));
+    }
+
+    void update_pinmask() {
+#ifdef CHESS_COMPACT_BOARD
+        pinmask_ = compute_pinmask(stm_);
+#else
+        pinmask_[Color::WHITE] = compute_pinmask(Color::WHITE);
+        pinmask_[Color::BLACK] = compute_pinmask(Color::BLACK);
+#endif
+    }
+
     void update_checkzones() {
+#ifndef CHESS_COMPACT_BOARD
         checkzones_[PieceType::PAWN] = Attacks::pawn(king_square(~stm_), ~stm_);
         checkzones_[PieceType::KNIGHT] = Attacks::knight(king_square(~stm_));
         checkzones_[PieceType::BISHOP] = Attacks::bishop(king_square(~stm_), occ());
         checkzones_[PieceType::ROOK] = Attacks::rook(king_square(~stm_), occ());
+#endif
     }
 
     void set_castling_rights(Color color, CastlingRights::Side side, File rook_file) {
@@ -920,5 +1112,11 @@ private:
     }
 };
 
+#ifdef CHESS_COMPACT_BOARD
+static_assert(sizeof(Board) == 128);
+static_assert(sizeof(Board::UndoInfo) == 64);
+#else
 static_assert(sizeof(Board) == 264);
+static_assert(sizeof(Board::UndoInfo) == 72);
+#endif
 }  // namespace chess
@@ -1,8 +1,10 @@
 #include <chess/include.h>
 
+#include <random>
 #include <tests/doctest/doctest.hpp>
 
 using namespace chess;
+using std::mt19937_64;
 
 
 
@@ -117,4 +119,56 @@ TEST_SUITE("Attacks") {
         CHECK(Attacks::between(Square::F1, Square::C4) == 0x4081000ULL);
         CHECK(Attacks::between(Square::F5, Square::C4) == 0x4000000ULL);
     }
+
+    TEST_CASE("Slider Reference") {
+        // walk the rays square by square and compare with the table lookups of this build
+        const auto slow_attacks = [](Square sq, BitBoard occ, bool is_rook) {
+            constexpr i32 dirs[2][4][2] = {
+                {{1, 1}, {1, -1}, {-1, -1}, {-1, 1}},
+                {{1, 0}, {0, -1}, {-1, 0},  {0, 1} }
+            };
+
+            BitBoard attacks = 0;
+            for (const auto& dir : dirs[is_rook]) {
+                i32 f = sq.file() + dir[0];
+                i32 r = sq.rank() + dir[1];
+                for (; f >= 0 && f < 8 && r >= 0 && r < 8; f += dir[0], r += dir[1]) {
+                    attacks.set(r * 8 + f);
+                    if (occ.is_set(r * 8 + f)) break;
+                }
+            }
+            return attacks;
+        };
+
+        mt19937_64 generator(0);
+        for (i32 i = 0; i < 16384; i++) {
+            const auto sq = Square(i & 63);
+            const auto occ = BitBoard(generator() & generator());
+
+            CHECK(Attacks::bishop(sq, occ) == slow_attacks(sq, occ, false));
+            CHECK(Attacks::rook(sq, occ) == slow_attacks(sq, occ, true));
+        }
+    }
+
+    TEST_CASE("Slider Lookup") {
+        mt19937_64 generator(0);
+        const bool pext = Attacks::uses_pext();
+
+        // both methods must agree wherever the build can switch between them
+        for (i32 i = 0; i < 4096; i++) {
+            const auto sq = Square(i & 63);
+            const auto occ = BitBoard(generator() & generator());
+
+            Attacks::set_slider_lookup(Attacks::SliderLookup::MAGIC);
+            const auto bishop = Attacks::bishop(sq, occ);
+            const auto rook = Attacks::rook(sq, occ);
+
+            Attacks::set_slider_lookup(Attacks::SliderLookup::PEXT);
+            CHECK(Attacks::bishop(sq, occ) == bishop);
+            CHECK(Attacks::rook(sq, occ) == rook);
+        }
+
+        Attacks::set_slider_lookup(Attacks::SliderLookup::AUTO);
+        CHECK(Attacks::uses_pext() == pext);
+    }
 }
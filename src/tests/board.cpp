@@ -1,8 +1,10 @@
 #include <chess/include.h>
 
+#include <random>
 #include <tests/doctest/doctest.hpp>
 
 using namespace chess;
+using std::mt19937_64;
 
 
 
@@ -101,6 +103,57 @@ TEST_SUITE("Board") {
         }
     }
 
+    TEST_CASE("Board unmake_move Round Trip") {
+        // castling, enpassant, promotions, and chess960 castling onto the rook's square
+        const auto fens = {
+            std::pair{Board::STARTPOS, false},
+            std::pair{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -", false},
+            std::pair{"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", false},
+            std::pair{"n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1", false},
+            std::pair{"bqnb1rkr/pp3ppp/3ppn2/2p5/5P2/P2P4/NPP1P1PP/BQ1BNRKR w HFhf - 2 9", true},
+            std::pair{"2r1kr2/8/8/8/8/8/8/1R2K1R1 w GBfc - 0 1", true},
+        };
+
+        mt19937_64 generator(0);
+        for (const auto& [fen, chess960] : fens) {
+            for (i32 game = 0; game < 20; game++) {
+                Board board(fen, chess960);
+                std::vector<Board> boards;
+                std::vector<Move> moves;
+                std::vector<Board::UndoInfo> undos;
+
+                // play random legal moves and nullmoves, then take them all back
+                for (i32 ply = 0; ply < 40; ply++) {
+                    MoveList<ScoredMove> movelist;
+                    Movegen::generate_legals(movelist, board);
+                    if (movelist.size() == 0) break;
+
+                    boards.push_back(board);
+                    undos.emplace_back();
+                    if (!board.in_check() && generator() % 8 == 0) {
+                        moves.push_back(Move::NO_MOVE);
+                        board.make_nullmove(undos.back());
+                    } else {
+                        moves.push_back(movelist[generator() % movelist.size()].move);
+                        board.make_move(moves.back(), undos.back());
+                    }
+                }
+
+                while (!moves.empty()) {
+                    if (moves.back() == Move::NO_MOVE)
+                        board.unmake_nullmove(undos.back());
+                    else
+                        board.unmake_move(moves.back(), undos.back());
+
+                    REQUIRE(board == boards.back());
+                    boards.pop_back();
+                    moves.pop_back();
+                    undos.pop_back();
+                }
+            }
+        }
+    }
+
     TEST_CASE("Board is_kingpawn") {
         Board board = Board("4k1n1/pppppppp/8/8/8/8/PPPPPPPP/4K3 w - - 0 1");
         CHECK(board.is_kingpawn(board.stm()));
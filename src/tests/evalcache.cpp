@@ -0,0 +1,51 @@
+#include <Raphael/EvalCache.h>
+
+#include <random>
+#include <tests/doctest/doctest.hpp>
+
+using raphael::EvalCache;
+using std::mt19937_64;
+
+
+
+TEST_SUITE("Eval Cache") {
+    TEST_CASE("Probe and Store") {
+        EvalCache cache(1);
+        i32 eval = 0;
+
+        // an empty cache misses, even for a zero key
+        CHECK_FALSE(cache.probe(0, eval));
+        CHECK_FALSE(cache.probe(0x123456789ABCDEF0ULL, eval));
+
+        cache.store(0x123456789ABCDEF0ULL, -1234);
+        REQUIRE(cache.probe(0x123456789ABCDEF0ULL, eval));
+        CHECK(eval == -1234);
+
+        // keys sharing a slot are told apart by the full key
+        const u64 other = 0x123456789ABCDEF1ULL;
+        CHECK_FALSE(cache.probe(other, eval));
+        cache.store(other, 42);
+        REQUIRE(cache.probe(other, eval));
+        CHECK(eval == 42);
+        CHECK_FALSE(cache.probe(0x123456789ABCDEF0ULL, eval));
+
+        cache.clear();
+        CHECK_FALSE(cache.probe(other, eval));
+    }
+
+    TEST_CASE("Resize") {
+        EvalCache cache(1);
+        mt19937_64 generator(0);
+        const u64 key = generator();
+
+        cache.store(key, 7);
+        cache.resize(2);
+        i32 eval;
+        CHECK_FALSE(cache.probe(key, eval));
+
+        cache.resize(0);
+        CHECK_FALSE(cache.enabled());
+        cache.resize(1);
+        CHECK(cache.enabled());
+    }
+}
@@ -0,0 +1,40 @@
+#include <Raphael/History.h>
+
+#include <memory>
+#include <tests/doctest/doctest.hpp>
+
+using chess::Move;
+using chess::Square;
+using raphael::History;
+using raphael::Position;
+using std::make_unique;
+
+
+
+TEST_SUITE("History") {
+    TEST_CASE("Clear") {
+        auto history = make_unique<History>();
+        auto position = make_unique<Position<true>>();
+        position->make_move(Move::make(Square::E2, Square::E4));
+
+        const auto knight = Move::make(Square::G8, Square::F6);
+        const auto other = Move::make(Square::B8, Square::C6);
+        history->update_quiet(knight, *position, 1000);
+        CHECK(history->get_conthist(knight, *position) > 0);
+        CHECK(history->get_quietscore(knight, *position) > 0);
+
+        // continuation entries from before the clear read as zero, even after writes to their block
+        history->clear();
+        CHECK(history->get_conthist(knight, *position) == 0);
+        CHECK(history->get_quietscore(knight, *position) == 0);
+        history->update_quiet(other, *position, 1000);
+        CHECK(history->get_conthist(other, *position) > 0);
+        CHECK(history->get_conthist(knight, *position) == 0);
+
+        // the generation wrapping around zeroes everything
+        history->update_quiet(knight, *position, 1000);
+        for (i32 i = 0; i < 256; i++) history->clear();
+        CHECK(history->get_conthist(knight, *position) == 0);
+        CHECK(history->get_conthist(other, *position) == 0);
+    }
+}
@@ -1,3 +1,4 @@
+#include <Raphael/commands.h>
 #include <chess/include.h>
 
 #include <chrono>
@@ -75,6 +76,18 @@ TEST_SUITE("PERFT") {
         }
     }
 
+    TEST_CASE("Threaded With Hash") {
+        // the perft command must agree with the plain count however the root moves are split
+        Board board("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+        CHECK(raphael::commands::perft(board, 4, 1, 0) == 4085603);
+        CHECK(raphael::commands::perft(board, 4, 4, 0) == 4085603);
+        CHECK(raphael::commands::perft(board, 4, 4, 1) == 4085603);
+
+        board.set960(true);
+        board.set_fen("1rqbkrbn/1ppppp1p/1n6/p1N3p1/8/2P4P/PP1PPPP1/1RQBKRBN w FBfb - 0 9");
+        CHECK(raphael::commands::perft(board, 5, 3, 1) == 8652810);
+    }
+
     TEST_CASE("Chess960") {
         const Test frc_test_positions[] = {
             {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w AHah - 0 1",           119060324ull,  6},
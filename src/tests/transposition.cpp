@@ -0,0 +1,219 @@
+#include <Raphael/Transposition.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <tests/doctest/doctest.hpp>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+using raphael::TranspositionTable;
+using std::fstream;
+using std::ios;
+using std::make_unique;
+using std::mt19937_64;
+using std::runtime_error;
+using std::vector;
+namespace fs = std::filesystem;
+
+
+
+TEST_SUITE("Transposition Table") {
+    TEST_CASE("Rehash") {
+        TranspositionTable tt(2);
+        mt19937_64 generator(0);
+
+        vector<u64> keys;
+        for (i32 i = 0; i < 2000; i++) {
+            keys.push_back(generator());
+            tt.set(
+                keys.back(), i, -i, chess::Move::NO_MOVE, i + 1, false, TranspositionTable::EXACT, 0
+            );
+        }
+
+        const auto count_hits = [&]() {
+            i32 hits = 0;
+            for (i32 i = 0; i < 2000; i++) {
+                TranspositionTable::ProbedEntry entry;
+                if (tt.get(entry, keys[i], 0) && entry.score == i && entry.static_eval == -i
+                    && entry.fdepth == i + 1)
+                    hits++;
+            }
+            return hits;
+        };
+        REQUIRE(count_hits() == 2000);
+
+        // growing and shrinking keeps all entries if there is room
+        tt.resize(5, 2, true);
+        CHECK(count_hits() == 2000);
+        tt.resize(1, 3, true);
+        CHECK(count_hits() == 2000);
+
+        // resizing without preserve clears the table
+        tt.resize(2, 1);
+        CHECK(count_hits() == 0);
+    }
+
+    TEST_CASE("Generations") {
+        TranspositionTable tt(1);
+        const u64 key = 0x123456789ABCDEF0ULL;
+        TranspositionTable::ProbedEntry entry;
+        i32 static_eval;
+
+        tt.set(key, 10, 20, chess::Move::NO_MOVE, 5, false, TranspositionTable::EXACT, 0);
+        tt.set_static_eval(key, 30);
+        REQUIRE(tt.get(entry, key, 0));
+        REQUIRE(tt.get_static_eval(key, static_eval));
+        CHECK(static_eval == 30);
+
+        // a new generation hides old entries, which can then be overwritten
+        tt.new_generation(1);
+        CHECK(!tt.get(entry, key, 0));
+        CHECK(!tt.get_static_eval(key, static_eval));
+        CHECK(tt.hashfull() == 0);
+
+        tt.set(key, 40, 50, chess::Move::NO_MOVE, 1, false, TranspositionTable::UPPER, 0);
+        REQUIRE(tt.get(entry, key, 0));
+        CHECK(entry.score == 40);
+        CHECK(entry.fdepth == 1);
+        CHECK(entry.flag == TranspositionTable::UPPER);
+
+        // wrapping around clears the table
+        for (i32 i = 0; i < 256; i++) tt.new_generation(1);
+        CHECK(!tt.get(entry, key, 0));
+    }
+
+    TEST_CASE("Save and Load") {
+        const auto path = (fs::temp_directory_path() / "raphael_tt_test.hash").string();
+        TranspositionTable tt(1);
+        mt19937_64 generator(0);
+
+        // entries are only counted by hashfull if they have the current age
+        tt.do_age();
+        vector<u64> keys;
+        for (i32 i = 0; i < 2000; i++) {
+            keys.push_back(generator());
+            tt.set(
+                keys.back(), i, -i, chess::Move::NO_MOVE, i + 1, false, TranspositionTable::EXACT, 0
+            );
+        }
+        const i32 hashfull = tt.hashfull();
+        REQUIRE(hashfull > 0);
+        tt.save(path, 2);
+
+        const auto count_hits = [&](const TranspositionTable& table) {
+            i32 hits = 0;
+            for (i32 i = 0; i < 2000; i++) {
+                TranspositionTable::ProbedEntry entry;
+                if (table.get(entry, keys[i], 0) && entry.score == i && entry.static_eval == -i
+                    && entry.fdepth == i + 1)
+                    hits++;
+            }
+            return hits;
+        };
+
+        SUBCASE("Same size") {
+            TranspositionTable loaded(1);
+            loaded.load(path, 2);
+            CHECK(count_hits(loaded) == 2000);
+            CHECK(loaded.hashfull() == hashfull);
+        }
+
+        // a rejected file leaves the table as it was
+        const u64 key = 0x123456789ABCDEF0ULL;
+        const auto check_rejected = [&](TranspositionTable& table) {
+            table.set(key, 10, 20, chess::Move::NO_MOVE, 5, false, TranspositionTable::EXACT, 0);
+            CHECK_THROWS_AS(table.load(path, 1), runtime_error);
+
+            TranspositionTable::ProbedEntry entry;
+            REQUIRE(table.get(entry, key, 0));
+            CHECK(entry.score == 10);
+            CHECK(count_hits(table) == 0);
+        };
+
+        SUBCASE("Different size") {
+            TranspositionTable other(2);
+            check_rejected(other);
+        }
+
+        SUBCASE("Corrupted header") {
+            const auto corrupt = [&](usize offset) {
+                fstream file(path, ios::in | ios::out | ios::binary);
+                file.seekp(offset);
+                file.put('\x7F');
+            };
+
+            SUBCASE("Magic") { corrupt(offsetof(TranspositionTable::FileHeader, magic)); }
+            SUBCASE("Layout") { corrupt(offsetof(TranspositionTable::FileHeader, entry_size)); }
+
+            TranspositionTable other(1);
+            check_rejected(other);
+        }
+
+        fs::remove(path);
+    }
+
+#ifndef _WIN32
+    TEST_CASE("Shared") {
+        const usize size = 1024 * 1024 / TranspositionTable::CLUSTER_SIZE;
+        const auto name = TranspositionTable::shared_name(size);
+        const auto segment_exists = [&]() {
+            const int fd = shm_open(name.c_str(), O_RDONLY, 0600);
+            if (fd >= 0) close(fd);
+            return fd >= 0;
+        };
+
+        {
+            auto first = make_unique<TranspositionTable>(1);
+            TranspositionTable second(1);
+            REQUIRE(first->set_shared(true, 1));
+            REQUIRE(second.set_shared(true, 1));
+
+            // entries stored through one table are seen through the other
+            mt19937_64 generator(0);
+            vector<u64> keys;
+            for (i32 i = 0; i < 2000; i++) {
+                keys.push_back(generator());
+                first->set(
+                    keys.back(), i, -i, chess::Move::NO_MOVE, i + 1, false,
+                    TranspositionTable::EXACT, 0
+                );
+            }
+            TranspositionTable::ProbedEntry entry;
+            REQUIRE(second.get(entry, keys[0], 0));
+            CHECK(entry.score == 0);
+            CHECK(entry.fdepth == 1);
+
+            // the age is shared too, so entries from the other process don't look stale
+            const i32 hashfull = first->hashfull();
+            REQUIRE(hashfull > 0);
+            CHECK(second.hashfull() == hashfull);
+            second.do_age();
+            CHECK(first->hashfull() == 0);
+
+            // a table in use elsewhere is neither wiped nor overwritten
+            second.clear(1);
+            CHECK(second.get(entry, keys[0], 0));
+
+            const auto path = (fs::temp_directory_path() / "raphael_tt_shared.hash").string();
+            first->save(path, 1);
+            CHECK_THROWS_AS(second.load(path, 1), runtime_error);
+            fs::remove(path);
+
+            // the segment is removed by the last table to detach
+            first.reset();
+            CHECK(segment_exists());
+            second.clear(1);
+            CHECK_FALSE(second.get(entry, keys[0], 0));
+        }
+        CHECK_FALSE(segment_exists());
+    }
+#endif
+}
@@ -5,6 +5,7 @@
 #include <Raphael/wdl.h>
 
 #include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -45,14 +46,22 @@ inline void handle_setoption(const vector<string>& tokens) {
         return;
     }
 
-    if (tokens.size() != 5 || tokens[1] != "name" || tokens[3] != "value") {
+    if (tokens.size() < 5 || tokens[1] != "name" || tokens[3] != "value") {
         cout << "info string usage: setoption name <NAME> value <VALUE>\n" << flush;
         return;
     }
 
+    // values may contain spaces (e.g., file paths)
+    string value_str = tokens[4];
+    for (usize i = 5; i < tokens.size(); i++) value_str += " " + tokens[i];
+
+    // these options respawn the search threads, so the position must be set again
+    for (const auto name : {"Threads", "NumaAffinity", "EvalFile", "SmallEvalFile", "NetHugePages"})
+        if (raphael::utils::is_case_insensitive_equals(tokens[2], name)) position_ready = false;
+
     // check option
-    if (tokens[4] == "true" || tokens[4] == "false") {
-        const bool value = (tokens[4][0] == 't');
+    if (value_str == "true" || value_str == "false") {
+        const bool value = (value_str[0] == 't');
 
         // UCI_Chess960
         if (raphael::utils::is_case_insensitive_equals(tokens[2], "UCI_Chess960")) chess960 = value;
@@ -62,11 +71,16 @@ inline void handle_setoption(const vector<string>& tokens) {
     }
 
     // spin option
-    i32 value;
+    i32 value = 0;
+    usize end = 0;
     try {
-        value = stoi(tokens[4]);
+        value = stoi(value_str, &end);
     } catch (const exception& e) {
-        cout << "info string value must either be a bool or an int\n" << flush;
+    }
+
+    // string or combo option
+    if (end != value_str.size()) {
+        engine.set_option(tokens[2], value_str);
         return;
     }
 
@@ -119,6 +133,53 @@ inline void handle_position(const vector<string>& tokens) {
     position_ready = false;
 }
 
+/** Handles the perft command
+ * E.g., perft {depth} threads {threads} hash {hash}, or go perft {depth} ...
+ *
+ * \param tokens list of tokens for the command
+ * \param start index of the depth token
+ */
+inline void handle_perft(const vector<string>& tokens, usize start) {
+    if (!engine.is_search_complete()) {
+        cout << "info string still searching\n" << flush;
+        return;
+    }
+
+    if (tokens.size() <= start) {
+        cout << "info string missing required positional parameter 'depth'\n" << flush;
+        return;
+    }
+
+    const i32 depth = stoi(tokens[start]);
+    i32 threads = 1;
+    i32 hash = 0;
+
+    usize i = start + 1;
+    while (i + 1 < tokens.size()) {
+        if (tokens[i] == "threads")
+            threads = stoi(tokens[i + 1]);
+        else if (tokens[i] == "hash")
+            hash = stoi(tokens[i + 1]);
+        i += 2;
+    }
+
+    if (depth <= 0) {
+        cout << "info string depth must be positive\n" << flush;
+        return;
+    }
+    if (threads <= 0) {
+        cout << "info string threads must be positive\n" << flush;
+        return;
+    }
+    if (hash < 0 || hash > raphael::PERFT_MAX_HASH) {
+        cout << "info string hash must be between 0 and " << raphael::PERFT_MAX_HASH << "\n"
+             << flush;
+        return;
+    }
+
+    raphael::commands::perft(position.board(), depth, threads, hash);
+}
+
 /** Handles the go command
  * E.g., go wtime {wtime} btime {btime}
  *
@@ -130,6 +191,11 @@ inline void handle_go(const vector<string>& tokens) {
         return;
     }
 
+    if (tokens.size() > 1 && tokens[1] == "perft") {
+        handle_perft(tokens, 2);
+        return;
+    }
+
     // get arguments
     raphael::TimeManager::SearchOptions options = {};
 
@@ -224,6 +290,35 @@ inline void handle_ucinewgame() {
     }
 }
 
+/** Handles the savehash and loadhash commands
+ *
+ * \param tokens list of tokens for the command
+ * \param save whether to save or load the hash
+ */
+inline void handle_hashfile(const vector<string>& tokens, bool save) {
+    if (!engine.is_search_complete()) {
+        cout << "info string still searching\n" << flush;
+        return;
+    }
+
+    if (tokens.size() < 2) {
+        cout << "info string missing required positional parameter 'file'\n" << flush;
+        return;
+    }
+
+    try {
+        if (save) {
+            engine.save_hash(tokens[1]);
+            cout << "info string saved hash to " << tokens[1] << "\n" << flush;
+        } else {
+            engine.load_hash(tokens[1]);
+            cout << "info string loaded hash from " << tokens[1] << "\n" << flush;
+        }
+    } catch (const exception& e) {
+        cout << "info string error: " << e.what() << "\n" << flush;
+    }
+}
+
 /** Handles the wait command */
 inline void handle_wait() {
     engine.wait_search();
@@ -231,14 +326,54 @@ inline void handle_wait() {
     cout << "info string search finished\n" << flush;
 }
 
-/** Handles the bench command */
-inline void handle_bench() {
+/** Handles the bench command
+ *
+ * \param tokens list of tokens for the command
+ */
+inline void handle_bench(const vector<string>& tokens) {
     if (!engine.is_search_complete()) {
         cout << "info string still searching\n" << flush;
         return;
     }
 
-    raphael::commands::bench(engine);
+    i32 threads = 1;
+    bool numa = false;
+    string hugenet = "true";
+
+    usize i = 1;
+    while (i + 1 < tokens.size()) {
+        if (tokens[i] == "threads")
+            threads = stoi(tokens[i + 1]);
+        else if (tokens[i] == "numa")
+            numa = (tokens[i + 1] == "true");
+        else if (tokens[i] == "hugenet")
+            hugenet = tokens[i + 1];
+        i += 2;
+    }
+
+    if (threads <= 0) {
+        cout << "info string threads must be positive\n" << flush;
+        return;
+    }
+
+    if (threads != 1) engine.set_option("Threads", threads);
+    if (numa) engine.set_option("NumaAffinity", true);
+
+    if (hugenet == "compare") {
+        // bench with the network on regular pages, then on huge pages
+        engine.set_option("NetHugePages", false);
+        const i64 nps_small = raphael::commands::bench(engine);
+        engine.set_option("NetHugePages", true);
+        const i64 nps_huge = raphael::commands::bench(engine);
+
+        cout << "\nbench: network on 4KB pages " << nps_small << " nps, on huge pages " << nps_huge
+             << " nps (" << std::fixed << std::setprecision(3) << (f64)nps_huge / nps_small
+             << "x)\n"
+             << flush;
+    } else {
+        if (hugenet != "true") engine.set_option("NetHugePages", false);
+        raphael::commands::bench(engine);
+    }
 
     quit = true;
 }
@@ -368,7 +503,102 @@ inline void handle_evalstats(const vector<string>& tokens) {
         return;
     }
 
-    raphael::commands::evalstats(engine, tokens[1]);
+    i32 threads = 1;
+    usize i = 2;
+    while (i < tokens.size()) {
+        if (tokens[i] == "threads") threads = stoi(tokens[i + 1]);
+        i += 2;
+    }
+
+    if (threads <= 0) {
+        cout << "info string threads must be positive\n" << flush;
+        return;
+    }
+
+    raphael::commands::evalstats(engine, tokens[1], threads);
+
+    quit = true;
+}
+
+/** Handles the sparsityprofile command
+ *
+ * \param tokens list of tokens for the command
+ */
+inline void handle_sparsityprofile(const vector<string>& tokens) {
+    if (!engine.is_search_complete()) {
+        cout << "info string still searching\n" << flush;
+        return;
+    }
+
+    if (tokens.size() < 2) {
+        cout << "info string missing required positional parameter 'book'\n" << flush;
+        return;
+    }
+
+    i32 threads = 1;
+    string outfile = "sparsity.perm";
+
+    usize i = 2;
+    while (i < tokens.size()) {
+        if (tokens[i] == "threads")
+            threads = stoi(tokens[i + 1]);
+        else if (tokens[i] == "out")
+            outfile = tokens[i + 1];
+        i += 2;
+    }
+
+    if (threads <= 0) {
+        cout << "info string threads must be positive\n" << flush;
+        return;
+    }
+
+    raphael::commands::sparsityprofile(tokens[1], outfile, threads);
+
+    quit = true;
+}
+
+/** Handles the evalbatch command
+ *
+ * \param tokens list of tokens for the command
+ */
+inline void handle_evalbatch(const vector<string>& tokens) {
+    if (!engine.is_search_complete()) {
+        cout << "info string still searching\n" << flush;
+        return;
+    }
+
+    if (tokens.size() < 3) {
+        cout << "info string missing required positional parameters 'infile' and 'outfile'\n"
+             << flush;
+        return;
+    }
+
+    i32 threads = 1;
+    i64 nodes = 0;
+    bool binary = false;
+
+    usize i = 3;
+    while (i < tokens.size()) {
+        if (tokens[i] == "threads")
+            threads = stoi(tokens[i + 1]);
+        else if (tokens[i] == "nodes")
+            nodes = stoll(tokens[i + 1]);
+        else if (tokens[i] == "format")
+            binary = (tokens[i + 1] == "binary");
+        i += 2;
+    }
+
+    if (threads <= 0) {
+        cout << "info string threads must be positive\n" << flush;
+        return;
+    }
+
+    if (nodes < 0) {
+        cout << "info string nodes must be non-negative\n" << flush;
+        return;
+    }
+
+    raphael::commands::evalbatch(tokens[1], tokens[2], threads, nodes, binary);
 
     quit = true;
 }
@@ -378,8 +608,19 @@ inline void show_help() {
     // help message style from pawnocchio
     cout << "Raphael " << engine.version << "\n\n"
          << "TOOLS:\n"
-         << "  bench\n"
-         << "      run benchmark\n\n"
+         << "  bench [threads THREADS] [numa NUMA] [hugenet HUGENET]\n"
+         << "      run benchmark\n"
+         << "      THREADS: number of threads to search with. default 1\n"
+         << "      NUMA: whether to bind threads to numa nodes and report nps per node, "
+            "true/false. default false\n"
+         << "      HUGENET: whether to copy the network into huge pages, true/false/compare. "
+            "compare benches both and reports the nps of each. default true\n\n"
+         << "  perft <DEPTH> [threads THREADS] [hash HASH]\n"
+         << "      count the leaves of the legal move tree of the current position, printing the\n"
+         << "      count under each root move. also available as go perft\n"
+         << "      DEPTH: depth to count to\n"
+         << "      THREADS: number of threads to split the root moves between. default 1\n"
+         << "      HASH: perft hash table size in MiB, 0 to disable. default 0\n\n"
          << "  genfens <COUNT> [seed SEED] [book BOOK] [randmoves RANDMOVES] [dfrc DFRC]\n"
          << "      generate FENs\n"
          << "      COUNT: number of FENs to generate\n"
@@ -396,9 +637,25 @@ inline void show_help() {
          << "      RANDMOVES: number of random moves to play from book position. default 0\n"
          << "      DFRC: whether to generate DFRC positions, true/false. default false\n"
          << "      THREADS: number of threads to generate with\n\n"
-         << "  evalstats <BOOK>\n"
+         << "  evalstats <BOOK> [threads THREADS]\n"
          << "      print statistics of NNUE evaluation\n"
-         << "      BOOK: book to benchmark with\n\n"
+         << "      BOOK: book to benchmark with\n"
+         << "      THREADS: number of threads to evaluate with. default 1\n\n"
+         << "  sparsityprofile <BOOK> [threads THREADS] [out OUTFILE]\n"
+         << "      measure how often each ft neuron fires and write the neuron order that\n"
+         << "      groups active neurons, apply it to a network with ./perm <NETWORK> <OUTFILE>\n"
+         << "      BOOK: book to profile with\n"
+         << "      THREADS: number of threads to evaluate with. default 1\n"
+         << "      OUTFILE: file to write the neuron order to. default sparsity.perm\n\n"
+         << "  evalbatch <INFILE> <OUTFILE> [threads THREADS] [nodes NODES] [format FORMAT]\n"
+         << "      score every position with the raw and corrected static eval, and optionally\n"
+         << "      the score and bestmove of a fixed node search. text lines are written as\n"
+         << "      <fen> | <raw> | <corrected> [| <bestmove> | <score>]\n"
+         << "      INFILE: fen/epd file to score\n"
+         << "      OUTFILE: file to write results to, in the same order as INFILE\n"
+         << "      THREADS: number of threads to score with. default 1\n"
+         << "      NODES: nodes to search each position with, or 0 to skip the search. default 0\n"
+         << "      FORMAT: output format, text/binary (8 byte records). default text\n\n"
          << "  obspsa\n"
          << "      print the OpenBench SPSA configs\n\n"
          << "  help\n"
@@ -410,7 +667,10 @@ inline void show_help() {
          << "  ucinewgame               - clear Hash and reset\n"
          << "  position                 - set board (fen <FEN> | startpos) [moves ...]\n"
          << "  go                       - start search. params: depth, nodes, movetime, movestogo\n"
-         << "                             wtime, btime, winc, binc, infinite\n"
+         << "                             wtime, btime, winc, binc, infinite, perft <DEPTH>\n"
+         << "  savehash <FILE>          - save the transposition table to a file\n"
+         << "  loadhash <FILE>          - load the transposition table from a file saved with the\n"
+         << "                             same Hash size\n"
          << "  eval                     - show raw static eval\n"
          << "  ceval                    - show corrected static eval\n"
          << "  fen                      - show current position's fen\n"
@@ -432,8 +692,11 @@ inline void handle_command(const string& uci_command) {
         const auto params = engine.default_params();
         cout << "id name Raphael " << engine.version << "\n"
              << "id author Rei Meguro\n"
-             << params.hash.uci() << params.threads.uci()
-             << "option name UCI_Chess960 type check default false\n"
+             << params.hash.uci() << params.evalcache.uci() << params.largepages.uci()
+             << params.sharedhash.uci() << params.sliderlookup.uci() << params.threads.uci()
+             << "option name UCI_Chess960 type check default false\n" << params.evalfile.uci()
+             << params.smallevalfile.uci() << params.nethugepages.uci()
+             << params.numa.uci()
              << params.moveoverhead.uci() << params.datagen.uci() << params.softnodes.uci()
              << params.softhardmult.uci();
 #ifdef TUNE
@@ -467,10 +730,7 @@ inline void handle_command(const string& uci_command) {
         cout << "info string this is not a tunable build\n" << flush;
 #endif
 
-    } else if (uci_command == "bench")
-        handle_bench();
-
-    else if (uci_command == "eval")
+    } else if (uci_command == "eval")
         handle_eval(false);
 
     else if (uci_command == "ceval")
@@ -500,6 +760,18 @@ inline void handle_command(const string& uci_command) {
         else if (keyword == "go")
             handle_go(tokens);
 
+        else if (keyword == "savehash")
+            handle_hashfile(tokens, true);
+
+        else if (keyword == "loadhash")
+            handle_hashfile(tokens, false);
+
+        else if (keyword == "bench")
+            handle_bench(tokens);
+
+        else if (keyword == "perft")
+            handle_perft(tokens, 1);
+
         else if (keyword == "genfens")
             handle_genfens(tokens);
 
@@ -509,6 +781,12 @@ inline void handle_command(const string& uci_command) {
         else if (keyword == "evalstats")
             handle_evalstats(tokens);
 
+        else if (keyword == "evalbatch")
+            handle_evalbatch(tokens);
+
+        else if (keyword == "sparsityprofile")
+            handle_sparsityprofile(tokens);
+
         else
             cout << "info string unknown command: '" << keyword << "'\n" << flush;
     }